@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "digest.h"
+
+/*
+ * Look up the entries of one segment of x in y.  Keys missing from y are
+ * reported; so are different values, but only from the a side, as b has
+ * the same key under a differing leaf and would report it again.
+ */
+static long diff_segment(hashtable *x, hashtable *y, size_t seg, BOOL report_values, ht_key_cb cb, void *arg) {
+    size_t i, first = ht_segment_first_slot(seg), last = ht_segment_first_slot(seg + 1);
+    ht_str *key, *value;
+    long reported = 0;
+
+    if (last > x->capacity)
+        last = x->capacity;
+    for (i = first; i < last; i++) {
+        if (ht_slot(x, i, &key, &value) != HT_SLOT_USED)
+            continue;
+        ht_str *other = ht_get(y, key->str, key->size);
+        if (other == NULL || (report_values &&
+                (other->size != value->size || memcmp(other->str, value->str, value->size) != 0))) {
+            cb(arg, key->str, key->size);
+            reported++;
+        }
+    }
+    return reported;
+}
+
+static long diff_subtree(hashtable *a, hashtable *b, size_t node, ht_key_cb cb, void *arg) {
+    if (ht_digest_node(a, node) == ht_digest_node(b, node))
+        return 0;
+    if (node < a->digest_leaves)
+        return diff_subtree(a, b, 2 * node, cb, arg) + diff_subtree(a, b, 2 * node + 1, cb, arg);
+
+    size_t seg = node - a->digest_leaves;
+    return diff_segment(a, b, seg, True, cb, arg) + diff_segment(b, a, seg, False, cb, arg);
+}
+
+long ht_diff(hashtable *a, hashtable *b, ht_key_cb cb, void *arg) {
+    size_t seg;
+    long reported = 0;
+
+    if (!(a->flags & HT_DIGEST) || !(b->flags & HT_DIGEST)) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (ht_digest(a) == ht_digest(b))
+        return 0;
+    if (a->capacity == b->capacity)
+        return diff_subtree(a, b, 1, cb, arg);
+
+    for (seg = 0; seg < ht_segment_count(a); seg++)
+        reported += diff_segment(a, b, seg, True, cb, arg);
+    for (seg = 0; seg < ht_segment_count(b); seg++)
+        reported += diff_segment(b, a, seg, False, cb, arg);
+    return reported;
+}
@@ -0,0 +1,19 @@
+#ifndef __HT_DIGEST__
+#define __HT_DIGEST__
+
+#include "hashtable.h"
+
+typedef void (*ht_key_cb)(void *arg, const char *key, u_int32 key_size);
+
+/*
+ * Report every key whose entry differs between a and b (missing from one
+ * of them, or with another value) to cb(arg, key, key_size).  Both tables
+ * need HT_DIGEST.  Equal roots end it at once; with the same capacity
+ * the trees are compared top-down and only the segments under differing
+ * leaves are walked, otherwise every segment is.  The caller holds both
+ * table locks.  Returns the number of keys reported, or -1 with errno
+ * set to ENOTSUP.
+ */
+long ht_diff(hashtable *a, hashtable *b, ht_key_cb cb, void *arg);
+
+#endif
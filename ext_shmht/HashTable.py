@@ -8,6 +8,25 @@ import marshal
 #basic wrapper: open, close, get, set, remove, foreach
 #extended wrapper: getobj, setobj, [], to_dict, update
 
+class Slot(object):
+    """
+    The slot of one key of a HashTable, from h.find(key).
+    """
+    def __init__(self, fd, key):
+        self.fd = fd
+        self.key = key
+        self.ref = _shmht.find(fd, key)
+
+    def get(self, default=None):
+        self.ref, val = _shmht.slot_get(self.fd, self.key, self.ref)
+        if val == None:
+            return default
+        return val
+
+    def set(self, value):
+        self.ref = _shmht.slot_set(self.fd, self.key, value, self.ref)
+        return True
+
 class HashTable(object):
     """
     Simple hash table stored in shared memory.
@@ -15,7 +34,7 @@ class HashTable(object):
             (bug: fix this someday)
         string keys, max len = 256
         string data, max len = 1024
-            (bug: make this settable per table someday)
+            (for LOG tables, as large as the log: up to 2G)
 
     import pyshmht
     h = pyshmht.HashTable( filename, max_entries )
@@ -42,6 +61,137 @@ class HashTable(object):
     print 'key' in h
         #
 
+    h.flush()
+        # msync the parts of the file changed since the last flush
+
+    h.start_flusher(interval=1.0, threshold=0)
+        # flush in a background thread every 'interval' seconds, or as
+        # soon as 'threshold' bytes are dirty; h.stop_flusher() ends it
+
+    h.snapshot(path, since=None)
+        # write the live entries to a compact, checksummed file; with
+        # since=<previous snapshot file>, only the parts changed since then
+
+    h.restore(path, threads=0, deltas=())
+        # replace the contents with a snapshot, then apply the deltas
+        # in order; 0 threads means one per cpu
+
+    h.backup(path)
+        # like snapshot, but writers keep going while it runs; the table
+        # must be created with flags=_shmht.BACKUP, which does not go
+        # with LOG, SPLIT or TIERED
+
+    h.start_mirror(path, interval=0.1, workers=2)
+        # keep a disk copy of a /dev/shm table up to date in the
+        # background; h.sync_mirror() waits for it, h.stop_mirror() ends it
+
+    h = HashTable(filename, max_entries, flags=_shmht.LOG, log_size=0)
+        # values are appended to a log, slots only hold offsets; space of
+        # old values comes back with h.compact(), or in the background
+        # with h.start_compactor(interval=1.0, ratio=0.5); see
+        # h.log_usage()
+
+    h = HashTable(filename, max_entries, flags=_shmht.SPLIT)
+        # LOG, with the hash and size of each key next to its offset in
+        # a 16-byte slot: probes scan the index and read only the record
+        # they are after
+
+    h = HashTable(filename, max_entries, flags=_shmht.SPLIT | _shmht.PAGED)
+        # for tables much larger than memory: a probe looks through the
+        # page of the key's home slot first, so a lookup usually faults
+        # in one page of slots (and one of records for the key found);
+        # PAGED needs SPLIT or INTKEY, whose slots tell keys apart
+
+    h = HashTable(filename, max_entries, cold_path=cold_filename, cold_size=0)
+    h.demote(idle_seconds, max_bytes=0)
+        # a TIERED table: LOG, and values neither read nor written for
+        # idle_seconds move to the cold file, on disk, leaving the log
+        # space to h.compact(); reads find them there all the same.
+        # h.set_promote(True) makes reads through h move them back.
+        # h.tier_usage() is (log live, cold live, cold used, cold size)
+        # bytes, cold live being what the table no longer keeps in memory
+
+    h = HashTable(filename, max_entries, flags=_shmht.JOURNAL, journal_size=0)
+    r = HashTable(replica_filename, max_entries)
+    r.follow(h)
+        # apply the changes made to h since the last follow; call it in
+        # a loop to keep a replica.  pos, changes = h.read_journal(pos)
+        # hands out the (seq, key, value) records to anybody else
+
+    h = HashTable(filename, max_entries, flags=_shmht.BLOOM)
+        # a Bloom filter answers most lookups of missing keys without a
+        # probe; h.compact() drops removed keys from it
+
+    h.digest()
+    h.diff(other)
+        # with flags=_shmht.DIGEST: a hash of the whole contents, equal
+        # for equal contents; the keys that differ from another table
+
+    HashTable.publish(new_filename, filename)
+        # atomically put a rebuilt table in place of filename; tables
+        # open on filename move to it at their next operation.
+        # h.generation() counts the publishes
+
+    h.seal()
+    h = HashTable(filename, readonly=True)
+        # a sealed table never changes again, and its readers skip the
+        # lock; a read-only handle never writes to the file
+
+    HashTable.freeze(new_filename, h_or_dict)
+        # write a table file for lookups only: a minimal perfect hash
+        # over the packed entries of a table, a dict or (key, value)
+        # pairs.  open it like any other table, or publish it
+
+    h = HashTable(filename, max_entries, namespace='users', quota=0)
+        # one of up to 255 named tables in the same file, sharing its
+        # slots (and log) and its single mapping; quota limits the bytes
+        # of keys and values in it.  h.namespaces() lists them as
+        # (name, entries, bytes, quota)
+
+    h.merge([a, b], on_conflict='overwrite', threads=0)
+        # put the entries of other tables into h, in C; a key h has
+        # already gets the value of the source ('overwrite'), keeps its
+        # own ('keep'), the sum of the two decimal integers ('incr') or
+        # the source value appended ('append')
+
+    h = HashTable(filename, max_entries, flags=_shmht.SET)
+    h.add('key'); 'key' in h
+        # keys only: a slot is 256 bytes instead of 1280, and values are
+        # refused (or, when copied in from another table, dropped)
+
+    h = HashTable(filename, max_entries, flags=_shmht.MULTI)
+    h.add('key', 'one'); h.add('key', 'two')
+    h.getall('key', start=0, count=-1); h.iterall('key'); h.count('key')
+    h.discard('key', 'one')
+        # several values per key, in the order added; each is reached
+        # without reading the others.  h['key'] is the first, setting it
+        # drops the rest, foreach sees every (key, value)
+
+    h = HashTable(filename, max_entries, flags=_shmht.INTKEY)
+    h.iset(12345, 678); h.iset(12345, 'bytes')
+    h.iget(12345); h.igetint(12345); h.iremove(12345)
+        # 64-bit integer keys, hashed with an integer mixer and kept in
+        # a 24-byte slot with a value of up to 8 bytes (an integer is
+        # stored as its 8 bytes); add _shmht.LOG for longer values.
+        # foreach and to_dict see keys as struct.pack('=Q', key)
+
+    HashTable.load(new_filename, source, threads=0, flags=0)
+        # build a table sized for exactly the entries of source, in
+        # parallel: a file of key<TAB>value lines (delimiter=None for
+        # length-prefixed records), a dict, or (key, value) pairs such
+        # as zip(keys, values)
+
+    slot = h.find('key')
+    slot.get(default=None); slot.set('data')
+        # a handle on the slot of one key: while no key is removed from
+        # the table, its reads and writes skip the hashing and the probe
+        # and go straight to the slot; after that, the next call looks
+        # the key up again.  not for namespaces or MULTI
+
+    threading.Thread(target=worker, args=(h,))
+        # threads can share one HashTable: each table has a mutex that
+        # keeps them apart, as the file lock keeps other processes out
+
     h.close()
 
     ## for string key and non-string python objects
@@ -49,7 +199,7 @@ class HashTable(object):
     to a string for storage.
 
     """
-    def __init__(self, name, capacity=0, force_init=False, serializer=marshal, mkdirs=False):
+    def __init__(self, name, capacity=0, force_init=False, serializer=marshal, mkdirs=False, flags=0, log_size=0, journal_size=0, readonly=False, namespace=None, quota=0, cold_path=None, cold_size=0):
         if mkdirs:
             try:
                 d = os.path.dirname(name)
@@ -57,13 +207,107 @@ class HashTable(object):
             except OSError :
                 pass
         force_init = 1 if force_init else 0
-        self.fd = _shmht.open(name, capacity, force_init)
+        readonly = 1 if readonly else 0
+        self.fd = _shmht.open(name, capacity, force_init, flags, log_size, journal_size, readonly, namespace, quota, cold_path, cold_size)
         self.loads = serializer.loads
         self.dumps = serializer.dumps
 
     def close(self):
         _shmht.close(self.fd)
 
+    def flush(self):
+        return _shmht.flush(self.fd)
+
+    def start_flusher(self, interval=1.0, threshold=0):
+        return _shmht.start_flusher(self.fd, interval, threshold)
+
+    def stop_flusher(self):
+        return _shmht.stop_flusher(self.fd)
+
+    def snapshot(self, path, since=None):
+        return _shmht.snapshot(self.fd, path, since)
+
+    def restore(self, path, threads=0, deltas=()):
+        n = _shmht.restore(self.fd, path, threads)
+        for delta in deltas:
+            _shmht.restore(self.fd, delta, threads)
+        return n
+
+    def backup(self, path):
+        return _shmht.backup(self.fd, path)
+
+    def start_mirror(self, path, interval=0.1, workers=2):
+        return _shmht.start_mirror(self.fd, path, interval, workers)
+
+    def sync_mirror(self):
+        return _shmht.sync_mirror(self.fd)
+
+    def stop_mirror(self):
+        return _shmht.stop_mirror(self.fd)
+
+    def compact(self):
+        return _shmht.compact(self.fd)
+
+    def start_compactor(self, interval=1.0, ratio=0.5):
+        return _shmht.start_compactor(self.fd, interval, ratio)
+
+    def stop_compactor(self):
+        return _shmht.stop_compactor(self.fd)
+
+    def log_usage(self):
+        return _shmht.log_usage(self.fd)
+
+    def demote(self, idle_seconds, max_bytes=0):
+        return _shmht.demote(self.fd, idle_seconds, max_bytes)
+
+    def tier_usage(self):
+        return _shmht.tier_usage(self.fd)
+
+    def set_promote(self, promote=True):
+        return _shmht.set_promote(self.fd, 1 if promote else 0)
+
+    def read_journal(self, pos=None, max_records=1000):
+        return _shmht.read_journal(self.fd, pos, max_records)
+
+    def follow(self, primary):
+        return _shmht.follow(self.fd, primary.fd)
+
+    def digest(self):
+        return _shmht.digest(self.fd)
+
+    def diff(self, other):
+        return _shmht.diff(self.fd, other.fd)
+
+    @staticmethod
+    def publish(path, name):
+        return _shmht.publish(path, name)
+
+    def generation(self):
+        return _shmht.generation(self.fd)
+
+    def seal(self):
+        return _shmht.seal(self.fd)
+
+    def namespaces(self):
+        return _shmht.namespaces(self.fd)
+
+    def merge(self, sources, on_conflict='overwrite', threads=0):
+        return _shmht.merge(self.fd, [ src.fd for src in sources ], on_conflict, threads)
+
+    @staticmethod
+    def freeze(path, source):
+        if isinstance(source, HashTable):
+            source = source.fd
+        elif hasattr(source, 'items'):
+            source = source.items()
+        return _shmht.freeze(path, source)
+
+    @staticmethod
+    def load(path, source, threads=0, flags=0, journal_size=0, delimiter='\t'):
+        if hasattr(source, 'items'):
+            source = source.items()
+        return _shmht.load(path, source, threads, flags, journal_size, delimiter)
+
     def get(self, key, default=None):
         val = _shmht.getval(self.fd, key)
         if val == None:
@@ -81,6 +325,9 @@ class HashTable(object):
     def remove(self, key):
         return _shmht.remove(self.fd, key)
 
+    def find(self, key):
+        return Slot(self.fd, key)
+
     def foreach(self, callback, unserialize=False):
         if not unserialize:
             cb = callback
@@ -91,6 +338,46 @@ class HashTable(object):
             cb = mcb
         return _shmht.foreach(self.fd, cb)
 
+    def add(self, key, value=''):
+        return _shmht.add(self.fd, key, value)
+
+    def count(self, key):
+        return _shmht.count(self.fd, key)
+
+    def getall(self, key, start=0, count=-1):
+        return _shmht.values(self.fd, key, start, count)
+
+    def iterall(self, key, chunk=64):
+        start = 0
+        while True:
+            values = _shmht.values(self.fd, key, start, chunk)
+            for value in values:
+                yield value
+            if len(values) < chunk:
+                return
+            start += chunk
+
+    def discard(self, key, value):
+        return _shmht.discard(self.fd, key, value)
+
+    def iget(self, key, default=None):
+        val = _shmht.igetval(self.fd, key)
+        if val == None:
+            return default
+        return val
+
+    def igetint(self, key, default=None):
+        val = _shmht.igetval(self.fd, key, 1)
+        if val == None:
+            return default
+        return val
+
+    def iset(self, key, value):
+        return _shmht.isetval(self.fd, key, value)
+
+    def iremove(self, key):
+        return _shmht.iremove(self.fd, key)
+
     def getobj(self, key, default=None):
         val = self.get(key, default)
         if val == default:
@@ -197,28 +484,37 @@ if __name__ == "__main__":
     except:
         print True
 
-    #simple performance test
-    import time
+    #simple performance test: HashTable.py [capacity [filename [intkey]]]
+    #intkey uses 24-byte INTKEY slots, for runs of billions of entries
+    import sys, time
 
-    capacity = 300000
+    capacity = int(sys.argv[1]) if len(sys.argv) > 1 else 300000
+    filename = sys.argv[2] if len(sys.argv) > 2 else '/dev/shm/test.HashTable'
+    intkey = len(sys.argv) > 3 and sys.argv[3] == 'intkey'
 
     #write_through
-    ht = HashTable('/dev/shm/test.HashTable', capacity, True)
+    ht = HashTable(filename, capacity, True, flags=_shmht.INTKEY if intkey else 0)
 
     begin_time = time.time()
-    for i in range(capacity):
-        s = '%064d' % i
-        ht[s] = s
+    for i in xrange(capacity):
+        if intkey:
+            ht.iset(i, i)
+        else:
+            s = '%064d' % i
+            ht[s] = s
     end_time = time.time()
     print capacity / (end_time - begin_time), 'iops @ set'
 
-    begin_timend_time = time.time()
-    for i in range(capacity):
-        s = '%064d' % i
-        if s != ht[s]:
-            raise Exception(s)
+    begin_time = time.time()
+    for i in xrange(capacity):
+        if intkey:
+            if ht.igetint(i) != i:
+                raise Exception(i)
+        else:
+            s = '%064d' % i
+            if s != ht[s]:
+                raise Exception(s)
     end_time = time.time()
     print capacity / (end_time - begin_time), 'iops @ get'
 
     ht.close()
-
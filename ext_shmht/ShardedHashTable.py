@@ -0,0 +1,186 @@
+#!/usr/bin/python
+#coding: utf-8
+
+import os
+import json
+import marshal
+from . import _shmht
+
+MANIFEST_FORMAT = 'shmht-shards'
+
+class ShardedHashTable(object):
+    """
+    Keys hashed onto several table files, each with its own lock and
+    its own capacity, so writers of different keys mostly do not wait
+    for each other, and a full shard grows without touching the rest.
+
+    h = ShardedHashTable( manifest, shards=8, capacity=1000000 )
+        # the first process creates manifest.0 .. manifest.7, each with
+        # room for capacity / shards entries, and then the manifest; flags,
+        # log_size and journal_size are those of every shard
+    h = ShardedHashTable( manifest )
+        # everybody else finds the shards in the manifest
+
+    h['key'] = 'data'; h.get('key'); del h['key']; 'key' in h
+        # like HashTable, on the shard of the key
+
+    h.get_many(keys)
+    h.update(dict_or_pairs)
+        # one call, and one lock, per shard touched
+
+    h.grow(shard, capacity)
+        # rebuild one shard with room for capacity entries and publish it
+        # under its name; h.shard_of(key) tells which shard holds a key
+
+    The manifest is a small json file naming the shard files, relative
+    to its own directory.  It never changes after it is written, since
+    the geometry of a shard lives in the shard itself.
+    """
+    def __init__(self, manifest, shards=0, capacity=0, flags=0, log_size=0, journal_size=0, readonly=False, serializer=marshal):
+        self.manifest = manifest
+        self.loads = serializer.loads
+        self.dumps = serializer.dumps
+        self.fds = []
+        if not os.path.exists(manifest):
+            if shards <= 0:
+                raise _shmht.error('no shard manifest at %s' % manifest)
+            if not self._create(shards, capacity, flags, log_size, journal_size):
+                self.close()
+        if not self.fds:
+            self._attach(readonly)
+        self.n = len(self.fds)
+
+    def _shard_files(self, names):
+        d = os.path.dirname(self.manifest)
+        return [ os.path.join(d, name) for name in names ]
+
+    def _create(self, shards, capacity, flags, log_size, journal_size):
+        base = os.path.basename(self.manifest)
+        names = [ '%s.%d' % (base, i) for i in range(shards) ]
+        per_shard = capacity // shards + 1
+        for path in self._shard_files(names):
+            self.fds.append(_shmht.open(path, per_shard, 0, flags, log_size, journal_size, 0))
+
+        # the shards exist before the manifest does; of two processes
+        # creating the same table, the first link wins
+        tmp = '%s.%d.tmp' % (self.manifest, os.getpid())
+        f = open(tmp, 'w')
+        json.dump({ 'format': MANIFEST_FORMAT, 'version': 1, 'shards': names }, f)
+        f.close()
+        try:
+            os.link(tmp, self.manifest)
+            return True
+        except OSError:
+            return False
+        finally:
+            os.unlink(tmp)
+
+    def _attach(self, readonly):
+        f = open(self.manifest)
+        try:
+            m = json.load(f)
+        finally:
+            f.close()
+        if m.get('format') != MANIFEST_FORMAT or m.get('version') != 1:
+            raise _shmht.error('%s is not a shard manifest' % self.manifest)
+        readonly = 1 if readonly else 0
+        for path in self._shard_files(m['shards']):
+            self.fds.append(_shmht.open(path, 0, 0, 0, 0, 0, readonly))
+
+    def close(self):
+        for fd in self.fds:
+            _shmht.close(fd)
+        self.fds = []
+
+    def flush(self):
+        return sum(_shmht.flush(fd) for fd in self.fds)
+
+    def shard_of(self, key):
+        return _shmht.shard(key, self.n)
+
+    def _fd(self, key):
+        return self.fds[_shmht.shard(key, self.n)]
+
+    def grow(self, shard, capacity, threads=0):
+        return _shmht.grow(self.fds[shard], capacity, threads)
+
+    def get(self, key, default=None):
+        val = _shmht.getval(self._fd(key), key)
+        if val == None:
+            return default
+        return val
+
+    def set(self, key, value):
+        return _shmht.setval(self._fd(key), key, value)
+
+    def put(self, key, value):
+        return _shmht.setval(self._fd(key), key, value)
+
+    def remove(self, key):
+        return _shmht.remove(self._fd(key), key)
+
+    def get_many(self, keys):
+        keys = list(keys)
+        positions = [ [] for i in range(self.n) ]
+        for i, key in enumerate(keys):
+            positions[_shmht.shard(key, self.n)].append(i)
+        values = [ None ] * len(keys)
+        for shard, at in enumerate(positions):
+            if at:
+                found = _shmht.getvals(self.fds[shard], [ keys[i] for i in at ])
+                for i, val in zip(at, found):
+                    values[i] = val
+        return values
+
+    def update(self, d, serialize=False):
+        pairs = d.items() if hasattr(d, 'items') else d
+        by_shard = [ [] for i in range(self.n) ]
+        dumps = self.dumps
+        for key, value in pairs:
+            if serialize:
+                value = dumps(value)
+            by_shard[_shmht.shard(key, self.n)].append((key, value))
+        for shard, items in enumerate(by_shard):
+            if items:
+                _shmht.setvals(self.fds[shard], items)
+
+    def foreach(self, callback, unserialize=False):
+        if unserialize:
+            loads = self.loads
+            cb = lambda key, value: callback(key, loads(value))
+        else:
+            cb = callback
+        for fd in self.fds:
+            _shmht.foreach(fd, cb)
+
+    def getobj(self, key, default=None):
+        val = self.get(key)
+        if val == None:
+            return default
+        return self.loads(val)
+
+    def setobj(self, key, val):
+        return self.set(key, self.dumps(val))
+
+    def __getitem__(self, key):
+        val = _shmht.getval(self._fd(key), key)
+        if val == None:
+            raise KeyError(key)
+        return val
+
+    def __setitem__(self, key, value):
+        return _shmht.setval(self._fd(key), key, value)
+
+    def __delitem__(self, key):
+        if False == _shmht.remove(self._fd(key), key):
+            raise KeyError(key)
+
+    def __contains__(self, key):
+        return _shmht.getval(self._fd(key), key) != None
+
+    def to_dict(self, unserialize=False):
+        d = {}
+        def insert(k, v):
+            d[k] = v
+        self.foreach(insert, unserialize)
+        return d
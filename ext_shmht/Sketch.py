@@ -0,0 +1,77 @@
+#!/usr/bin/python
+#coding: utf-8
+
+from . import _shmht
+
+class _Sketch(object):
+    def close(self):
+        if self.fd is not None:
+            _shmht.sketch_close(self.fd)
+            self.fd = None
+
+    def merge(self, other):
+        return _shmht.sketch_merge(self.fd, other.fd)
+
+    def clear(self):
+        return _shmht.sketch_clear(self.fd)
+
+class HyperLogLog(_Sketch):
+    """
+    Count of distinct keys, approximately, shared through a file like
+    a HashTable.  Adds from any process or thread need no lock.
+
+    h = HyperLogLog( filename, precision=14 )
+        # 2**precision bytes, standard error about 1.04 / sqrt(2**precision);
+        # precision 4 to 18.  an existing sketch must have the same one
+    h = HyperLogLog( filename, 0 )
+        # attach to whatever sketch the file has
+
+    h.add('key'); h.add(keys)
+    len(h); h.count()
+        # estimated number of distinct keys ever added
+
+    h.merge(other)
+        # the union of both, into h; both must have the same precision
+    """
+    def __init__(self, name, precision=14, force_init=False):
+        self.fd = _shmht.hll_open(name, precision, 1 if force_init else 0)
+
+    def add(self, keys):
+        return _shmht.hll_add(self.fd, keys)
+
+    def count(self):
+        return _shmht.hll_count(self.fd)
+
+    def __len__(self):
+        return int(round(_shmht.hll_count(self.fd)))
+
+class CountMinSketch(_Sketch):
+    """
+    Count of each key, approximately and never too low, shared through
+    a file like a HashTable.  Adds from any process or thread need no lock.
+
+    c = CountMinSketch( filename, width=2048, depth=4 )
+        # width * depth counters of 8 bytes; an estimate is within
+        # 2.7 / width of the total of all counts of the truth, except with
+        # probability e**-depth
+    c = CountMinSketch( filename, 0 )
+        # attach to whatever sketch the file has
+
+    c.add('key'); c.add('key', 5); c.add(keys)
+    c['key']; c.estimate(keys)
+        # estimated count of a key; a list of counts for several
+
+    c.merge(other)
+        # adds the counts of other, of the same width and depth, into c
+    """
+    def __init__(self, name, width=2048, depth=4, force_init=False):
+        self.fd = _shmht.cms_open(name, width, depth if width else 0, 1 if force_init else 0)
+
+    def add(self, keys, count=1):
+        return _shmht.cms_add(self.fd, keys, count)
+
+    def estimate(self, keys):
+        return _shmht.cms_estimate(self.fd, keys)
+
+    def __getitem__(self, key):
+        return _shmht.cms_estimate(self.fd, key)
@@ -2,4 +2,6 @@
 
 from HashTable import HashTable
 from Cacher import Cacher, MemCacher
+from ShardedHashTable import ShardedHashTable
 
+from Sketch import HyperLogLog, CountMinSketch
@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "frozen.h"
+
+#define keys_per_bucket     5
+#define max_displacement    (1U << 20)
+#define max_seeds           16
+
+typedef struct _mph {
+    size_t n, n_buckets, seed;
+    size_t *hash;           //per pair
+    size_t *start;          //pairs of bucket b: order[start[b] .. start[b + 1])
+    size_t *order;
+    size_t *by_size;        //buckets, largest first
+    size_t *slot_pair;      //pair in each slot
+    u_int32 *disp;          //per bucket
+    char *taken;            //per slot
+} mph;
+
+static void mph_free(mph *m) {
+    free(m->hash), free(m->start), free(m->order), free(m->by_size);
+    free(m->slot_pair), free(m->disp), free(m->taken);
+}
+
+//group the pairs by bucket, and the buckets by size, both counting sorts
+static void mph_buckets(mph *m, const ht_pair *pairs) {
+    size_t i, b, max_size = 0;
+
+    bzero(m->start, sizeof(size_t) * (m->n_buckets + 1));
+    for (i = 0; i < m->n; i++) {
+        m->hash[i] = ht_frozen_hash(m->seed, pairs[i].key, pairs[i].key_size);
+        m->start[ht_frozen_bucket(m->hash[i], m->n_buckets) + 1]++;
+    }
+    for (b = 0; b < m->n_buckets; b++) {
+        if (m->start[b + 1] > max_size)
+            max_size = m->start[b + 1];
+        m->start[b + 1] += m->start[b];
+    }
+    size_t *fill = ALLOC(size_t, m->n_buckets);
+    memcpy(fill, m->start, sizeof(size_t) * m->n_buckets);
+    for (i = 0; i < m->n; i++)
+        m->order[fill[ht_frozen_bucket(m->hash[i], m->n_buckets)]++] = i;
+    free(fill);
+
+    size_t *count = ALLOC(size_t, max_size + 2), s, at = 0;
+    bzero(count, sizeof(size_t) * (max_size + 2));
+    for (b = 0; b < m->n_buckets; b++)
+        count[m->start[b + 1] - m->start[b]]++;
+    for (s = max_size + 1; s-- > 0; ) {
+        size_t c = count[s];
+        count[s] = at;
+        at += c;
+    }
+    for (b = 0; b < m->n_buckets; b++)
+        m->by_size[count[m->start[b + 1] - m->start[b]]++] = b;
+    free(count);
+}
+
+//try to send every pair of bucket b to a free slot with displacement d
+static int mph_fits(mph *m, size_t b, u_int32 d, size_t *slots) {
+    size_t k, j, size = m->start[b + 1] - m->start[b];
+    for (k = 0; k < size; k++) {
+        slots[k] = ht_frozen_slot(m->hash[m->order[m->start[b] + k]], d, m->n);
+        if (m->taken[slots[k]])
+            return False;
+        for (j = 0; j < k; j++)
+            if (slots[j] == slots[k])
+                return False;
+    }
+    return True;
+}
+
+//two pairs of bucket b with the same key can never be placed
+static int mph_has_duplicate(mph *m, const ht_pair *pairs, size_t b) {
+    size_t k, j;
+    for (k = m->start[b]; k < m->start[b + 1]; k++) {
+        for (j = m->start[b]; j < k; j++) {
+            const ht_pair *x = &pairs[m->order[j]], *y = &pairs[m->order[k]];
+            if (m->hash[m->order[j]] == m->hash[m->order[k]] && x->key_size == y->key_size
+                    && memcmp(x->key, y->key, x->key_size) == 0)
+                return True;
+        }
+    }
+    return False;
+}
+
+/*
+ * Place every pair with the current seed; False if some bucket found no
+ * displacement (try another seed), or with errno EINVAL for a duplicate.
+ */
+static int mph_place(mph *m, const ht_pair *pairs) {
+    size_t i, k, free_slot = 0;
+    size_t slots[64];
+
+    mph_buckets(m, pairs);
+    bzero(m->taken, m->n);
+    bzero(m->disp, sizeof(u_int32) * m->n_buckets);
+
+    for (i = 0; i < m->n_buckets; i++) {
+        size_t b = m->by_size[i], size = m->start[b + 1] - m->start[b];
+        if (size == 0)
+            break;
+        if (size > sizeof(slots) / sizeof(slots[0]))
+            return False;   //hopelessly skewed seed
+
+        if (size == 1) {
+            while (m->taken[free_slot])
+                free_slot++;
+            m->disp[b] = HT_FROZEN_DIRECT | (u_int32)free_slot;
+            m->taken[free_slot] = 1;
+            m->slot_pair[free_slot] = m->order[m->start[b]];
+            continue;
+        }
+
+        u_int32 d;
+        for (d = 1; d < max_displacement; d++)
+            if (mph_fits(m, b, d, slots))
+                break;
+        if (d == max_displacement) {
+            if (mph_has_duplicate(m, pairs, b))
+                errno = EINVAL;
+            return False;
+        }
+        m->disp[b] = d;
+        for (k = 0; k < size; k++) {
+            m->taken[slots[k]] = 1;
+            m->slot_pair[slots[k]] = m->order[m->start[b] + k];
+        }
+    }
+    return True;
+}
+
+static int write_frozen(const char *path, const ht_pair *pairs, mph *m) {
+    char tmp_path[PATH_MAX];
+    size_t i, record_bytes = 0, at = 0;
+
+    for (i = 0; i < m->n; i++)
+        record_bytes += ht_record_size(pairs[i].key_size, pairs[i].value_size);
+    size_t mem_size = ht_frozen_memory_size(m->n, m->n_buckets, record_bytes);
+
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+        errno = ENAMETOOLONG;
+        return False;
+    }
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+        return False;
+    if (ftruncate(fd, mem_size) != 0)
+        goto failed;
+    void *mem = mmap(NULL, mem_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED)
+        goto failed;
+
+    hashtable *ht = ht_frozen_init(mem, m->n, m->n_buckets, m->seed, record_bytes);
+    for (i = 0; i < m->n_buckets; i++)
+        ht_frozen_set_disp(ht, i, m->disp[i]);
+    for (i = 0; i < m->n; i++) {
+        const ht_pair *p = &pairs[m->slot_pair[i]];
+        at = ht_frozen_put(ht, i, at, p->key, p->key_size, p->value, p->value_size);
+    }
+
+    int ok = msync(mem, mem_size, MS_SYNC) == 0;
+    munmap(mem, mem_size);
+    if (!ok || close(fd) != 0) {
+        fd = -1;
+        goto failed;
+    }
+    if (rename(tmp_path, path) != 0) {
+        fd = -1;
+        goto failed;
+    }
+    return True;
+
+failed:
+    {
+        int saved_errno = errno;
+        if (fd >= 0)
+            close(fd);
+        unlink(tmp_path);
+        errno = saved_errno;
+    }
+    return False;
+}
+
+long ht_freeze(const char *path, const ht_pair *pairs, size_t n) {
+    mph m;
+    int attempt, ok = False;
+
+    if (n >= HT_FROZEN_DIRECT) {
+        errno = E2BIG;
+        return -1;
+    }
+
+    bzero(&m, sizeof(m));
+    m.n         = n;
+    m.n_buckets = n / keys_per_bucket + 1;
+    m.hash      = ALLOC(size_t, n + 1);
+    m.start     = ALLOC(size_t, m.n_buckets + 1);
+    m.order     = ALLOC(size_t, n + 1);
+    m.by_size   = ALLOC(size_t, m.n_buckets);
+    m.slot_pair = ALLOC(size_t, n + 1);
+    m.disp      = ALLOC(u_int32, m.n_buckets);
+    m.taken     = ALLOC(char, n + 1);
+    if (!m.hash || !m.start || !m.order || !m.by_size || !m.slot_pair || !m.disp || !m.taken) {
+        mph_free(&m);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    errno = 0;
+    for (attempt = 0; !ok && errno == 0 && attempt < max_seeds; attempt++) {
+        m.seed = 0x5eed0000ULL + attempt * 0x9e3779b97f4a7c15ULL;
+        ok = mph_place(&m, pairs);
+    }
+    if (!ok && errno == 0)
+        errno = EAGAIN;
+
+    if (ok)
+        ok = write_frozen(path, pairs, &m);
+    mph_free(&m);
+    return ok ? (long)n : -1;
+}
@@ -0,0 +1,20 @@
+#ifndef __HT_FROZEN__
+#define __HT_FROZEN__
+
+#include "hashtable.h"
+
+/*
+ * Write an HT_FROZEN table of the n pairs to path (through path.tmp, so
+ * the file appears complete or not at all).  The keys get a minimal
+ * perfect hash, CHD style: they are spread over n / 5 buckets, and the
+ * buckets, largest first, each search for a displacement that sends all
+ * of their keys to free slots; single-key buckets just take a free slot.
+ * The records are packed in slot order.
+ *
+ * Returns n, or -1 with errno set: EINVAL for a duplicate key, E2BIG
+ * for 2^31 keys or more, EAGAIN if no seed worked, or whatever writing
+ * the file failed with.
+ */
+long ht_freeze(const char *path, const ht_pair *pairs, size_t n);
+
+#endif
@@ -6,6 +6,9 @@
 #include <assert.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/mman.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,11 +22,25 @@ extern "C" {
 
 #define ht_flag_base(ht) ((char *)(ht) + (ht)->flag_offset)
 #define ht_bucket_base(ht) ((char *)(ht) + (ht)->bucket_offset)
+#define ht_bucket(ht, i) (ht_bucket_base(ht) + ((ht)->page_slots ? ht_paged_at(ht, i) : (i) * (ht)->slot_size))
+#define ht_paged_at(ht, i) ((i) / (ht)->page_slots * paged_page + (i) % (ht)->page_slots * (ht)->slot_size)
+#define ht_log_base(ht) ((char *)(ht) + (ht)->log_offset)
+#define ht_journal_base(ht) ((char *)(ht) + (ht)->journal_offset)
+#define ht_digest_base(ht) ((size_t *)((char *)(ht) + (ht)->digest_offset))
+#define ht_mph_base(ht) ((u_int32 *)((char *)(ht) + (ht)->mph_offset))
+#define ht_ns_base(ht) ((ht_namespace *)((char *)(ht) + (ht)->ns_offset))
+#define ht_bloom_base(ht) ((unsigned long *)((char *)(ht) + (ht)->bloom_offset))
+#define ht_dirty_base(ht) ((unsigned long *)((char *)(ht) + (ht)->dirty_offset))
+#define ht_mirror_base(ht) ((unsigned long *)((char *)(ht) + (ht)->mirror_offset))
+#define ht_seq_base(ht) ((size_t *)((char *)(ht) + (ht)->seq_offset))
+#define ht_atime_base(ht) ((u_int32 *)((char *)(ht) + (ht)->atime_offset))
+#define ht_cow_base(ht) ((unsigned long *)((char *)(ht) + (ht)->cow_offset))
+#define ht_shadow_segment(ht, seg) ((char *)(ht) + (ht)->shadow_offset + (seg) * segment_bytes)
 
-static const unsigned ht_magic = 0xBFBF;
+static const unsigned ht_magic = 0xBFCF;
 
 enum bucket_flag {
-    empty = 0, used = 1, removed = 2
+    empty = HT_SLOT_EMPTY, used = HT_SLOT_USED, removed = HT_SLOT_REMOVED
 };
 
 size_t header_size = 1024;
@@ -32,16 +49,84 @@ size_t header_size = 1024;
 #define max_key_size    256
 #define max_value_size  (bucket_size - max_key_size)
 
-const float max_load_factor = 0.65;
+//value of every key of an HT_SET table
+static ht_str no_value = { 0, { 0 } };
 
-static const unsigned int primes[] = { 
+//granularity of dirty tracking; one bit per chunk of the mapping in each
+//of two bitmaps, one for msync and one for the disk mirror
+#define dirty_chunk_size (64 * 1024)
+#define bits_per_word    (sizeof(unsigned long) * 8)
+
+//unit of change tracking and of copy-on-write for online backups
+#define segment_slots    512
+#define segment_bytes    (segment_slots * (1 + bucket_size))
+#define page_align(x)    (((x) + 4095) & ~(size_t)4095)
+
+//HT_LOG tables: a slot holds the offset of its record in the log, which
+//is two halves, one taking appends while the other is being compacted.
+//a record is the key and the value as ht_str, each 8-byte aligned
+#define log_slot_size    sizeof(size_t)
+#define log_default_size 256    //bytes of log per slot, for each half
+#define log_full         ((size_t)-1)
+#define log_align(x)     (((x) + 7) & ~(size_t)7)
+#define log_value_at(key_size) log_align(sizeof(u_int32) + (key_size))
+#define log_record_size(key_size, value_size) (log_value_at(key_size) + log_align(sizeof(u_int32) + (value_size)))
+
+//HT_INTKEY tables: a slot is the key, an ht_str of 8 bytes, and then the
+//value, an ht_str of up to 8 bytes; for HT_LOG, the offset of its record
+#define intkey_size         sizeof(size_t)
+#define intkey_slot_size    24
+#define intkey_value_at     (sizeof(u_int32) + intkey_size)
+#define intkey_record_at    16
+#define ht_value_at(ht)     (((ht)->flags & HT_INTKEY) ? intkey_value_at : max_key_size)
+
+//HT_SPLIT tables: a slot is the offset of the record, as for HT_LOG, and
+//then the low bits of the hash and the size of the key, so a probe reads
+//the record only when both agree; the slots are a dense index apart
+//from the payload in the log
+typedef struct _split_slot {
+    size_t record;
+    u_int32 hash, key_size;
+} split_slot;
+
+//HT_TIERED tables: the time of the last read or write of each slot, in
+//seconds, after the journal where it is not dirty-tracked; and where the
+//cold file starts, relative to the log, so record offsets reach it
+#define ht_tier_now()    ((u_int32)time(NULL))
+#define ht_is_cold(ht, record) (((ht)->flags & HT_TIERED) && (record) >= (ht)->cold_offset - (ht)->log_offset)
+
+//HT_PAGED tables: page_slots slots in each page of the bucket area, the
+//rest of the page unused, so no slot straddles two pages
+#define paged_page       4096
+
+//HT_BLOOM tables: blocks of one cache line, 8 bits per slot; a key sets
+//bloom_k bits of the block its hash picks.  removed keys stay in it
+//until the next compaction rebuilds it
+#define bloom_block_bits 512
+#define bloom_block_words (bloom_block_bits / (sizeof(unsigned long) * 8))
+#define bloom_k          7
+#define bloom_seed       0xb10000f1ULL
+
+//HT_JOURNAL tables: ring of change records after the tracked data
+#define journal_default_size (1024 * 1024)
+#define journal_min_size     (64 * 1024)
+#define journal_max_record   (16 * 1024)    //larger changes go out as a reset
+#define journal_header       (sizeof(size_t) + 2 * sizeof(u_int32))
+
+const double max_load_factor = 0.65;
+
+//slot counts; past 1610612741, the next prime above twice the last
+static const size_t primes[] = { 
     53, 97, 193, 389,
     769, 1543, 3079, 6151,
     12289, 24593, 49157, 98317,
     196613, 393241, 786433, 1572869,
     3145739, 6291469, 12582917, 25165843,
     50331653, 100663319, 201326611, 402653189,
-    805306457, 1610612741
+    805306457, 1610612741, 3221225533ULL, 6442451077ULL,
+    12884902183ULL, 25769804377ULL, 51539608777ULL, 103079217557ULL,
+    206158435127ULL, 412316870257ULL, 824633740543ULL, 1649267481107ULL,
+    3298534962241ULL
 };
 static const unsigned int prime_table_length = sizeof (primes) / sizeof (primes[0]);
 
@@ -50,7 +135,7 @@ static inline void fill_ht_str(ht_str *s, const char *str, const u_int32 size) {
     memcpy(s->str, str, size);
 }
 
-static unsigned int ht_get_prime_by(size_t capacity) {
+static size_t ht_get_prime_by(size_t capacity) {
     unsigned i = 0;
     capacity *= 2;
     for (i = 0; i < prime_table_length; i++) {
@@ -60,62 +145,1004 @@ static unsigned int ht_get_prime_by(size_t capacity) {
     return 0;
 }
 
-size_t ht_memory_size(size_t capacity) {
+//the largest capacity the primes above can serve
+size_t ht_max_capacity(void) {
+    return (primes[prime_table_length - 1] - 1) / 2;
+}
+
+static size_t ht_aligned_capacity(size_t capacity) {
+    return (capacity / 8 + 1) * 8; //round up to 8-byte alignment
+}
+
+//one bit per chunk, in whole words; the spare words cover the bitmap itself
+static size_t ht_dirty_map_size(size_t data_size) {
+    return (data_size / dirty_chunk_size / bits_per_word + 2) * sizeof(unsigned long);
+}
+
+static size_t ht_segments(size_t capacity) {
+    return (capacity + segment_slots - 1) / segment_slots;
+}
+
+//HT_DIGEST: leaves of the hash tree, one per segment, rounded up to a power of two
+static size_t ht_digest_leaves(size_t capacity) {
+    size_t leaves = 1;
+    while (leaves < ht_segments(capacity))
+        leaves *= 2;
+    return leaves;
+}
+
+/*
+ * Work out where each region of a table lives; returns the size of the
+ * whole mapping.  Regions after data_size are not dirty-tracked.
+ */
+static size_t ht_layout(hashtable *ht, size_t capacity, unsigned flags, size_t log_size, size_t journal_size) {
+    if (flags & (HT_SPLIT | HT_TIERED))
+        flags |= HT_LOG;
     const int flag_size = 1; //char
-    size_t aligned_capacity = (ht_get_prime_by(capacity) / 4 + 1) * 4; //round up to 4-byte alignment
-    return header_size                      //header
-         + flag_size * aligned_capacity     //flag
-         + bucket_size * aligned_capacity;  //bucket
+    size_t aligned_capacity = ht_aligned_capacity(ht_get_prime_by(capacity));
+    size_t segments = ht_segments(ht_get_prime_by(capacity));
+    size_t slot_size = (flags & HT_INTKEY) ? intkey_slot_size : (flags & HT_SPLIT) ? sizeof(split_slot)
+                     : (flags & HT_LOG) ? log_slot_size
+                     : (flags & HT_SET) ? max_key_size : bucket_size;
+    size_t page_slots = (flags & HT_PAGED) ? paged_page / slot_size : 0;
+    size_t bucket_bytes = page_slots ? (aligned_capacity + page_slots - 1) / page_slots * paged_page
+                                     : slot_size * aligned_capacity;
+    size_t log_half = 0;
+    if (flags & HT_LOG)
+        log_half = page_align(log_size ? log_size : log_default_size * ht_get_prime_by(capacity));
+    size_t digest_leaves = (flags & HT_DIGEST) ? ht_digest_leaves(ht_get_prime_by(capacity)) : 0;
+    size_t ns_size = (flags & HT_NAMESPACES) ? sizeof(ht_namespace) * HT_MAX_NAMESPACES : 0;
+    size_t bloom_blocks = (flags & HT_BLOOM) ? ht_get_prime_by(capacity) / 64 + 1 : 0;
+    size_t tracked_size = header_size                   //header
+                     + ns_size                          //namespace directory
+                     + bloom_blocks * bloom_block_bits / 8 //bloom filter
+                     + flag_size * aligned_capacity     //flag
+                     + sizeof(size_t) * segments        //segment change seq
+                     + sizeof(size_t) * 2 * digest_leaves //hash tree
+                     + bucket_bytes + (page_slots ? paged_page : 0) //bucket, page aligned if paged
+                     + 4096 + 2 * log_half;             //log, page aligned
+
+    ht->orig_capacity = capacity;
+    ht->capacity      = ht_get_prime_by(capacity);
+    ht->flags         = flags;
+    ht->slot_size     = slot_size;
+    ht->page_slots    = page_slots;
+    ht->log_half      = log_half;
+    ht->ns_offset     = header_size;
+    ht->bloom_offset  = ht->ns_offset + ns_size;    //both multiples of a cache line
+    ht->bloom_blocks  = bloom_blocks;
+    ht->flag_offset   = ht->bloom_offset + bloom_blocks * bloom_block_bits / 8;
+    ht->seq_offset    = ht->flag_offset + flag_size * aligned_capacity;
+    ht->digest_offset = ht->seq_offset + sizeof(size_t) * segments;
+    ht->digest_leaves = digest_leaves;
+    ht->dirty_offset  = ht->digest_offset + sizeof(size_t) * 2 * digest_leaves;
+    ht->mirror_offset = ht->dirty_offset + ht_dirty_map_size(tracked_size);  //dirty bitmap
+    ht->bucket_offset = ht->mirror_offset + ht_dirty_map_size(tracked_size); //mirror bitmap
+    if (page_slots)
+        ht->bucket_offset = page_align(ht->bucket_offset);
+    ht->log_offset    = page_align(ht->bucket_offset + bucket_bytes);
+    ht->data_size     = ht->log_offset + 2 * log_half;
+    ht->dirty_chunks  = (ht->mirror_offset - ht->dirty_offset) / sizeof(unsigned long) * bits_per_word;
+
+    size_t end = ht->data_size;
+    ht->journal_offset = ht->journal_size = 0;
+    if (flags & HT_JOURNAL) {
+        if (journal_size == 0)
+            journal_size = journal_default_size;
+        ht->journal_offset = page_align(end);
+        ht->journal_size   = page_align(journal_size < journal_min_size ? journal_min_size : journal_size);
+        end = ht->journal_offset + ht->journal_size;
+    }
+    ht->atime_offset = 0;
+    if (flags & HT_TIERED) {
+        ht->atime_offset = page_align(end);
+        end = ht->atime_offset + sizeof(u_int32) * aligned_capacity;
+    }
+    ht->cow_offset = ht->shadow_offset = end;
+
+    if (flags & HT_BACKUP) {
+        ht->cow_offset    = end;
+        ht->shadow_offset = page_align(ht->cow_offset + (segments / bits_per_word + 1) * sizeof(unsigned long));
+        return ht->shadow_offset + segments * segment_bytes;
+    }
+    return end;
 }
 
-/*dbj2_hash function (copied from libshmht)*/
-static unsigned int dbj2_hash (const char *str, size_t size) {
-    unsigned long hash = 5381;
+size_t ht_memory_size(size_t capacity, unsigned flags, size_t log_size, size_t journal_size) {
+    hashtable layout;
+    return ht_layout(&layout, capacity, flags, log_size, journal_size);
+}
+
+/*
+ * HT_FROZEN layout: header, bitmaps, one u_int32 displacement per bucket,
+ * one record offset per slot, the records.  All of it is data_size; no
+ * flags, segments or journal, since the table never changes.
+ */
+static size_t ht_frozen_layout(hashtable *ht, size_t n, size_t n_buckets, size_t record_bytes) {
+    size_t tracked_size = header_size
+                     + sizeof(u_int32) * n_buckets + sizeof(size_t)    //displacements, aligned
+                     + log_slot_size * n                               //record offsets
+                     + record_bytes;
+
+    ht->orig_capacity = ht->capacity = ht->size = n;
+    ht->flags         = HT_FROZEN;
+    ht->slot_size     = log_slot_size;
+    ht->page_slots    = 0;
+    ht->log_half      = 0;
+    ht->flag_offset   = ht->seq_offset = ht->digest_offset = ht->ns_offset = ht->bloom_offset = header_size;
+    ht->bloom_blocks  = 0;
+    ht->digest_leaves = 0;
+    ht->dirty_offset  = header_size;
+    ht->mirror_offset = ht->dirty_offset + ht_dirty_map_size(tracked_size);
+    ht->mph_offset    = ht->mirror_offset + ht_dirty_map_size(tracked_size);
+    ht->mph_buckets   = n_buckets;
+    ht->bucket_offset = log_align(ht->mph_offset + sizeof(u_int32) * n_buckets);
+    ht->log_offset    = ht->bucket_offset + log_slot_size * n;
+    ht->data_size     = ht->log_offset + record_bytes;
+    ht->dirty_chunks  = (ht->mirror_offset - ht->dirty_offset) / sizeof(unsigned long) * bits_per_word;
+    ht->journal_offset = ht->journal_size = 0;
+    ht->atime_offset  = 0;
+    ht->cow_offset    = ht->shadow_offset = ht->data_size;
+    return ht->data_size;
+}
+
+size_t ht_frozen_memory_size(size_t n, size_t n_buckets, size_t record_bytes) {
+    hashtable layout;
+    return ht_frozen_layout(&layout, n, n_buckets, record_bytes);
+}
+
+//bytes to map for a valid table, whatever its kind
+size_t ht_file_size(hashtable *ht) {
+    if (ht->flags & HT_FROZEN)
+        return ht->data_size;
+    return ht_memory_size(ht->orig_capacity, ht->flags, ht->log_half, ht->journal_size);
+}
+
+//call after the bytes are written, so a flush that races us sees the bit again
+static inline void ht_mark_dirty(hashtable *ht, const void *addr, size_t len) {
+    unsigned long *dirty_map = ht_dirty_base(ht), *mirror_map = ht_mirror_base(ht);
+    size_t offset = (const char *)addr - (const char *)ht;
+    size_t c, last = (offset + len - 1) / dirty_chunk_size;
+    for (c = offset / dirty_chunk_size; c <= last; c++) {
+        unsigned long bit = 1UL << (c % bits_per_word);
+        if (!(mirror_map[c / bits_per_word] & bit))
+            __sync_fetch_and_or(&mirror_map[c / bits_per_word], bit);
+        if (dirty_map[c / bits_per_word] & bit)
+            continue;
+        if (!(__sync_fetch_and_or(&dirty_map[c / bits_per_word], bit) & bit))
+            __sync_fetch_and_add(&ht->dirty_count, 1);
+    }
+}
+
+//where slot i of an HT_LOG table keeps the offset of its record
+static inline size_t* ht_log_ref(hashtable *ht, size_t i) {
+    return (size_t *)(ht_bucket(ht, i) + ((ht->flags & HT_INTKEY) ? intkey_record_at : 0));
+}
+
+//key and value of a used slot, wherever the table keeps them
+static inline ht_str* ht_bucket_key(hashtable *ht, size_t i) {
+    if (ht->flags & HT_INTKEY)
+        return (ht_str *)ht_bucket(ht, i);
+    if (ht->flags & (HT_LOG | HT_FROZEN))
+        return (ht_str *)(ht_log_base(ht) + *(size_t *)ht_bucket(ht, i));
+    return (ht_str *)ht_bucket(ht, i);
+}
+
+static inline ht_str* ht_bucket_value(hashtable *ht, size_t i) {
+    if (ht->flags & (HT_LOG | HT_FROZEN)) {
+        ht_str *key = (ht_str *)(ht_log_base(ht) + *ht_log_ref(ht, i));
+        return (ht_str *)((char *)key + log_value_at(key->size));
+    }
+    if (ht->flags & HT_SET)
+        return &no_value;
+    return (ht_str *)(ht_bucket(ht, i) + ht_value_at(ht));
+}
+
+/*
+ * Append a record to the active half of the log; returns its offset, or
+ * log_full.  Threads may append at once (restore does).
+ */
+static size_t ht_log_append(hashtable *ht, const char *key, u_int32 key_size, const char *value, u_int32 value_size) {
+    size_t len = log_record_size(key_size, value_size), half = ht->log_active, at;
+    do {
+        at = ht->log_tail[half];
+        if (at + len > ht->log_half)
+            return log_full;
+    } while (!__sync_bool_compare_and_swap(&ht->log_tail[half], at, at + len));
+
+    char *record = ht_log_base(ht) + half * ht->log_half + at;
+    fill_ht_str((ht_str *)record, key, key_size);
+    fill_ht_str((ht_str *)(record + log_value_at(key_size)), value, value_size);
+    __sync_fetch_and_add(&ht->log_live, len);
+    ht_mark_dirty(ht, record, len);
+    ht_mark_dirty(ht, ht, sizeof(hashtable));
+    return half * ht->log_half + at;
+}
+
+//the record of used slot i is about to be dropped or replaced
+static inline void ht_log_drop(hashtable *ht, size_t i) {
+    if (ht->flags & HT_LOG) {
+        ht_str *key = ht_bucket_key(ht, i), *value = ht_bucket_value(ht, i);
+        size_t *live = ht_is_cold(ht, *ht_log_ref(ht, i)) ? &ht->cold_live : &ht->log_live;
+        __sync_fetch_and_sub(live, log_record_size(key->size, value->size));
+    }
+}
+
+static inline size_t ht_hash(hashtable *ht, const char *key, u_int32 key_size);
+
+/*
+ * Write key and value for slot i: into its bucket, or as a record
+ * appended to the log that the slot then points at.  With replace the
+ * slot already holds this key and only the value changes.  Fails only
+ * when the log is full.  HT_SET tables keep the key alone.
+ */
+static int ht_store(hashtable *ht, size_t i, const char *key, u_int32 key_size, const char *value, u_int32 value_size, BOOL replace) {
+    char *bucket = ht_bucket(ht, i);
+
+    if (ht->flags & HT_SET)
+        value_size = 0;
+    if ((ht->flags & (HT_SET | HT_LOG)) == HT_SET) {
+        if (!replace) {
+            fill_ht_str((ht_str *)bucket, key, key_size);
+            ht_mark_dirty(ht, bucket, sizeof(u_int32) + key_size);
+        }
+        return True;
+    }
+    if (!(ht->flags & HT_LOG)) {
+        ht_str *bucket_value = (ht_str *)(bucket + ht_value_at(ht));
+        if (!replace)
+            fill_ht_str((ht_str *)bucket, key, key_size);
+        fill_ht_str(bucket_value, value, value_size);
+        if (replace)
+            ht_mark_dirty(ht, bucket_value, sizeof(u_int32) + value_size);
+        else
+            ht_mark_dirty(ht, bucket, ht_value_at(ht) + sizeof(u_int32) + value_size);
+        return True;
+    }
+
+    size_t record = ht_log_append(ht, key, key_size, value, value_size);
+    if (record == log_full) {
+        fprintf(stderr, "the log is full: live=%lu, size=%lu\n", ht->log_live, ht->log_half);
+        return False;
+    }
+    if (replace)
+        ht_log_drop(ht, i);
+    else if (ht->flags & HT_INTKEY)
+        fill_ht_str((ht_str *)bucket, key, key_size);
+    else if (ht->flags & HT_SPLIT) {
+        ((split_slot *)bucket)->hash     = ht_hash(ht, key, key_size);
+        ((split_slot *)bucket)->key_size = key_size;
+    }
+    *ht_log_ref(ht, i) = record;
+    ht_mark_dirty(ht, bucket, ht->slot_size);
+    if (ht->flags & HT_TIERED)
+        ht_atime_base(ht)[i] = ht_tier_now();
+    return True;
+}
+
+static inline size_t journal_record_size(u_int32 key_size, u_int32 value_size) {
+    size_t len = journal_header + key_size;
+    if (value_size < HT_JOURNAL_PAD)
+        len += value_size;
+    return log_align(len);
+}
+
+static void ht_journal_put(hashtable *ht, size_t at, size_t seq, u_int32 key_size, u_int32 value_size) {
+    char *record = ht_journal_base(ht) + at % ht->journal_size;
+    memcpy(record, &seq, sizeof(size_t));
+    memcpy(record + sizeof(size_t), &key_size, sizeof(u_int32));
+    memcpy(record + sizeof(size_t) + sizeof(u_int32), &value_size, sizeof(u_int32));
+}
+
+/*
+ * Record a change for followers.  Called by the writer, under the table
+ * lock, after the change is made.  Readers do not lock: the reserve
+ * mark goes up before any byte is overwritten, so they can tell whether
+ * what they copied was still intact.
+ */
+static void ht_journal(hashtable *ht, const char *key, u_int32 key_size, const char *value, u_int32 value_size) {
+    if (!(ht->flags & HT_JOURNAL))
+        return;
+
+    size_t len = journal_record_size(key_size, value_size);
+    if (len > journal_max_record) {
+        //a large value of a log table: followers copy the table instead
+        ht_journal(ht, NULL, 0, NULL, HT_JOURNAL_RESET);
+        return;
+    }
+    size_t head = ht->journal_head, room = ht->journal_size - head % ht->journal_size;
+    size_t skip = room < len ? room : 0;
+
+    __atomic_store_n(&ht->journal_reserve, head + skip + len, __ATOMIC_SEQ_CST);
+    __sync_synchronize();
+    if (skip >= journal_header)
+        ht_journal_put(ht, head, 0, 0, HT_JOURNAL_PAD);
+
+    size_t seq = ++ht->journal_seq;
+    char *record = ht_journal_base(ht) + (head + skip) % ht->journal_size;
+    ht_journal_put(ht, head + skip, seq, key_size, value_size);
+    memcpy(record + journal_header, key, key_size);
+    if (value_size < HT_JOURNAL_PAD)
+        memcpy(record + journal_header + key_size, value, value_size);
+
+    __atomic_store_n(&ht->journal_head, head + skip + len, __ATOMIC_RELEASE);
+    ht_mark_dirty(ht, ht, sizeof(hashtable));
+}
+
+//where the next record will go; a reader starting here sees changes from now on
+size_t ht_journal_position(hashtable *ht) {
+    return __atomic_load_n(&ht->journal_head, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Copy up to max_records whole records from *pos on into buf, without
+ * the table lock, and advance *pos past them.  Returns the bytes copied
+ * (walk them with ht_journal_next()), or -1 with errno set: ENOTSUP
+ * without HT_JOURNAL, ESTALE if the ring has already overwritten *pos
+ * (the reader fell behind and has to resync), EINVAL for a position the
+ * journal never reached.
+ */
+long ht_journal_read(hashtable *ht, size_t *pos, char *buf, size_t buf_size, size_t max_records) {
+    size_t start = *pos, p = start, used = 0, n = 0;
+    size_t size = ht->journal_size;
+
+    if (!(ht->flags & HT_JOURNAL)) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    size_t head = __atomic_load_n(&ht->journal_head, __ATOMIC_ACQUIRE);
+    if (start > head) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (head - start > size) {
+        errno = ESTALE;
+        return -1;
+    }
+
+    while (p < head && n < max_records) {
+        size_t room = size - p % size;
+        if (room < journal_header) {
+            p += room;
+            continue;
+        }
+        const char *record = ht_journal_base(ht) + p % size;
+        u_int32 key_size, value_size;
+        memcpy(&key_size, record + sizeof(size_t), sizeof(u_int32));
+        memcpy(&value_size, record + sizeof(size_t) + sizeof(u_int32), sizeof(u_int32));
+        if (value_size == HT_JOURNAL_PAD) {
+            p += room;
+            continue;
+        }
+        size_t len = journal_record_size(key_size, value_size);
+        if (len > room || p + len > head)
+            break; //overwritten under us; caught below
+        if (used + len > buf_size)
+            break;
+        memcpy(buf + used, record, len);
+        used += len, p += len, n++;
+    }
+
+    __sync_synchronize();
+    size_t reserve = __atomic_load_n(&ht->journal_reserve, __ATOMIC_ACQUIRE);
+    if (reserve - start > size) {
+        errno = ESTALE;
+        return -1;
+    }
+    *pos = p;
+    return (long)used;
+}
+
+//step through records copied by ht_journal_read(); False at the end
+int ht_journal_next(const char *buf, size_t len, size_t *offset, ht_journal_entry *entry) {
+    const char *record = buf + *offset;
+    if (*offset + journal_header > len)
+        return False;
+    memcpy(&entry->seq, record, sizeof(size_t));
+    memcpy(&entry->key_size, record + sizeof(size_t), sizeof(u_int32));
+    memcpy(&entry->value_size, record + sizeof(size_t) + sizeof(u_int32), sizeof(u_int32));
+    entry->key   = record + journal_header;
+    entry->value = entry->value_size < HT_JOURNAL_PAD ? entry->key + entry->key_size : NULL;
+    *offset += journal_record_size(entry->key_size, entry->value_size);
+    return True;
+}
+
+/*
+ * HT_DIGEST: node 1 of the tree is the root, node n has children 2n and
+ * 2n+1, and leaf digest_leaves + seg covers segment seg.  A node is the
+ * sum of the hashes of the entries below it, so changes are applied as
+ * differences, in any order, by any number of threads; and the root
+ * does not depend on which slot an entry sits in.
+ */
+static size_t ht_entry_hash(const ht_str *key, const ht_str *value) {
+    size_t h = 14695981039346656037ULL;    //FNV-1a, 64 bit
+    u_int32 i;
+    for (i = 0; i < key->size; i++)
+        h = (h ^ (unsigned char)key->str[i]) * 1099511628211ULL;
+    h = (h ^ key->size) * 1099511628211ULL;
+    for (i = 0; i < value->size; i++)
+        h = (h ^ (unsigned char)value->str[i]) * 1099511628211ULL;
+    h ^= h >> 30, h *= 0xbf58476d1ce4e5b9ULL;  //splitmix64 finalizer
+    h ^= h >> 27, h *= 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+static void ht_digest_update(hashtable *ht, size_t seg, size_t delta) {
+    size_t *tree = ht_digest_base(ht), node;
+    for (node = ht->digest_leaves + seg; node >= 1; node /= 2) {
+        __sync_fetch_and_add(&tree[node], delta);
+        ht_mark_dirty(ht, &tree[node], sizeof(size_t));
+    }
+}
+
+//used slot i is about to change (sign -1) or has just been filled (+1)
+static inline void ht_digest_entry(hashtable *ht, size_t i, int sign) {
+    if (!(ht->flags & HT_DIGEST))
+        return;
+    size_t h = ht_entry_hash(ht_bucket_key(ht, i), ht_bucket_value(ht, i));
+    ht_digest_update(ht, i / segment_slots, sign > 0 ? h : -h);
+}
+
+/*dbj2_hash function (copied from libshmht), kept to 64 bits so that
+  tables of more than 2^32 slots are reached all over*/
+static size_t dbj2_hash (const char *str, size_t size) {
+    size_t hash = 5381;
     while (size--) {
         char c = *str++;
         hash = ((hash << 5) + hash) + c;    /* hash * 33 + c */
     }
-    return (unsigned int) hash;
+    return hash;
 }
 
 BOOL is_equal(const char *a, size_t asize, const char *b, size_t bsize) {
     if (asize != bsize)
         return False;
-    return strncmp(a, b, asize) ? False : True;
+    return memcmp(a, b, asize) ? False : True;  //keys may hold 0 bytes
 }
 
 int ht_is_valid(hashtable *ht) {
     return (ht->magic == ht_magic);
 }
 
+//tells tables apart so a delta is never applied on top of the wrong base
+static size_t ht_new_table_id(hashtable *ht) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    size_t id = ((size_t)tv.tv_sec << 20) ^ tv.tv_usec ^ ((size_t)getpid() << 40) ^ (size_t)ht;
+    return id ? id : 1;
+}
+
+static inline size_t ht_mix64(size_t h) {
+    h ^= h >> 30, h *= 0xbf58476d1ce4e5b9ULL;  //splitmix64 finalizer
+    h ^= h >> 27, h *= 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+//where the probe chain of a key starts, before the modulo: HT_INTKEY keys
+//are mixed as one word
+static inline size_t ht_hash(hashtable *ht, const char *key, u_int32 key_size) {
+    if ((ht->flags & HT_INTKEY) && key_size == intkey_size) {
+        size_t k;
+        memcpy(&k, key, intkey_size);
+        return ht_mix64(k);
+    }
+    return dbj2_hash(key, key_size);
+}
+
+//whether used slot i holds key, whose ht_hash is h
+static inline BOOL ht_slot_holds(hashtable *ht, size_t i, size_t h, const char *key, u_int32 key_size) {
+    if ((ht->flags & (HT_SPLIT | HT_INTKEY)) == HT_SPLIT) {   //INTKEY slots hold the key itself
+        split_slot *slot = (split_slot *)ht_bucket(ht, i);
+        if (slot->hash != (u_int32)h || slot->key_size != key_size)
+            return False;
+    }
+    ht_str *bucket_key = ht_bucket_key(ht, i);
+    return is_equal(key, key_size, bucket_key->str, bucket_key->size);
+}
+
+/*
+ * Whether an entry fits in a slot (or in the log) of the table.  Values
+ * in the log are only limited by its size; HT_BACKUP, whose shadow area
+ * holds whole buckets, is never combined with HT_LOG.
+ */
+static inline BOOL ht_fits(hashtable *ht, u_int32 key_size, u_int32 value_size) {
+    if (sizeof(u_int32) + key_size >= max_key_size)
+        return False;
+    if ((ht->flags & HT_LOG) ? value_size > HT_MAX_LOG_VALUE
+                             : sizeof(u_int32) + value_size >= max_value_size)
+        return False;
+    if (ht->flags & HT_INTKEY)
+        return key_size == intkey_size && (value_size <= intkey_size || (ht->flags & (HT_LOG | HT_SET)));
+    return True;
+}
+
+size_t ht_frozen_hash(size_t seed, const char *key, u_int32 key_size) {
+    size_t h = 14695981039346656037ULL ^ seed;
+    u_int32 i;
+    for (i = 0; i < key_size; i++)
+        h = (h ^ (unsigned char)key[i]) * 1099511628211ULL;
+    return ht_mix64(h ^ key_size);
+}
+
+static inline unsigned long* ht_bloom_block(hashtable *ht, size_t h) {
+    return ht_bloom_base(ht) + (h >> 32) % ht->bloom_blocks * bloom_block_words;
+}
+
+//atomic, since the parallel loader adds keys from several threads
+static void ht_bloom_add(hashtable *ht, const char *key, u_int32 key_size) {
+    if (!(ht->flags & HT_BLOOM))
+        return;
+    size_t h = ht_frozen_hash(bloom_seed, key, key_size), bits = ht_mix64(h);
+    unsigned long *block = ht_bloom_block(ht, h);
+    int j;
+    for (j = 0; j < bloom_k; j++, bits >>= 9) {
+        unsigned b = bits % bloom_block_bits;
+        unsigned long bit = 1UL << (b % bits_per_word);
+        if (!(block[b / bits_per_word] & bit))
+            __sync_fetch_and_or(&block[b / bits_per_word], bit);
+    }
+    ht_mark_dirty(ht, block, bloom_block_bits / 8);
+}
+
+//False if key is certainly not in the table
+static inline int ht_bloom_maybe(hashtable *ht, const char *key, u_int32 key_size) {
+    if (!(ht->flags & HT_BLOOM))
+        return True;
+    size_t h = ht_frozen_hash(bloom_seed, key, key_size), bits = ht_mix64(h);
+    const unsigned long *block = ht_bloom_block(ht, h);
+    int j;
+    for (j = 0; j < bloom_k; j++, bits >>= 9) {
+        unsigned b = bits % bloom_block_bits;
+        if (!(block[b / bits_per_word] & (1UL << (b % bits_per_word))))
+            return False;
+    }
+    return True;
+}
+
+size_t ht_frozen_bucket(size_t hash, size_t n_buckets) {
+    return (hash >> 32) % n_buckets;
+}
+
+size_t ht_frozen_slot(size_t hash, u_int32 disp, size_t n) {
+    if (disp & HT_FROZEN_DIRECT)
+        return disp & ~HT_FROZEN_DIRECT;
+    return ht_mix64(hash ^ (disp * 0x9e3779b97f4a7c15ULL)) % n;
+}
+
+/*
+ * Lay out an HT_FROZEN table of n entries at base_addr, which holds
+ * ht_frozen_memory_size() bytes of zeroes.  The caller then sets every
+ * displacement and puts every record; the table is sealed from the start.
+ */
+hashtable* ht_frozen_init(void *base_addr, size_t n, size_t n_buckets, size_t seed, size_t record_bytes) {
+    hashtable *ht = (hashtable *)base_addr;
+    ht_frozen_layout(ht, n, n_buckets, record_bytes);
+    ht->mph_seed   = seed;
+    ht->sealed     = 1;
+    ht->ref_cnt    = 0;
+    ht->table_id   = ht_new_table_id(ht);
+    ht->magic      = ht_magic;
+    return ht;
+}
+
+void ht_frozen_set_disp(hashtable *ht, size_t bucket, u_int32 disp) {
+    ht_mph_base(ht)[bucket] = disp;
+}
+
+//write the record for slot at offset at of the record area; returns where the next one goes
+size_t ht_frozen_put(hashtable *ht, size_t slot, size_t at, const char *key, u_int32 key_size, const char *value, u_int32 value_size) {
+    char *record = ht_log_base(ht) + at;
+    fill_ht_str((ht_str *)record, key, key_size);
+    fill_ht_str((ht_str *)(record + log_value_at(key_size)), value, value_size);
+    *(size_t *)ht_bucket(ht, slot) = at;
+    return at + log_record_size(key_size, value_size);
+}
+
+//one displacement, one record offset, one record; no probing.  returns
+//the slot of key, or capacity
+static size_t ht_frozen_find(hashtable *ht, const char *key, u_int32 key_size) {
+    if (ht->capacity == 0)
+        return 0;
+    size_t h = ht_frozen_hash(ht->mph_seed, key, key_size);
+    u_int32 disp = ht_mph_base(ht)[ht_frozen_bucket(h, ht->mph_buckets)];
+    size_t i = ht_frozen_slot(h, disp, ht->capacity);
+    ht_str *bucket_key = ht_bucket_key(ht, i);
+    if (!is_equal(key, key_size, bucket_key->str, bucket_key->size))
+        return ht->capacity;
+    return i;
+}
+
+static ht_str* ht_frozen_get(hashtable *ht, const char *key, u_int32 key_size) {
+    size_t i = ht_frozen_find(ht, key, key_size);
+    return i == ht->capacity ? NULL : ht_bucket_value(ht, i);
+}
+
 /*
- * The caller is responsible for the 4-byte alignment of base_addr
- * and the size of base_addr should be no less than ht_get_prime_by(capacity)
+ * The caller is responsible for the page alignment of base_addr
+ * and the size of base_addr should be no less than ht_memory_size(capacity, flags)
  */
-hashtable* ht_init(void *base_addr, size_t capacity, int force_init) {
+hashtable* ht_init(void *base_addr, size_t capacity, unsigned flags, size_t log_size, size_t journal_size, int force_init) {
     hashtable* ht = (hashtable *)base_addr;
     if (force_init || !ht_is_valid(ht)) {
         ht->magic     = ht_magic;
         ht->ref_cnt   = 0;
+        ht->size      = 0;
 
-        ht->orig_capacity = capacity;
-        ht->capacity      = ht_get_prime_by(capacity);
-        ht->size          = 0;
-
-        ht->flag_offset   = header_size;
-        ht->bucket_offset = ht->flag_offset + (ht->capacity / 4 + 1) * 4; //alignment
+        ht_layout(ht, capacity, flags, log_size, journal_size);
+        ht->dirty_count   = 0;
+        ht->log_active    = ht->log_from = ht->log_live = 0;
+        ht->log_tail[0]   = ht->log_tail[1] = 0;
+        ht->compact_pid   = 0;
+        ht->journal_head  = ht->journal_reserve = ht->journal_seq = 0;
+        ht->follow_id     = ht->follow_pos = 0;
+        ht->generation    = ht->superseded = ht->sealed = 0;
+        ht->backup_pid    = 0;
+        ht->mirror_pid    = 0;
+        ht->change_seq    = 0;
+        ht->source_id     = ht->source_seq = 0;
+        ht->cold_offset   = ht->cold_size = ht->cold_tail = ht->cold_live = 0;
+        ht->cold_path[0]  = 0;
+        ht->slot_epoch    = 0;
+        ht->table_id      = ht_new_table_id(ht);
 
+        bzero(ht_ns_base(ht), ht->flag_offset - ht->ns_offset); //and the bloom filter
         bzero(ht_flag_base(ht), ht->capacity);
+        bzero(ht_seq_base(ht), ht->dirty_offset - ht->seq_offset); //and the hash tree
+        bzero(ht_dirty_base(ht), ht->bucket_offset - ht->dirty_offset);
+        ht_mark_dirty(ht, ht, ht->dirty_offset);
     }
     ht->ref_cnt += 1;
+    ht_mark_dirty(ht, ht, sizeof(hashtable));
     return ht;
 }
 
-static size_t ht_position(hashtable *ht, const char *key, u_int32 key_size, BOOL treat_removed_as_empty) {
+size_t ht_dirty_bytes(hashtable *ht) {
+    long count = (long)ht->dirty_count; //may dip below zero while a flush races a writer
+    return count > 0 ? (size_t)count * dirty_chunk_size : 0;
+}
+
+/*
+ * Clear the bits of one bitmap and hand the marked chunks to cb() as byte
+ * ranges, coalescing neighbours up to max_chunks.  Bits are cleared
+ * before cb() sees the range, so writes racing with it are simply picked
+ * up by the next call; no lock is needed.  Returns the bytes reported.
+ */
+static size_t ht_report_range(hashtable *ht, size_t first_chunk, size_t n_chunks, ht_range_cb cb, void *arg) {
+    size_t offset = first_chunk * dirty_chunk_size;
+    size_t len = n_chunks * dirty_chunk_size;
+    if (offset >= ht->data_size)
+        return 0;
+    if (offset + len > ht->data_size)
+        len = ht->data_size - offset;
+    cb(arg, offset, len);
+    return len;
+}
+
+static size_t ht_take_marked(hashtable *ht, unsigned long *map, int counted, size_t max_chunks, ht_range_cb cb, void *arg) {
+    size_t words = ht->dirty_chunks / bits_per_word;
+    size_t w, b, taken = 0, run_start = 0, run_len = 0;
+
+    for (w = 0; w < words; w++) {
+        if (map[w] == 0)
+            continue;
+        unsigned long bits = __sync_fetch_and_and(&map[w], 0UL);
+        for (b = 0; b < bits_per_word; b++) {
+            if (!(bits & (1UL << b)))
+                continue;
+            size_t chunk = w * bits_per_word + b;
+            if (counted)
+                __sync_fetch_and_sub(&ht->dirty_count, 1);
+            if (run_len > 0 && chunk == run_start + run_len && run_len < max_chunks) {
+                run_len++;
+                continue;
+            }
+            if (run_len > 0)
+                taken += ht_report_range(ht, run_start, run_len, cb, arg);
+            run_start = chunk, run_len = 1;
+        }
+    }
+    if (run_len > 0)
+        taken += ht_report_range(ht, run_start, run_len, cb, arg);
+    return taken;
+}
+
+static void ht_msync_range(void *arg, size_t offset, size_t len) {
+    hashtable *ht = (hashtable *)arg;
+    if (msync((char *)ht + offset, len, MS_SYNC) != 0)
+        fprintf(stderr, "msync failed at offset %lu: [%d] %s\n", offset, errno, strerror(errno));
+}
+
+/*
+ * Write back the chunks that were dirtied since the last flush.
+ */
+size_t ht_flush_dirty(hashtable *ht) {
+    return ht_take_marked(ht, ht_dirty_base(ht), True, (size_t)-1, ht_msync_range, ht);
+}
+
+/*
+ * Report the chunks changed since the mirror last looked; see mirror.c.
+ * Only one mirror may consume the bits of a table, see ht_mirror_claim().
+ */
+size_t ht_mirror_changes(hashtable *ht, size_t max_bytes, ht_range_cb cb, void *arg) {
+    size_t max_chunks = max_bytes / dirty_chunk_size;
+    return ht_take_marked(ht, ht_mirror_base(ht), False, max_chunks ? max_chunks : 1, cb, arg);
+}
+
+//forget pending changes, before a mirror copies the table in full
+void ht_mirror_reset(hashtable *ht) {
+    bzero(ht_mirror_base(ht), ht->bucket_offset - ht->mirror_offset);
+}
+
+int ht_mirror_claim(hashtable *ht) {
+    if (ht->mirror_pid != 0) {
+        //a mirror whose process died is simply taken over
+        pid_t pid = (pid_t)ht->mirror_pid;
+        if (pid == getpid() || kill(pid, 0) == 0 || errno == EPERM) {
+            errno = EBUSY;
+            return False;
+        }
+    }
+    ht->mirror_pid = getpid();
+    ht_mark_dirty(ht, ht, sizeof(hashtable));
+    return True;
+}
+
+void ht_mirror_release(hashtable *ht) {
+    if ((pid_t)ht->mirror_pid == getpid()) {
+        ht->mirror_pid = 0;
+        ht_mark_dirty(ht, ht, sizeof(hashtable));
+    }
+}
+
+size_t ht_segment_count(hashtable *ht) {
+    return ht_segments(ht->capacity);
+}
+
+size_t ht_segment_buffer_size(void) {
+    return segment_bytes;
+}
+
+/*
+ * Copy the flags and the used buckets of a segment into dst, laid out
+ * like the shadow area (full buckets, also for HT_LOG).  Only the bytes
+ * in use are copied, so the shadow stays as sparse as the table.
+ */
+static size_t ht_copy_segment(hashtable *ht, size_t seg, char *dst) {
+    size_t first = seg * segment_slots, n = ht->capacity - first, i;
+    if (n > segment_slots)
+        n = segment_slots;
+
+    const char *flags = ht_flag_base(ht) + first;
+    memcpy(dst, flags, n);
+    for (i = 0; i < n; i++) {
+        if (flags[i] != used)
+            continue;
+        const ht_str *bucket_key = ht_bucket_key(ht, first + i);
+        const ht_str *bucket_value = ht_bucket_value(ht, first + i);
+        char *copy = dst + segment_slots + i * bucket_size;
+        memcpy(copy, bucket_key, sizeof(u_int32) + bucket_key->size);
+        memcpy(copy + max_key_size, bucket_value, sizeof(u_int32) + bucket_value->size);
+    }
+    return n;
+}
+
+/*
+ * Preserve the pre-backup image of the segment holding slot i before it
+ * is first modified.  Called with the table lock held.
+ */
+static inline void ht_cow(hashtable *ht, size_t i) {
+    if (ht->backup_pid == 0)
+        return;
+    size_t seg = i / segment_slots;
+    unsigned long *cow_map = ht_cow_base(ht);
+    unsigned long bit = 1UL << (seg % bits_per_word);
+    if (cow_map[seg / bits_per_word] & bit)
+        return;
+    ht_copy_segment(ht, seg, ht_shadow_segment(ht, seg));
+    cow_map[seg / bits_per_word] |= bit;
+}
+
+/*
+ * Every change to a slot goes through here first: it preserves the
+ * segment for a running backup and stamps it for incremental snapshots.
+ */
+static inline void ht_before_write(hashtable *ht, size_t i) {
+    size_t *seq = ht_seq_base(ht) + i / segment_slots;
+    ht_cow(ht, i);
+    *seq = __sync_add_and_fetch(&ht->change_seq, 1);
+    ht_mark_dirty(ht, seq, sizeof(size_t));
+}
+
+static void ht_before_write_all(hashtable *ht) {
+    size_t seg;
+    for (seg = 0; seg < ht_segments(ht->capacity); seg++)
+        ht_before_write(ht, seg * segment_slots);
+}
+
+/*
+ * Start an online backup; from now on writers preserve each segment
+ * before changing it.  Fails with ENOTSUP if the table has no shadow
+ * area, or EBUSY if a backup by a live process is in progress.
+ * Called with the table lock held.
+ */
+int ht_backup_begin(hashtable *ht) {
+    if (!(ht->flags & HT_BACKUP)) {
+        errno = ENOTSUP;
+        return False;
+    }
+    if (ht->backup_pid != 0) {
+        //a backup whose process died is simply taken over
+        pid_t pid = (pid_t)ht->backup_pid;
+        if (pid == getpid() || kill(pid, 0) == 0 || errno == EPERM) {
+            errno = EBUSY;
+            return False;
+        }
+    }
+    bzero(ht_cow_base(ht), ht->shadow_offset - ht->cow_offset);
+    ht->backup_pid = getpid();
+    return True;
+}
+
+/*
+ * Copy segment seg as it was when the backup began into buf, which
+ * holds ht_segment_buffer_size() bytes; returns the number of slots in
+ * it.  Called with the table lock held.
+ */
+size_t ht_backup_copy(hashtable *ht, size_t seg, char *buf) {
+    unsigned long *cow_map = ht_cow_base(ht);
+    unsigned long bit = 1UL << (seg % bits_per_word);
+    size_t n = ht->capacity - seg * segment_slots;
+    if (n > segment_slots)
+        n = segment_slots;
+
+    if (cow_map[seg / bits_per_word] & bit) {
+        memcpy(buf, ht_shadow_segment(ht, seg), segment_bytes);
+        return n;
+    }
+    //nobody changed it yet; the live copy is the pre-backup image
+    ht_copy_segment(ht, seg, buf);
+    cow_map[seg / bits_per_word] |= bit;
+    return n;
+}
+
+size_t ht_segment_first_slot(size_t seg) {
+    return seg * segment_slots;
+}
+
+size_t ht_segment_seq(hashtable *ht, size_t seg) {
+    return ht_seq_base(ht)[seg];
+}
+
+//state of slot i; key and value are only set for HT_SLOT_USED
+int ht_slot(hashtable *ht, size_t i, ht_str **key, ht_str **value) {
+    char flag = (ht->flags & HT_FROZEN) ? used : ht_flag_base(ht)[i];
+    if (flag == used) {
+        *key   = ht_bucket_key(ht, i);
+        *value = ht_bucket_value(ht, i);
+    }
+    return flag;
+}
+
+/*
+ * Empty every slot of a segment, for a delta that replaces it wholesale;
+ * returns how many entries were dropped.  ht->size is left to the caller.
+ */
+size_t ht_clear_segment(hashtable *ht, size_t seg) {
+    size_t first = seg * segment_slots, n = ht->capacity - first, i, dropped = 0;
+    char *flags = ht_flag_base(ht) + first;
+    if (n > segment_slots)
+        n = segment_slots;
+    ht_before_write(ht, first);
+    for (i = 0; i < n; i++) {
+        if (flags[i] == used) {
+            ht_digest_entry(ht, first + i, -1);
+            ht_log_drop(ht, first + i);
+            dropped++;
+        }
+    }
+    bzero(flags, n);
+    __sync_fetch_and_add(&ht->slot_epoch, 1);  //segments may be cleared by several threads
+    ht_mark_dirty(ht, flags, n);
+    ht_mark_dirty(ht, ht, sizeof(hashtable));
+    ht_journal(ht, NULL, 0, NULL, HT_JOURNAL_RESET);
+    return dropped;
+}
+
+/*
+ * Put an entry (or a tombstone) into exactly slot i, reproducing the
+ * layout of the table a snapshot was taken from.  Fails if the slot is
+ * out of range or taken.  Threads may place into distinct slots at once.
+ */
+int ht_place(hashtable *ht, size_t i, int flag, const char *key, u_int32 key_size, const char *value, u_int32 value_size) {
+    char *flag_base = ht_flag_base(ht);
+    if (i >= ht->capacity || flag_base[i] != empty || (flag != used && flag != removed))
+        return False;
+    if (flag == used) {
+        if (!ht_fits(ht, key_size, value_size))
+            return False;
+        if (!ht_store(ht, i, key, key_size, value, value_size, False))
+            return False;
+    }
+    ht_before_write(ht, i);
+    flag_base[i] = flag;
+    if (flag == used) {
+        ht_bloom_add(ht, key, key_size);
+        ht_digest_entry(ht, i, +1);
+    }
+    ht_mark_dirty(ht, flag_base + i, 1);
+    return True;
+}
+
+/*
+ * Step to the next non-empty slot of a segment copied by ht_backup_copy();
+ * returns its flag (key and value are only set for HT_SLOT_USED), or
+ * HT_SLOT_EMPTY at the end.  The slot is *pos - 1 within the segment.
+ */
+int ht_segment_next(const char *buf, size_t n_slots, size_t *pos, ht_str **key, ht_str **value) {
+    size_t i;
+    for (i = *pos; i < n_slots; i++) {
+        if (buf[i] == used) {
+            const char *bucket = buf + segment_slots + i * bucket_size;
+            *key   = (ht_str *)bucket;
+            *value = (ht_str *)(bucket + max_key_size);
+            *pos   = i + 1;
+            return used;
+        }
+        if (buf[i] == removed) {
+            *pos = i + 1;
+            return removed;
+        }
+    }
+    *pos = n_slots;
+    return empty;
+}
+
+/*
+ * Stop the copy-on-write and give the shadow pages back to the system.
+ * Called with the table lock held.
+ */
+void ht_backup_end(hashtable *ht) {
+    if (!(ht->flags & HT_BACKUP))
+        return;
+    ht->backup_pid = 0;
+    madvise(ht_shadow_segment(ht, 0), ht_segments(ht->capacity) * segment_bytes, MADV_REMOVE);
+}
+
+/*
+ * Move i to the next slot of the probe chain starting at hval, the step
+ * counted in *di; False once the chain is back where it started.  Chains
+ * go i + 1, i + 3, i + 6 ... round the table; those of HT_PAGED tables
+ * first go through the rest of the page of hval, in order, so that most
+ * probes touch one page, and only then go on round the table.
+ */
+static inline BOOL ht_probe_step(hashtable *ht, size_t hval, size_t *i, size_t *di) {
+    size_t g = ht->page_slots, step = *di;
+    if (g) {
+        size_t first = hval - hval % g, n = ht->capacity - first < g ? ht->capacity - first : g;
+        if (step < n) {
+            *i = first + (hval - first + step) % n;
+            *di = step + 1;
+            return True;
+        }
+        if (step == n)
+            *i = hval;  //the page is full
+        step -= n - 1;
+    }
+    *i = (*i + step) % ht->capacity;
+    *di += 1;
+    return *i != hval;
+}
+
+/*
+ * Walk the probe chain of key; returns the slot where it stops, or
+ * capacity if it went all the way round.  Writes nothing, so read-only
+ * mappings can use it.
+ */
+static size_t ht_probe(hashtable *ht, const char *key, u_int32 key_size, BOOL treat_removed_as_empty) {
     char *flag_base = ht_flag_base(ht);
-    char *bucket_base = ht_bucket_base(ht);
     size_t capacity = ht->capacity;
-    unsigned long hval = dbj2_hash(key, key_size) % capacity;
+    size_t h = ht_hash(ht, key, key_size);
+    unsigned long hval = h % capacity;
 
     size_t i = hval, di = 1;
     while (True) {
@@ -123,55 +1150,118 @@ static size_t ht_position(hashtable *ht, const char *key, u_int32 key_size, BOOL
             break;
         if (flag_base[i] == removed && treat_removed_as_empty)
             break;
-        if (flag_base[i] == used)
-        {
-            char *bucket = bucket_base + i * bucket_size;
-            ht_str* bucket_key = (ht_str *)bucket;
-            if (is_equal(key, key_size, bucket_key->str, bucket_key->size)) {
-                break;
-            }
-        }
-        i = (i + di) % capacity;
-        di++;
-        if (i == hval) {
-            //extreme condition: when all flags are 'removed'
-            bzero(flag_base, capacity);
+        if (flag_base[i] == used && ht_slot_holds(ht, i, h, key, key_size))
             break;
-        }
+        if (!ht_probe_step(ht, hval, &i, &di))
+            return capacity;
+    }
+    return i;
+}
+
+static size_t ht_position(hashtable *ht, const char *key, u_int32 key_size, BOOL treat_removed_as_empty) {
+    size_t i = ht_probe(ht, key, key_size, treat_removed_as_empty);
+    if (i == ht->capacity) {
+        //extreme condition: when all flags are 'removed'
+        char *flag_base = ht_flag_base(ht);
+        ht_before_write_all(ht);
+        bzero(flag_base, ht->capacity);
+        ht->slot_epoch++;
+        ht_mark_dirty(ht, flag_base, ht->capacity);
+        ht_bloom_rebuild(ht);
+        i = ht_hash(ht, key, key_size) % ht->capacity;
     }
     return i;
 }
 
 ht_str* ht_get(hashtable *ht, const char *key, u_int32 key_size) {
-    size_t i = ht_position(ht, key, key_size, False); //'removed' bucket is not 'empty' when searching a chain.
-    if (ht_flag_base(ht)[i] != used) {
+    if (ht->flags & HT_FROZEN)
+        return ht_frozen_get(ht, key, key_size);
+    if (!ht_bloom_maybe(ht, key, key_size))
+        return NULL;
+    size_t i = ht_probe(ht, key, key_size, False); //'removed' bucket is not 'empty' when searching a chain.
+    if (i == ht->capacity || ht_flag_base(ht)[i] != used) {
         return NULL;
     }
-    char *bucket = ht_bucket_base(ht) + i * bucket_size;
-    return (ht_str*)(bucket + max_key_size);
+    return ht_bucket_value(ht, i);
+}
+
+/*
+ * One walk of the probe chain of key for a write: the slot that holds
+ * it (*found is set), or else the first free one on the way, removed or
+ * empty; capacity if the walk went all the way round without either.
+ * Unless maybe, the key is known not to be in the table and the first
+ * free slot will do.
+ */
+static size_t ht_probe_write(hashtable *ht, const char *key, u_int32 key_size, BOOL maybe, BOOL *found) {
+    char *flag_base = ht_flag_base(ht);
+    size_t capacity = ht->capacity;
+    size_t h = ht_hash(ht, key, key_size);
+    unsigned long hval = h % capacity;
+
+    size_t i = hval, di = 1, free_slot = capacity;
+    *found = False;
+    while (True) {
+        if (flag_base[i] == empty)
+            return free_slot == capacity ? i : free_slot;
+        if (flag_base[i] == removed) {
+            if (free_slot == capacity)
+                free_slot = i;
+            if (!maybe)
+                return free_slot;
+        }
+        else if (maybe && ht_slot_holds(ht, i, h, key, key_size)) {
+            *found = True;
+            return i;
+        }
+        if (!ht_probe_step(ht, hval, &i, &di))
+            return free_slot;
+    }
 }
 
 int ht_set(hashtable *ht, const char *key, u_int32 key_size, const char *value, u_int32 value_size) {
-    if (sizeof(u_int32) + key_size >= max_key_size || sizeof(u_int32) + value_size >= max_value_size) {
+    return ht_upsert(ht, key, key_size, value, value_size, NULL);
+}
+
+/*
+ * ht_set() that also tells which slot now holds the key, if slot is not
+ * NULL.  The probe chain is walked once, for the key and for a free
+ * slot at the same time.
+ */
+int ht_upsert(hashtable *ht, const char *key, u_int32 key_size, const char *value, u_int32 value_size, size_t *slot) {
+    if (!ht_fits(ht, key_size, value_size)) {
         //the item is too large
         fprintf(stderr, "the item is too large: key_size(%u), value(%u)\n", key_size, value_size);
         return False;
     }
+    if (ht->sealed) {
+        errno = EROFS;
+        return False;
+    }
+    if (ht->flags & HT_SET)
+        value_size = 0;     //so the journal agrees with the table
 
     char *flag_base = ht_flag_base(ht);
-    char *bucket_base = ht_bucket_base(ht);
+    BOOL found;
+    size_t i = ht_probe_write(ht, key, key_size, ht_bloom_maybe(ht, key, key_size), &found);
 
-    ht_str *bucket_key = NULL, *bucket_value = NULL;
-
-    //if it exists: just find and modify it's value
-    bucket_value = ht_get(ht, key, key_size);
-    if (bucket_value) { 
-        fill_ht_str(bucket_value, value, value_size);
+    //if it exists: just modify its value
+    if (found) {
+        ht_before_write(ht, i);
+        ht_digest_entry(ht, i, -1);
+        if (!ht_store(ht, i, key, key_size, value, value_size, True)) {
+            ht_digest_entry(ht, i, +1);
+            return False;
+        }
+        ht_digest_entry(ht, i, +1);
+        ht_journal(ht, key, key_size, value, value_size);
+        if (slot != NULL)
+            *slot = i;
         return True;
     }
 
-    //else: find an available bucket, which can be both 'empty' or 'removed'
-    size_t i = ht_position(ht, key, key_size, True);
+    //else: the available bucket found on the way, which can be both 'empty' or 'removed'
+    if (i == ht->capacity)
+        i = ht_position(ht, key, key_size, True);
 
     if (ht->capacity * max_load_factor < ht->size) {
         //hash table is over loaded
@@ -179,27 +1269,551 @@ int ht_set(hashtable *ht, const char *key, u_int32 key_size, const char *value,
         return False;
     }
 
+    ht_before_write(ht, i);
+    if (!ht_store(ht, i, key, key_size, value, value_size, False))
+        return False;
     ht->size += 1;
     flag_base[i] = used;
-
-    char *bucket = bucket_base + i * bucket_size;
-    bucket_key   = (ht_str*)bucket;
-    bucket_value = (ht_str*)(bucket + max_key_size);
-    fill_ht_str(bucket_key, key, key_size);
-    fill_ht_str(bucket_value, value, value_size);
+    ht_bloom_add(ht, key, key_size);
+    ht_digest_entry(ht, i, +1);
+    ht_mark_dirty(ht, ht, sizeof(hashtable));
+    ht_mark_dirty(ht, flag_base + i, 1);
+    ht_journal(ht, key, key_size, value, value_size);
+    if (slot != NULL)
+        *slot = i;
     return True;
 }
 
 int ht_remove(hashtable *ht, const char *key, u_int32 key_size) {
+    if (ht->sealed) {
+        errno = EROFS;
+        return False;
+    }
+    if (!ht_bloom_maybe(ht, key, key_size))
+        return False;
     size_t i = ht_position(ht, key, key_size, False); //'removed' bucket is not 'empty' when searching a chain.
     if (ht_flag_base(ht)[i] != used) {
         return False;
     }
+    ht_before_write(ht, i);
+    ht_digest_entry(ht, i, -1);
+    ht_log_drop(ht, i);
     ht_flag_base(ht)[i] = removed;
     ht->size -= 1;
+    ht->slot_epoch++;
+    ht_mark_dirty(ht, ht, sizeof(hashtable));
+    ht_mark_dirty(ht, ht_flag_base(ht) + i, 1);
+    ht_journal(ht, key, key_size, NULL, HT_JOURNAL_REMOVE);
+    return True;
+}
+
+//slot of key, or capacity if it is not in the table
+size_t ht_find(hashtable *ht, const char *key, u_int32 key_size) {
+    if (ht->flags & HT_FROZEN)
+        return ht_frozen_find(ht, key, key_size);
+    if (!ht_bloom_maybe(ht, key, key_size))
+        return ht->capacity;
+    size_t i = ht_probe(ht, key, key_size, False);
+    if (i == ht->capacity || ht_flag_base(ht)[i] != used)
+        return ht->capacity;
+    return i;
+}
+
+//value of used slot i; the caller knows slot_epoch has not moved since it found i
+ht_str* ht_slot_value(hashtable *ht, size_t i) {
+    return ht_bucket_value(ht, i);
+}
+
+/*
+ * Replace the value of used slot i, found under the same slot_epoch: no
+ * hashing and no probing.  Fails as ht_set() does.
+ */
+int ht_slot_set(hashtable *ht, size_t i, const char *value, u_int32 value_size) {
+    ht_str *key = ht_bucket_key(ht, i);   //stays put: the old record is not reclaimed under the lock
+    if (!ht_fits(ht, key->size, value_size)) {
+        fprintf(stderr, "the item is too large: key_size(%u), value(%u)\n", key->size, value_size);
+        return False;
+    }
+    if (ht->sealed || (ht->flags & HT_FROZEN)) {
+        errno = EROFS;
+        return False;
+    }
+    if (ht->flags & HT_SET)
+        value_size = 0;
+
+    ht_before_write(ht, i);
+    ht_digest_entry(ht, i, -1);
+    if (!ht_store(ht, i, key->str, key->size, value, value_size, True)) {
+        ht_digest_entry(ht, i, +1);
+        return False;
+    }
+    ht_digest_entry(ht, i, +1);
+    ht_journal(ht, key->str, key->size, value, value_size);
+    return True;
+}
+
+/*
+ * Drop every entry.  The caller must have the table to itself.
+ */
+void ht_clear(hashtable *ht) {
+    ht_before_write_all(ht);
+    bzero(ht_flag_base(ht), ht->capacity);
+    bzero(ht_digest_base(ht), sizeof(size_t) * 2 * ht->digest_leaves);
+    bzero(ht_bloom_base(ht), ht->bloom_blocks * bloom_block_bits / 8);
+    ht->size = 0;
+    ht->log_tail[0] = ht->log_tail[1] = ht->log_live = 0;
+    ht->cold_tail = ht->cold_live = 0;
+    ht->slot_epoch++;
+    if (ht->flags & HT_NAMESPACES) {
+        int ns;
+        for (ns = 0; ns < HT_MAX_NAMESPACES; ns++)
+            ht_ns_base(ht)[ns].size = ht_ns_base(ht)[ns].bytes = 0;
+    }
+    ht_mark_dirty(ht, ht, ht->dirty_offset); //header, namespaces and flags
+    ht_journal(ht, NULL, 0, NULL, HT_JOURNAL_RESET);
+}
+
+size_t ht_max_size(hashtable *ht) {
+    return ht->capacity * max_load_factor;
+}
+
+void ht_set_size(hashtable *ht, size_t size) {
+    ht->size = size;
+    ht_mark_dirty(ht, ht, sizeof(hashtable));
+}
+
+//remember which snapshot the table now mirrors, so deltas can follow it
+void ht_set_source(hashtable *ht, size_t table_id, size_t seq) {
+    ht->source_id  = table_id;
+    ht->source_seq = seq;
+    ht_mark_dirty(ht, ht, sizeof(hashtable));
+}
+
+/*
+ * Digest of the whole contents of an HT_DIGEST table (0 when empty, or
+ * without the flag); equal for tables with equal contents, whatever
+ * their capacity or history.
+ */
+size_t ht_digest(hashtable *ht) {
+    return ht_digest_node(ht, 1);
+}
+
+//node of the hash tree, 0 past its end; see ht_diff()
+size_t ht_digest_node(hashtable *ht, size_t node) {
+    if (!(ht->flags & HT_DIGEST) || node >= 2 * ht->digest_leaves)
+        return 0;
+    return ht_digest_base(ht)[node];
+}
+
+//remember how far a replica got in the journal of the table it follows
+void ht_set_follow(hashtable *ht, size_t table_id, size_t pos) {
+    ht->follow_id  = table_id;
+    ht->follow_pos = pos;
+    ht_mark_dirty(ht, ht, sizeof(hashtable));
+}
+
+//how many tables were published under this file name before this one
+void ht_set_generation(hashtable *ht, size_t generation) {
+    ht->generation = generation;
+    ht_mark_dirty(ht, ht, sizeof(hashtable));
+}
+
+//another file took this table's name; whoever has it mapped should move over
+void ht_supersede(hashtable *ht) {
+    __atomic_store_n(&ht->superseded, 1, __ATOMIC_RELEASE);
+    ht_mark_dirty(ht, ht, sizeof(hashtable));
+}
+
+/*
+ * The table will never change again: ht_set() and ht_remove() fail with
+ * EROFS from now on, and readers may skip the table lock.  There is no
+ * way back; publish a rebuilt table instead.  Called with the lock held.
+ */
+void ht_seal(hashtable *ht) {
+    __atomic_store_n(&ht->sealed, 1, __ATOMIC_RELEASE);
+    ht_mark_dirty(ht, ht, sizeof(hashtable));
+}
+
+int ht_is_sealed(hashtable *ht) {
+    return __atomic_load_n(&ht->sealed, __ATOMIC_ACQUIRE) ? True : False;
+}
+
+//directory entry of namespace ns of an HT_NAMESPACES table
+ht_namespace* ht_namespace_at(hashtable *ht, int ns) {
+    return &ht_ns_base(ht)[ns];
+}
+
+void ht_namespace_changed(hashtable *ht, int ns) {
+    ht_mark_dirty(ht, &ht_ns_base(ht)[ns], sizeof(ht_namespace));
+}
+
+//bytes of log in use, live records and garbage alike
+size_t ht_log_used(hashtable *ht) {
+    return ht->log_tail[0] + ht->log_tail[1];
+}
+
+/*
+ * Appends switch to the other (empty) half of the log; what is still
+ * live in the old half is moved over by ht_compact_segment().  A
+ * compaction left unfinished, by a dead process or for lack of space,
+ * is resumed rather than started anew.  Called with the table lock held.
+ */
+static int ht_compact_begin(hashtable *ht) {
+    if (!(ht->flags & HT_LOG)) {
+        errno = ENOTSUP;
+        return False;
+    }
+    if (ht->sealed) {
+        errno = EROFS;
+        return False;
+    }
+    if (ht->compact_pid != 0) {
+        pid_t pid = (pid_t)ht->compact_pid;
+        if (pid == getpid() || kill(pid, 0) == 0 || errno == EPERM) {
+            errno = EBUSY;
+            return False;
+        }
+    }
+    if (ht->log_from == 0) {
+        ht->log_from   = ht->log_active + 1;
+        ht->log_active = 1 - ht->log_active;
+    }
+    ht->compact_pid = getpid();
+    ht_mark_dirty(ht, ht, sizeof(hashtable));
+    return True;
+}
+
+//move the live records of one segment out of the old half; returns the bytes moved
+static size_t ht_compact_segment(hashtable *ht, size_t seg) {
+    size_t first = seg * segment_slots, last = first + segment_slots, i, moved = 0;
+    size_t from = ht->log_from - 1;
+    char *flag_base = ht_flag_base(ht);
+    if (last > ht->capacity)
+        last = ht->capacity;
+
+    for (i = first; i < last; i++) {
+        size_t *slot = ht_log_ref(ht, i);
+        if (flag_base[i] != used || *slot / ht->log_half != from)
+            continue;
+        ht_str *key = ht_bucket_key(ht, i), *value = ht_bucket_value(ht, i);
+        size_t record = ht_log_append(ht, key->str, key->size, value->str, value->size);
+        if (record == log_full) {
+            errno = ENOSPC;
+            return log_full;
+        }
+        //same entry, new place: nothing for backups or deltas to see
+        ht_log_drop(ht, i);
+        *slot = record;
+        ht_mark_dirty(ht, slot, log_slot_size);
+        moved += log_record_size(key->size, value->size);
+    }
+    return moved;
+}
+
+//the old half holds nothing live any more; give its pages back
+static void ht_compact_end(hashtable *ht, BOOL done) {
+    if (done) {
+        size_t from = ht->log_from - 1;
+        ht->log_tail[from] = 0;
+        ht->log_from = 0;
+        madvise(ht_log_base(ht) + from * ht->log_half, ht->log_half, MADV_REMOVE);
+        ht_bloom_rebuild(ht);
+    }
+    ht->compact_pid = 0;
+    ht_mark_dirty(ht, ht, sizeof(hashtable));
+}
+
+/*
+ * Reclaim the space of overwritten and removed values of an HT_LOG
+ * table, Bitcask style: live records are rewritten, sequentially, into
+ * the other half of the log.  Like ht_backup(), called WITHOUT the table
+ * lock; lock/unlock(arg) take it for one segment at a time, so writers
+ * keep going (into the new half).  Returns the bytes moved, or -1 with
+ * errno set: ENOTSUP without HT_LOG, EBUSY while a live process is
+ * compacting, ENOSPC if the new half fills up, EROFS once it is sealed.
+ */
+long ht_compact(hashtable *ht, void (*lock)(void *), void (*unlock)(void *), void *arg) {
+    size_t seg, moved = 0, n;
+    int ok;
+
+    if (!(ht->flags & HT_LOG) && (ht->flags & HT_BLOOM)) {
+        //no log to compact, only the keys removed from the filter
+        lock(arg);
+        ok = !ht->sealed;
+        if (ok)
+            ht_bloom_rebuild(ht);
+        unlock(arg);
+        if (!ok)
+            errno = EROFS;
+        return ok ? 0 : -1;
+    }
+
+    lock(arg);
+    ok = ht_compact_begin(ht);
+    unlock(arg);
+    if (!ok)
+        return -1;
+
+    for (seg = 0; ok && seg < ht_segments(ht->capacity); seg++) {
+        lock(arg);
+        if (ht->sealed) {
+            //readers of a sealed table take no lock; leave values where they are
+            errno = EROFS;
+            n = log_full;
+        }
+        else
+            n = ht_compact_segment(ht, seg);
+        unlock(arg);
+        if (n == log_full)
+            ok = False;
+        else
+            moved += n;
+    }
+
+    int saved_errno = errno;
+    lock(arg);
+    ht_compact_end(ht, ok);
+    unlock(arg);
+    errno = saved_errno;
+    return ok ? (long)moved : -1;
+}
+
+/*
+ * HT_TIERED: give a new table its cold file, cold_size bytes (made at
+ * least a page), which the caller maps cold_offset bytes after the
+ * table.  Called with the table lock held, before anything is demoted.
+ */
+int ht_tier_init(hashtable *ht, const char *cold_path, size_t cold_size) {
+    if (!(ht->flags & HT_TIERED)) {
+        errno = ENOTSUP;
+        return False;
+    }
+    if (strlen(cold_path) >= HT_COLD_PATH) {
+        errno = ENAMETOOLONG;
+        return False;
+    }
+    ht->cold_offset = page_align(ht_file_size(ht));
+    ht->cold_size   = page_align(cold_size ? cold_size : 1);
+    ht->cold_tail   = ht->cold_live = 0;
+    strcpy(ht->cold_path, cold_path);
+    ht_mark_dirty(ht, ht, sizeof(hashtable));
+    return True;
+}
+
+/*
+ * ht_get() that also notes the time of the read for ht_tier_demote(),
+ * and with promote copies a value found in the cold file back into the
+ * log (it stays cold if the log is full).  Called with the table lock
+ * held; sealed tables are only read.
+ */
+ht_str* ht_access(hashtable *ht, const char *key, u_int32 key_size, int promote) {
+    if (!(ht->flags & HT_TIERED) || ht->sealed)
+        return ht_get(ht, key, key_size);
+    if (!ht_bloom_maybe(ht, key, key_size))
+        return NULL;
+    size_t i = ht_probe(ht, key, key_size, False);
+    if (i == ht->capacity || ht_flag_base(ht)[i] != used)
+        return NULL;
+    return ht_slot_access(ht, i, promote);
+}
+
+//ht_access() of used slot i, found as for ht_slot_value(): no hashing and no probing
+ht_str* ht_slot_access(hashtable *ht, size_t i, int promote) {
+    if (!(ht->flags & HT_TIERED) || ht->sealed)
+        return ht_bucket_value(ht, i);
+
+    u_int32 now = ht_tier_now();
+    if (ht_atime_base(ht)[i] != now)
+        ht_atime_base(ht)[i] = now;
+
+    size_t *slot = ht_log_ref(ht, i);
+    if (promote && ht_is_cold(ht, *slot)) {
+        ht_str *bucket_key = ht_bucket_key(ht, i), *value = ht_bucket_value(ht, i);
+        size_t record = ht_log_append(ht, bucket_key->str, bucket_key->size, value->str, value->size);
+        if (record != log_full) {
+            //same entry, new place, as for compaction
+            ht_log_drop(ht, i);
+            *slot = record;
+            ht_mark_dirty(ht, slot, log_slot_size);
+        }
+    }
+    return ht_bucket_value(ht, i);
+}
+
+/*
+ * Move the records of entries neither read nor written since cutoff
+ * (seconds since the epoch) from the log to the end of the cold file,
+ * up to max_bytes of them (0 for no limit).  The log space they leave
+ * is reclaimed by the next compaction; the cold file is reused only
+ * once the table is cleared.  Called with the table lock held.  Returns
+ * the bytes moved, or -1 with errno set: ENOTSUP without HT_TIERED,
+ * EROFS once sealed, ENOSPC if the cold file had no room for any.
+ */
+long ht_tier_demote(hashtable *ht, size_t cutoff, size_t max_bytes) {
+    char *flag_base = ht_flag_base(ht);
+    size_t cold_base = ht->cold_offset - ht->log_offset, start = ht->cold_tail, moved = 0, i;
+    BOOL full = False;
+
+    if (!(ht->flags & HT_TIERED) || ht->cold_size == 0) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (ht->sealed) {
+        errno = EROFS;
+        return -1;
+    }
+
+    for (i = 0; i < ht->capacity && !full && (max_bytes == 0 || moved < max_bytes); i++) {
+        size_t *slot = ht_log_ref(ht, i);
+        if (flag_base[i] != used || ht_is_cold(ht, *slot) || ht_atime_base(ht)[i] > cutoff)
+            continue;
+        ht_str *key = (ht_str *)(ht_log_base(ht) + *slot), *value = ht_bucket_value(ht, i);
+        size_t len = log_record_size(key->size, value->size);
+        if (ht->cold_tail + len > ht->cold_size) {
+            full = True;
+            break;
+        }
+        memcpy(ht_log_base(ht) + cold_base + ht->cold_tail, key, len);
+        ht_log_drop(ht, i);
+        *slot = cold_base + ht->cold_tail;
+        ht_mark_dirty(ht, slot, log_slot_size);
+        ht->cold_tail += len;
+        ht->cold_live += len;
+        moved += len;
+    }
+    if (moved > 0) {
+        //the cold file is not dirty-tracked; start its write-back now
+        size_t first = start & ~(size_t)4095;
+        msync(ht_log_base(ht) + cold_base + first, ht->cold_tail - first, MS_ASYNC);
+        ht_mark_dirty(ht, ht, sizeof(hashtable));
+    }
+    if (full && moved == 0) {
+        errno = ENOSPC;
+        return -1;
+    }
+    return (long)moved;
+}
+
+/*
+ * Insert a key that is known not to be in the table, e.g. when rebuilding
+ * a cleared table from a snapshot.  Several threads may call this at once
+ * (slots are claimed by a compare-and-swap on the flag), but nobody else
+ * may use the table meanwhile, and the caller settles ht->size with
+ * ht_set_size() afterwards.
+ */
+int ht_insert_unique(hashtable *ht, const char *key, u_int32 key_size, const char *value, u_int32 value_size) {
+    if (!ht_fits(ht, key_size, value_size)) {
+        fprintf(stderr, "the item is too large: key_size(%u), value(%u)\n", key_size, value_size);
+        return False;
+    }
+
+    char *flag_base = ht_flag_base(ht);
+    size_t capacity = ht->capacity;
+    unsigned long hval = ht_hash(ht, key, key_size) % capacity;
+
+    size_t i = hval, di = 1;
+    while (!__sync_bool_compare_and_swap(&flag_base[i], (char)empty, (char)used)) {
+        if (!ht_probe_step(ht, hval, &i, &di))
+            return False; //no empty bucket left
+    }
+
+    ht_before_write(ht, i);
+    if (!ht_store(ht, i, key, key_size, value, value_size, False)) {
+        flag_base[i] = empty;
+        return False;
+    }
+    ht_bloom_add(ht, key, key_size);
+    ht_digest_entry(ht, i, +1);
+    ht_mark_dirty(ht, flag_base + i, 1);
     return True;
 }
 
+//bytes an entry takes in the log of an HT_LOG table, or in an HT_FROZEN one
+size_t ht_record_size(u_int32 key_size, u_int32 value_size) {
+    return log_record_size(key_size, value_size);
+}
+
+//where the probe chain of key starts
+size_t ht_home_slot(hashtable *ht, const char *key, u_int32 key_size) {
+    return ht_hash(ht, key, key_size) % ht->capacity;
+}
+
+//pull the flag and the slot where a probe chain starts into the cache
+void ht_prefetch_slot(hashtable *ht, size_t i) {
+    __builtin_prefetch(ht_flag_base(ht) + i);
+    __builtin_prefetch(ht_bucket(ht, i));
+}
+
+//the filter of just the keys in the table now; the caller has the table to itself
+void ht_bloom_rebuild(hashtable *ht) {
+    char *flag_base = ht_flag_base(ht);
+    size_t i;
+    if (!(ht->flags & HT_BLOOM))
+        return;
+    bzero(ht_bloom_base(ht), ht->bloom_blocks * bloom_block_bits / 8);
+    for (i = 0; i < ht->capacity; i++) {
+        if (flag_base[i] == used) {
+            ht_str *key = ht_bucket_key(ht, i);
+            ht_bloom_add(ht, key->str, key->size);
+        }
+    }
+    ht_mark_dirty(ht, ht_bloom_base(ht), ht->bloom_blocks * bloom_block_bits / 8);
+}
+
+/*
+ * Bulk load of a fresh table (see load.c): insert, or replace the value
+ * of an earlier occurrence of the key.  Threads may call this at once as
+ * long as all occurrences of a key go to the same thread, in order; a
+ * slot is claimed with a compare-and-swap, and marked used only once it
+ * is filled, so other threads never mistake it for one of their keys.
+ * Returns 1 for a new key, 2 for a replaced value, 0 on failure (table
+ * full, item too large, log full).  The caller settles ht->size.
+ */
+#define loading 3
+
+int ht_load_put(hashtable *ht, const char *key, u_int32 key_size, const char *value, u_int32 value_size) {
+    if (!ht_fits(ht, key_size, value_size)) {
+        fprintf(stderr, "the item is too large: key_size(%u), value(%u)\n", key_size, value_size);
+        return 0;
+    }
+
+    char *flag_base = ht_flag_base(ht);
+    size_t capacity = ht->capacity;
+    size_t h = ht_hash(ht, key, key_size), hval = h % capacity, i = hval, di = 1;
+
+    while (True) {
+        char flag = __atomic_load_n(&flag_base[i], __ATOMIC_ACQUIRE);
+        if (flag == used) {
+            if (ht_slot_holds(ht, i, h, key, key_size)) {
+                ht_before_write(ht, i);
+                ht_digest_entry(ht, i, -1);
+                if (!ht_store(ht, i, key, key_size, value, value_size, True))
+                    return 0;
+                ht_digest_entry(ht, i, +1);
+                return 2;
+            }
+        }
+        else if (flag == empty) {
+            if (__sync_bool_compare_and_swap(&flag_base[i], (char)empty, (char)loading))
+                break;
+            continue; //lost the race for this slot; look at it again
+        }
+        if (!ht_probe_step(ht, hval, &i, &di))
+            return 0; //no empty bucket left
+    }
+
+    ht_before_write(ht, i);
+    if (!ht_store(ht, i, key, key_size, value, value_size, False)) {
+        __atomic_store_n(&flag_base[i], (char)empty, __ATOMIC_RELEASE);
+        return 0;
+    }
+    ht_bloom_add(ht, key, key_size);
+    ht_digest_entry(ht, i, +1);
+    __atomic_store_n(&flag_base[i], (char)used, __ATOMIC_RELEASE);
+    ht_mark_dirty(ht, flag_base + i, 1);
+    return 1;
+}
+
 //don't forget to free(ht_iter)
 ht_iter* ht_get_iterator(hashtable *ht) {
     ht_iter* iter = ALLOC(ht_iter, 1);
@@ -213,12 +1827,10 @@ int ht_iter_next(ht_iter* iter) {
     size_t i = 0;
     hashtable *ht = iter->ht;
     char *flag_base = ht_flag_base(ht);
-    char *bucket_base = ht_bucket_base(ht);
 
     for (i = iter->pos + 1; i < ht->capacity; i++) {
-        if (flag_base[i] == used) {
-            char *bucket = bucket_base + i * bucket_size;
-            iter->key = (ht_str*)bucket, iter->value = (ht_str*)(bucket + max_key_size);
+        if ((ht->flags & HT_FROZEN) || flag_base[i] == used) {
+            iter->key = ht_bucket_key(ht, i), iter->value = ht_bucket_value(ht, i);
             iter->pos = i;
             return True;
         }
@@ -228,6 +1840,7 @@ int ht_iter_next(ht_iter* iter) {
 
 int ht_destroy(hashtable *ht) {
     ht->ref_cnt -= 1;
+    ht_mark_dirty(ht, ht, sizeof(hashtable));
     return ht->ref_cnt == 0 ? True : False;
 }
 
@@ -245,10 +1858,10 @@ static void dump_ht_str(ht_str *s) {
 
 int main() {
     size_t capacity = 500000;
-    printf("%u\n", ht_get_prime_by(capacity));
-    printf("%lu\n", ht_memory_size(capacity));
-    void *mem = malloc(ht_memory_size(capacity) + 1);
-    hashtable *ht = ht_init(mem, capacity, 0);
+    printf("%lu\n", ht_get_prime_by(capacity));
+    printf("%lu\n", ht_memory_size(capacity, 0, 0, 0));
+    void *mem = malloc(ht_memory_size(capacity, 0, 0, 0) + 1);
+    hashtable *ht = ht_init(mem, capacity, 0, 0, 0, 0);
 
     ht_set(ht, "hello", 5, "-----", 5);
     ht_set(ht, "hello1", 6, "hello1", 6);
@@ -271,7 +1884,7 @@ int main() {
 
     ht_remove(ht, "c", 1);
 
-    hashtable* ht1 = ht_init(mem, capacity, 0);
+    hashtable* ht1 = ht_init(mem, capacity, 0, 0, 0, 0);
 
     ht_iter* iter = ht_get_iterator(ht1);
     while (ht_iter_next(iter)) {
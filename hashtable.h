@@ -8,13 +8,49 @@
 #include <errno.h>
 #include <assert.h>
 
-#define ALLOC(type, n) ((type *)malloc(sizeof(type) * n))
+#define ALLOC(type, n) ((type *)malloc(sizeof(type) * (n)))
+
+#define HT_COLD_PATH    256     //room for the path of the cold file of an HT_TIERED table
+#define HT_MAX_LOG_VALUE 0x7FFFFFFFU //largest value of an HT_LOG table, as large as a Python string
 
 typedef struct __hashtable {
     unsigned magic;
     size_t ref_cnt, orig_capacity, capacity, size, flag_offset, bucket_offset;
+    size_t dirty_offset, dirty_chunks, dirty_count;
+    size_t flags, data_size;
+    size_t backup_pid, cow_offset, shadow_offset;
+    size_t seq_offset, change_seq, table_id, source_id, source_seq;
+    size_t mirror_offset, mirror_pid;
+    size_t slot_size, log_offset, log_half, log_active, log_from, log_live, compact_pid;
+    size_t log_tail[2];
+    size_t journal_offset, journal_size, journal_head, journal_reserve, journal_seq;
+    size_t follow_id, follow_pos;
+    size_t digest_offset, digest_leaves;
+    size_t generation, superseded, sealed;
+    size_t mph_offset, mph_buckets, mph_seed;
+    size_t ns_offset;
+    size_t bloom_offset, bloom_blocks;
+    size_t page_slots;
+    size_t atime_offset, cold_offset, cold_size, cold_tail, cold_live;
+    char cold_path[HT_COLD_PATH];
+    size_t slot_epoch;
 } hashtable;
 
+//table flags, fixed when the table is created
+#define HT_BACKUP   0x1     //reserve a shadow area for online backups
+#define HT_LOG      0x2     //append values to a log, slots only hold its offsets
+#define HT_JOURNAL  0x4     //record every change in a ring for followers
+#define HT_DIGEST   0x8     //keep a hash tree of the contents, see ht_digest()
+#define HT_FROZEN   0x10    //sealed, minimal perfect hash over packed records; see frozen.c
+#define HT_NAMESPACES 0x20  //keys belong to named namespaces; see namespace.c
+#define HT_BLOOM    0x40    //blocked Bloom filter of the keys in front of the probe chains
+#define HT_SET      0x80    //keys only: values are dropped, slots have no room for them
+#define HT_MULTI    0x100   //several values per key; see multimap.c
+#define HT_INTKEY   0x200   //8-byte keys kept in the slot, up to 8-byte values too unless HT_LOG
+#define HT_SPLIT    0x400   //HT_LOG with the hash and size of the key in the slot, for probes
+#define HT_PAGED    0x800   //slots in whole pages; probes try the page of the home slot first
+#define HT_TIERED   0x1000  //HT_LOG whose idle values can move out to a cold file; see ht_tier_demote()
+
 typedef unsigned u_int32;
 
 typedef struct _ht_str {
@@ -22,12 +58,32 @@ typedef struct _ht_str {
     char str[1];
 } ht_str;
 
+//a key and a value somewhere in memory, for building tables in bulk
+typedef struct _ht_pair {
+    const char *key, *value;
+    u_int32 key_size, value_size;
+} ht_pair;
+
+//HT_NAMESPACES tables: a directory entry, after the header
+#define HT_MAX_NAMESPACES   256     //0 is the unnamed one
+#define HT_NAMESPACE_NAME   56
+
+typedef struct _ht_namespace {
+    char name[HT_NAMESPACE_NAME];   //nul-terminated; empty for a free entry
+    size_t size, bytes, quota;      //entries, key and value bytes, limit on bytes (0 for none)
+} ht_namespace;
+
 typedef struct _ht_iter {
     hashtable *ht;
     size_t pos;
     ht_str *key, *value;
 } ht_iter;
 
+//slot states
+#define HT_SLOT_EMPTY   0
+#define HT_SLOT_USED    1
+#define HT_SLOT_REMOVED 2
+
 typedef int BOOL;
 #define True    1
 #define False   0
@@ -35,13 +91,116 @@ typedef int BOOL;
 ht_iter* ht_get_iterator(hashtable *ht);
 int ht_iter_next(ht_iter* iter);
 
-size_t ht_memory_size(size_t capacity);
-hashtable* ht_init(void *base_addr, size_t capacity, int force_init);
+size_t ht_max_capacity(void);
+size_t ht_memory_size(size_t capacity, unsigned flags, size_t log_size, size_t journal_size);
+size_t ht_file_size(hashtable *ht);
+hashtable* ht_init(void *base_addr, size_t capacity, unsigned flags, size_t log_size, size_t journal_size, int force_init);
 ht_str* ht_get(hashtable *ht, const char *key, u_int32 key_size);
 int ht_set(hashtable *ht, const char *key, u_int32 key_size, const char *value, u_int32 value_size);
+int ht_upsert(hashtable *ht, const char *key, u_int32 key_size, const char *value, u_int32 value_size, size_t *slot);
 int ht_remove(hashtable *ht, const char *key, u_int32 key_size);
 int ht_destroy(hashtable *ht);
 
 int ht_is_valid(hashtable *ht);
 
+void ht_clear(hashtable *ht);
+size_t ht_max_size(hashtable *ht);
+void ht_set_size(hashtable *ht, size_t size);
+void ht_set_source(hashtable *ht, size_t table_id, size_t seq);
+void ht_set_follow(hashtable *ht, size_t table_id, size_t pos);
+void ht_set_generation(hashtable *ht, size_t generation);
+void ht_supersede(hashtable *ht);
+void ht_seal(hashtable *ht);
+ht_namespace* ht_namespace_at(hashtable *ht, int ns);
+void ht_namespace_changed(hashtable *ht, int ns);
+int ht_is_sealed(hashtable *ht);
+size_t ht_segment_count(hashtable *ht);
+size_t ht_segment_first_slot(size_t seg);
+size_t ht_segment_seq(hashtable *ht, size_t seg);
+size_t ht_segment_buffer_size(void);
+int ht_slot(hashtable *ht, size_t i, ht_str **key, ht_str **value);
+size_t ht_clear_segment(hashtable *ht, size_t seg);
+int ht_place(hashtable *ht, size_t i, int flag, const char *key, u_int32 key_size, const char *value, u_int32 value_size);
+int ht_segment_next(const char *buf, size_t n_slots, size_t *pos, ht_str **key, ht_str **value);
+int ht_backup_begin(hashtable *ht);
+size_t ht_backup_copy(hashtable *ht, size_t seg, char *buf);
+void ht_backup_end(hashtable *ht);
+
+size_t ht_digest(hashtable *ht);
+size_t ht_digest_node(hashtable *ht, size_t node);
+size_t ht_log_used(hashtable *ht);
+long ht_compact(hashtable *ht, void (*lock)(void *), void (*unlock)(void *), void *arg);
+
+int ht_insert_unique(hashtable *ht, const char *key, u_int32 key_size, const char *value, u_int32 value_size);
+size_t ht_home_slot(hashtable *ht, const char *key, u_int32 key_size);
+void ht_prefetch_slot(hashtable *ht, size_t i);
+void ht_bloom_rebuild(hashtable *ht);
+int ht_load_put(hashtable *ht, const char *key, u_int32 key_size, const char *value, u_int32 value_size);
+size_t ht_record_size(u_int32 key_size, u_int32 value_size);
+
+/*
+ * Slot handles: a slot found once, by ht_find() or ht_upsert(), holds
+ * the same key for as long as slot_epoch and the table_id stay the same;
+ * removes, clears and restores move slot_epoch on.
+ */
+size_t ht_find(hashtable *ht, const char *key, u_int32 key_size);
+ht_str* ht_slot_value(hashtable *ht, size_t i);
+int ht_slot_set(hashtable *ht, size_t i, const char *value, u_int32 value_size);
+
+/*
+ * HT_TIERED tables: the cold file is mapped cold_offset bytes after the
+ * start of the table, so a record offset past the log points into it and
+ * reads need not tell the tiers apart.
+ */
+int ht_tier_init(hashtable *ht, const char *cold_path, size_t cold_size);
+ht_str* ht_access(hashtable *ht, const char *key, u_int32 key_size, int promote);
+ht_str* ht_slot_access(hashtable *ht, size_t i, int promote);
+long ht_tier_demote(hashtable *ht, size_t cutoff, size_t max_bytes);
+
+typedef void (*ht_range_cb)(void *arg, size_t offset, size_t len);
+
+size_t ht_dirty_bytes(hashtable *ht);
+size_t ht_flush_dirty(hashtable *ht);
+size_t ht_mirror_changes(hashtable *ht, size_t max_bytes, ht_range_cb cb, void *arg);
+void ht_mirror_reset(hashtable *ht);
+int ht_mirror_claim(hashtable *ht);
+void ht_mirror_release(hashtable *ht);
+
+/*
+ * Change journal of an HT_JOURNAL table: a ring of records
+ *   { size_t seq, u_int32 key_size, u_int32 value_size, key, value }
+ * 8-byte aligned, never wrapping around the end of the ring.
+ * Positions are byte counts since the table was created; a record at
+ * position pos lives at pos % journal_size until overwritten.
+ */
+#define HT_JOURNAL_REMOVE   0xFFFFFFFFU     //value_size of a remove
+#define HT_JOURNAL_RESET    0xFFFFFFFEU     //table cleared or restored: resync
+#define HT_JOURNAL_PAD      0xFFFFFFFDU     //filler up to the end of the ring
+
+typedef struct _ht_journal_entry {
+    size_t seq;
+    u_int32 key_size, value_size;
+    const char *key, *value;
+} ht_journal_entry;
+
+/*
+ * HT_FROZEN tables: key i hashes to h = ht_frozen_hash(seed, key), falls
+ * into bucket ht_frozen_bucket(h, n_buckets), and that bucket's
+ * displacement d puts it at slot ht_frozen_slot(h, d, n).  A slot holds
+ * the offset of a record laid out like those of HT_LOG tables.
+ */
+#define HT_FROZEN_DIRECT    0x80000000U     //displacement is the slot itself
+
+size_t ht_frozen_hash(size_t seed, const char *key, u_int32 key_size);
+size_t ht_frozen_bucket(size_t hash, size_t n_buckets);
+size_t ht_frozen_slot(size_t hash, u_int32 disp, size_t n);
+size_t ht_frozen_memory_size(size_t n, size_t n_buckets, size_t record_bytes);
+hashtable* ht_frozen_init(void *base_addr, size_t n, size_t n_buckets, size_t seed, size_t record_bytes);
+void ht_frozen_set_disp(hashtable *ht, size_t bucket, u_int32 disp);
+size_t ht_frozen_put(hashtable *ht, size_t slot, size_t at, const char *key, u_int32 key_size, const char *value, u_int32 value_size);
+
+size_t ht_journal_position(hashtable *ht);
+long ht_journal_read(hashtable *ht, size_t *pos, char *buf, size_t buf_size, size_t max_records);
+int ht_journal_next(const char *buf, size_t len, size_t *offset, ht_journal_entry *entry);
+
 #endif
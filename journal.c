@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "journal.h"
+
+//records are at most key + value + 16 bytes; this takes a few hundred
+#define follow_buffer_size  (256 * 1024)
+#define follow_batch        4096
+
+static long follow_resync(hashtable *replica, hashtable *primary, void (*lock)(void *), void (*unlock)(void *), void *arg) {
+    size_t i;
+    long copied = 0;
+    ht_str *key, *value;
+
+    lock(arg);
+    ht_set_follow(replica, 0, 0);
+    ht_clear(replica);
+    for (i = 0; i < primary->capacity; i++) {
+        if (ht_slot(primary, i, &key, &value) != HT_SLOT_USED)
+            continue;
+        if (!ht_set(replica, key->str, key->size, value->str, value->size)) {
+            unlock(arg);
+            errno = ENOSPC;
+            return -1;
+        }
+        copied++;
+    }
+    ht_set_follow(replica, primary->table_id, ht_journal_position(primary));
+    unlock(arg);
+    return copied;
+}
+
+long ht_follow(hashtable *replica, hashtable *primary, void (*lock)(void *), void (*unlock)(void *), void *arg) {
+    char *buf;
+    long applied = 0, n;
+
+    if (!(primary->flags & HT_JOURNAL)) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    buf = ALLOC(char, follow_buffer_size);
+    if (buf == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (replica->follow_id != primary->table_id) {
+        if ((applied = follow_resync(replica, primary, lock, unlock, arg)) < 0)
+            goto follow_done;
+    }
+
+    while (True) {
+        size_t pos = replica->follow_pos, offset = 0;
+        ht_journal_entry e;
+        BOOL reset = False;
+
+        n = ht_journal_read(primary, &pos, buf, follow_buffer_size, follow_batch);
+        if (n < 0 && errno == ESTALE)
+            reset = True;
+        else if (n < 0) {
+            applied = -1;
+            goto follow_done;
+        }
+        if (n == 0)
+            break;
+
+        while (!reset && ht_journal_next(buf, n, &offset, &e)) {
+            if (e.value_size == HT_JOURNAL_RESET) {
+                reset = True;
+                continue;
+            }
+            if (e.value_size == HT_JOURNAL_REMOVE)
+                ht_remove(replica, e.key, e.key_size);
+            else if (!ht_set(replica, e.key, e.key_size, e.value, e.value_size)) {
+                errno = ENOSPC;
+                applied = -1;
+                goto follow_done;
+            }
+            applied++;
+        }
+        if (reset) {
+            if ((n = follow_resync(replica, primary, lock, unlock, arg)) < 0) {
+                applied = -1;
+                goto follow_done;
+            }
+            applied += n;
+            continue;
+        }
+        ht_set_follow(replica, primary->table_id, pos);
+    }
+
+follow_done:
+    free(buf);
+    return applied;
+}
@@ -0,0 +1,21 @@
+#ifndef __HT_JOURNAL__
+#define __HT_JOURNAL__
+
+#include "hashtable.h"
+
+/*
+ * Keep a replica in step with an HT_JOURNAL primary by replaying its
+ * change journal.  The replica remembers which table it follows and how
+ * far it got; the first call, a reset record in the journal (the primary
+ * was cleared or restored) or falling more than a ring behind all make
+ * it start over with a full copy of the primary.
+ *
+ * The caller holds the replica lock; lock/unlock(arg) take the primary
+ * lock, which is only needed for a full copy.  Nothing but followers may
+ * write to a replica.  Returns the number of changes applied (entries
+ * copied, for a full copy), or -1 with errno set: ENOTSUP if the primary
+ * has no journal, ENOSPC if the replica is too small.
+ */
+long ht_follow(hashtable *replica, hashtable *primary, void (*lock)(void *), void (*unlock)(void *), void *arg);
+
+#endif
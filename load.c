@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "load.h"
+
+#define load_region_slots   4096
+#define load_region_batch   16      //regions a thread takes off the cursor at once
+#define load_max_threads    64
+
+enum load_phase {
+    load_count, load_scatter, load_insert
+};
+
+struct load_job {
+    hashtable *ht;
+    const ht_pair *pairs;
+    size_t n, n_regions;
+    int n_threads, phase;
+
+    size_t *region;         //of each pair
+    size_t *slots;          //per thread and region: a count, then a write position
+    size_t *order;          //pairs grouped by region, in input order within one
+    size_t *start;          //pairs of region r: order[start[r] .. start[r + 1])
+
+    size_t next_region;     //shared cursor, taken with atomic adds
+    size_t added;
+    int error;
+};
+
+struct load_worker {
+    struct load_job *job;
+    int t;
+};
+
+static void load_chunk(struct load_job *job, int t, size_t *first, size_t *last) {
+    size_t per_thread = job->n / job->n_threads + 1;
+    *first = t * per_thread;
+    *last  = *first + per_thread;
+    if (*first > job->n)
+        *first = job->n;
+    if (*last > job->n)
+        *last = job->n;
+}
+
+static void load_insert_region(struct load_job *job, size_t r, size_t *added) {
+    size_t k;
+    for (k = job->start[r]; k < job->start[r + 1] && !job->error; k++) {
+        const ht_pair *p = &job->pairs[job->order[k]];
+        int result = ht_load_put(job->ht, p->key, p->key_size, p->value, p->value_size);
+        if (result == 0)
+            __sync_bool_compare_and_swap(&job->error, 0, ENOSPC);
+        else if (result == 1)
+            *added += 1;
+    }
+}
+
+static void * load_worker_main(void *arg) {
+    struct load_worker *w = (struct load_worker *)arg;
+    struct load_job *job = w->job;
+    size_t *slots = job->slots + w->t * job->n_regions;
+    size_t i, first, last, added = 0;
+
+    load_chunk(job, w->t, &first, &last);
+    switch (job->phase) {
+    case load_count:
+        for (i = first; i < last; i++) {
+            job->region[i] = ht_home_slot(job->ht, job->pairs[i].key, job->pairs[i].key_size) / load_region_slots;
+            slots[job->region[i]]++;
+        }
+        break;
+    case load_scatter:
+        for (i = first; i < last; i++)
+            job->order[slots[job->region[i]]++] = i;
+        break;
+    case load_insert:
+        while (!job->error) {
+            size_t r = __sync_fetch_and_add(&job->next_region, load_region_batch), end = r + load_region_batch;
+            if (r >= job->n_regions)
+                break;
+            for (; r < end && r < job->n_regions; r++)
+                load_insert_region(job, r, &added);
+        }
+        __sync_fetch_and_add(&job->added, added);
+        break;
+    }
+    return NULL;
+}
+
+static void load_run(struct load_job *job, int phase) {
+    pthread_t threads[load_max_threads];
+    struct load_worker workers[load_max_threads];
+    int t, started[load_max_threads];
+
+    job->phase = phase;
+    for (t = 0; t < job->n_threads; t++) {
+        workers[t].job = job, workers[t].t = t;
+        started[t] = t > 0 && pthread_create(&threads[t], NULL, load_worker_main, &workers[t]) == 0;
+    }
+    //the chunks of threads that did not start are done here
+    for (t = 0; t < job->n_threads; t++)
+        if (!started[t])
+            load_worker_main(&workers[t]);
+    for (t = 1; t < job->n_threads; t++)
+        if (started[t])
+            pthread_join(threads[t], NULL);
+}
+
+long ht_load(hashtable *ht, const ht_pair *pairs, size_t n, int n_threads) {
+    struct load_job job;
+    size_t r;
+    int t;
+
+    if (n_threads <= 0)
+        n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads > load_max_threads)
+        n_threads = load_max_threads;
+    if ((size_t)n_threads > n / load_region_slots + 1)
+        n_threads = n / load_region_slots + 1;
+
+    bzero(&job, sizeof(job));
+    job.ht        = ht;
+    job.pairs     = pairs;
+    job.n         = n;
+    job.n_threads = n_threads;
+    job.n_regions = ht->capacity / load_region_slots + 1;
+    job.region    = ALLOC(size_t, n + 1);
+    job.order     = ALLOC(size_t, n + 1);
+    job.start     = ALLOC(size_t, job.n_regions + 1);
+    job.slots     = ALLOC(size_t, job.n_regions * n_threads);
+    if (!job.region || !job.order || !job.start || !job.slots) {
+        free(job.region), free(job.order), free(job.start), free(job.slots);
+        errno = ENOMEM;
+        return -1;
+    }
+    bzero(job.slots, sizeof(size_t) * job.n_regions * n_threads);
+
+    //a counting sort by region; thread t's chunk goes ahead of thread
+    //t+1's within a region, so duplicates keep their order
+    load_run(&job, load_count);
+    size_t at = 0;
+    for (r = 0; r < job.n_regions; r++) {
+        job.start[r] = at;
+        for (t = 0; t < n_threads; t++) {
+            size_t count = job.slots[t * job.n_regions + r];
+            job.slots[t * job.n_regions + r] = at;
+            at += count;
+        }
+    }
+    job.start[job.n_regions] = at;
+    load_run(&job, load_scatter);
+    load_run(&job, load_insert);
+
+    free(job.region), free(job.order), free(job.start), free(job.slots);
+    ht_set_size(ht, ht->size + job.added);
+    if (job.error) {
+        errno = job.error;
+        return -1;
+    }
+    return (long)job.added;
+}
+
+long ht_build(const char *path, const ht_pair *pairs, size_t n, size_t capacity, unsigned flags, size_t journal_size, int n_threads) {
+    char tmp_path[PATH_MAX];
+    size_t i, log_size = 0;
+    long added = -1;
+    int saved_errno;
+
+    if (capacity < n)
+        capacity = n;
+    if (capacity == 0)
+        capacity = 1;
+    if (capacity > ht_max_capacity()) {
+        errno = EFBIG;
+        return -1;
+    }
+    //a PAGED chain only stays in one page when the slots alone tell keys apart
+    if ((flags & HT_PAGED) && !(flags & (HT_SPLIT | HT_INTKEY))) {
+        errno = EINVAL;
+        return -1;
+    }
+    //the shadow of a backup holds whole buckets, which log records need not fit
+    if ((flags & HT_BACKUP) && (flags & (HT_LOG | HT_SPLIT))) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (flags & HT_LOG) {
+        for (i = 0; i < n; i++)
+            log_size += ht_record_size(pairs[i].key_size, pairs[i].value_size);
+        //room for the same average record in every slot
+        if (n > 0 && capacity > n)
+            log_size = log_size / n * capacity;
+        if (log_size == 0)
+            log_size = n ? 1 : 0;
+    }
+    size_t mem_size = ht_memory_size(capacity, flags, log_size, journal_size);
+
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, mem_size) != 0)
+        goto build_failed;
+    void *mem = mmap(NULL, mem_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED)
+        goto build_failed;
+
+    hashtable *ht = ht_init(mem, capacity, flags, log_size, journal_size, True);
+    added = ht_load(ht, pairs, n, n_threads);
+    ht_destroy(ht);
+
+    saved_errno = errno;
+    if (added >= 0 && msync(mem, mem_size, MS_SYNC) != 0)
+        added = -1, saved_errno = errno;
+    munmap(mem, mem_size);
+    errno = saved_errno;
+    if (added < 0)
+        goto build_failed;
+    if (close(fd) != 0 || rename(tmp_path, path) != 0) {
+        fd = -1;
+        added = -1;
+        goto build_failed;
+    }
+    return added;
+
+build_failed:
+    saved_errno = errno;
+    if (fd >= 0)
+        close(fd);
+    unlink(tmp_path);
+    errno = saved_errno;
+    return -1;
+}
+
+static int add_pair(ht_pair **pairs, size_t *n, size_t *room, const char *key, size_t key_size, const char *value, size_t value_size) {
+    if (*n == *room) {
+        size_t grown = *room ? *room * 2 : 1024;
+        ht_pair *p = (ht_pair *)realloc(*pairs, sizeof(ht_pair) * grown);
+        if (p == NULL)
+            return False;
+        *pairs = p, *room = grown;
+    }
+    (*pairs)[*n].key        = key;
+    (*pairs)[*n].key_size   = key_size;
+    (*pairs)[*n].value      = value;
+    (*pairs)[*n].value_size = value_size;
+    (*n)++;
+    return True;
+}
+
+long ht_load_parse(const char *buf, size_t len, int delimiter, ht_pair **pairs) {
+    size_t n = 0, room = 0, pos = 0;
+    int err = EBADMSG;
+    *pairs = NULL;
+
+    while (pos < len) {
+        if (delimiter < 0) {
+            u_int32 key_size, value_size;
+            if (len - pos < 2 * sizeof(u_int32))
+                goto parse_failed;
+            memcpy(&key_size, buf + pos, sizeof(u_int32));
+            memcpy(&value_size, buf + pos + sizeof(u_int32), sizeof(u_int32));
+            pos += 2 * sizeof(u_int32);
+            if (len - pos < (size_t)key_size + value_size)
+                goto parse_failed;
+            if (!add_pair(pairs, &n, &room, buf + pos, key_size, buf + pos + key_size, value_size)) {
+                err = ENOMEM;
+                goto parse_failed;
+            }
+            pos += (size_t)key_size + value_size;
+            continue;
+        }
+
+        const char *line = buf + pos, *end = memchr(line, '\n', len - pos);
+        size_t line_len = end ? (size_t)(end - line) : len - pos;
+        pos += line_len + 1;
+        if (line_len > 0 && line[line_len - 1] == '\r')
+            line_len--;
+        if (line_len == 0)
+            continue;
+        const char *sep = memchr(line, delimiter, line_len);
+        if (sep == NULL)
+            goto parse_failed;
+        if (!add_pair(pairs, &n, &room, line, sep - line, sep + 1, line + line_len - sep - 1)) {
+            err = ENOMEM;
+            goto parse_failed;
+        }
+    }
+    return (long)n;
+
+parse_failed:
+    free(*pairs);
+    *pairs = NULL;
+    errno = err;
+    return -1;
+}
@@ -0,0 +1,36 @@
+#ifndef __HT_LOAD__
+#define __HT_LOAD__
+
+#include "hashtable.h"
+
+/*
+ * Insert n pairs into a fresh table nobody else uses yet, with n_threads
+ * threads (0 for one per cpu).  The pairs are grouped by the region of
+ * 4096 slots their probe chains start in, keeping their order within a
+ * region, and the threads take regions off a shared cursor; so each
+ * thread mostly writes its own stretch of the table, and no lock is
+ * taken.  A later pair with the same key replaces the value of an
+ * earlier one.  Returns the number of distinct keys, or -1 with errno
+ * set: ENOSPC if the table or its log is too small, ENOMEM.
+ */
+long ht_load(hashtable *ht, const ht_pair *pairs, size_t n, int n_threads);
+
+/*
+ * Write a table of the n pairs to path (through path.tmp), with room for
+ * capacity entries (0, or anything below n, for exactly n) and, for
+ * HT_LOG, a log that holds as many records of their average size.
+ * Returns the number of distinct keys, or -1 with errno set.
+ */
+long ht_build(const char *path, const ht_pair *pairs, size_t n, size_t capacity, unsigned flags, size_t journal_size, int n_threads);
+
+/*
+ * Split buf into pairs that point into it: lines of key, delimiter,
+ * value (a trailing \r is dropped, empty lines are skipped), or, for a
+ * negative delimiter, records of { u_int32 key_size, u_int32 value_size,
+ * key, value }.  *pairs is malloc()ed.  Returns the number of pairs, or
+ * -1 with errno set to EBADMSG for a line without the delimiter or a
+ * truncated record.
+ */
+long ht_load_parse(const char *buf, size_t len, int delimiter, ht_pair **pairs);
+
+#endif
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "merge.h"
+
+#define merge_region_slots  4096
+#define merge_prefetch      8       //inserts ahead whose chains are pulled in
+#define merge_max_threads   64
+#define merge_max_value     2048    //more than a bucket holds; log values go to the heap
+
+struct merge_job {
+    hashtable *dst, **srcs;
+    size_t n_srcs;
+    ht_pair *pairs;         //of source s: pairs[first[s] .. first[s] + count[s])
+    size_t *home;           //home slot in dst of each pair
+    size_t *first, *count;
+    size_t next_source;     //shared cursor, taken with atomic adds
+};
+
+static void merge_collect(struct merge_job *job, size_t s) {
+    hashtable *src = job->srcs[s];
+    ht_pair *pairs = job->pairs + job->first[s];
+    size_t *home = job->home + job->first[s], n = 0;
+    ht_iter *iter = ht_get_iterator(src);
+
+    while (n < src->size && ht_iter_next(iter)) {
+        pairs[n].key        = iter->key->str;
+        pairs[n].key_size   = iter->key->size;
+        pairs[n].value      = iter->value->str;
+        pairs[n].value_size = iter->value->size;
+        home[n] = ht_home_slot(job->dst, iter->key->str, iter->key->size);
+        n++;
+    }
+    free(iter);
+    job->count[s] = n;
+}
+
+static void * merge_worker_main(void *arg) {
+    struct merge_job *job = (struct merge_job *)arg;
+    while (True) {
+        size_t s = __sync_fetch_and_add(&job->next_source, 1);
+        if (s >= job->n_srcs)
+            break;
+        merge_collect(job, s);
+    }
+    return NULL;
+}
+
+static void merge_read_sources(struct merge_job *job, int n_threads) {
+    pthread_t threads[merge_max_threads];
+    int t, started = 0;
+
+    for (t = 1; t < n_threads; t++)
+        if (pthread_create(&threads[started], NULL, merge_worker_main, job) == 0)
+            started++;
+    merge_worker_main(job);
+    for (t = 0; t < started; t++)
+        pthread_join(threads[t], NULL);
+}
+
+//a decimal integer, all of the string
+static int parse_integer(const char *s, size_t len, long long *result) {
+    char buf[32];
+    char *end;
+    if (len == 0 || len >= sizeof(buf))
+        return False;
+    memcpy(buf, s, len);
+    buf[len] = 0;
+    errno = 0;
+    *result = strtoll(buf, &end, 10);
+    return errno == 0 && *end == 0 && !isspace((unsigned char)buf[0]);
+}
+
+//1 if dst changed, 0 if not, -1 with errno set
+static int merge_put(hashtable *dst, const ht_pair *p, int mode) {
+    char buf[merge_max_value], *joined = NULL, *to = buf;
+    const char *value = p->value;
+    size_t value_size = p->value_size;
+    ht_str *old = ht_get(dst, p->key, p->key_size);
+    long long a = 0, b;
+
+    switch (mode) {
+    case HT_MERGE_OVERWRITE:
+        if (old != NULL && old->size == value_size && memcmp(old->str, value, value_size) == 0)
+            return 0;
+        break;
+    case HT_MERGE_KEEP:
+        if (old != NULL)
+            return 0;
+        break;
+    case HT_MERGE_INCR:
+        if (!parse_integer(value, value_size, &b) || (old != NULL && !parse_integer(old->str, old->size, &a))) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (__builtin_add_overflow(a, b, &a)) {
+            errno = ERANGE;
+            return -1;
+        }
+        value_size = snprintf(buf, sizeof(buf), "%lld", a);
+        value = buf;
+        break;
+    case HT_MERGE_APPEND:
+        if (old == NULL)
+            break;
+        if (old->size + value_size > HT_MAX_LOG_VALUE) {
+            errno = ENOSPC;
+            return -1;
+        }
+        if (old->size + value_size > sizeof(buf) && (to = joined = ALLOC(char, old->size + value_size)) == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        memcpy(to, old->str, old->size);
+        memcpy(to + old->size, value, value_size);
+        value_size += old->size;
+        value = to;
+        break;
+    }
+    int ok = ht_set(dst, p->key, p->key_size, value, value_size);
+    free(joined);
+    if (!ok) {
+        errno = ENOSPC;
+        return -1;
+    }
+    return 1;
+}
+
+long ht_merge(hashtable *dst, hashtable **srcs, size_t n_srcs, int mode, int n_threads) {
+    struct merge_job job;
+    size_t s, i, k, r, total = 0;
+    long changed = 0;
+
+    if (n_threads <= 0)
+        n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads > merge_max_threads)
+        n_threads = merge_max_threads;
+    if ((size_t)n_threads > n_srcs)
+        n_threads = n_srcs;
+
+    bzero(&job, sizeof(job));
+    job.dst    = dst;
+    job.srcs   = srcs;
+    job.n_srcs = n_srcs;
+    job.first  = ALLOC(size_t, n_srcs + 1);
+    job.count  = ALLOC(size_t, n_srcs + 1);
+    if (job.first != NULL)
+        for (s = 0; s < n_srcs; s++)
+            job.first[s] = total, total += srcs[s]->size;
+    size_t n_regions = dst->capacity / merge_region_slots + 1;
+    size_t *start = ALLOC(size_t, n_regions + 1), *order = ALLOC(size_t, total + 1);
+    job.pairs = ALLOC(ht_pair, total + 1);
+    job.home  = ALLOC(size_t, total + 1);
+    if (!job.first || !job.count || !start || !order || !job.pairs || !job.home) {
+        free(job.first), free(job.count), free(start), free(order), free(job.pairs), free(job.home);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    merge_read_sources(&job, n_threads);
+
+    //a counting sort by region, sources in order within one, so the
+    //conflicts of a key still resolve in the order of the sources
+    bzero(start, sizeof(size_t) * (n_regions + 1));
+    for (s = 0; s < n_srcs; s++)
+        for (i = job.first[s]; i < job.first[s] + job.count[s]; i++)
+            start[job.home[i] / merge_region_slots + 1]++;
+    for (r = 0; r < n_regions; r++)
+        start[r + 1] += start[r];
+    for (s = 0; s < n_srcs; s++)
+        for (i = job.first[s]; i < job.first[s] + job.count[s]; i++)
+            order[start[job.home[i] / merge_region_slots]++] = i;
+    size_t n = start[n_regions - 1];
+
+    for (k = 0; k < n; k++) {
+        if (k + merge_prefetch < n)
+            ht_prefetch_slot(dst, job.home[order[k + merge_prefetch]]);
+        int result = merge_put(dst, &job.pairs[order[k]], mode);
+        if (result < 0) {
+            changed = -1;
+            break;
+        }
+        changed += result;
+    }
+
+    int saved_errno = errno;
+    free(job.first), free(job.count), free(start), free(order), free(job.pairs), free(job.home);
+    errno = saved_errno;
+    return changed;
+}
@@ -0,0 +1,31 @@
+#ifndef __HT_MERGE__
+#define __HT_MERGE__
+
+#include "hashtable.h"
+
+//what a merge does with a key that the destination already has
+enum ht_merge_mode {
+    HT_MERGE_OVERWRITE,     //take the value of the source
+    HT_MERGE_KEEP,          //keep the value there is
+    HT_MERGE_INCR,          //add decimal integers
+    HT_MERGE_APPEND         //append the value of the source
+};
+
+/*
+ * Merge the entries of n_srcs tables into dst, in the order given: with
+ * HT_MERGE_OVERWRITE the last source wins, with HT_MERGE_KEEP the first
+ * value (dst's own, if it had one).  n_threads threads (0 for one per
+ * cpu) read the sources at once, each taking whole sources; then the
+ * entries are sorted by the region of dst their probe chains start in,
+ * keeping their order within a region, and inserted with the next
+ * chains prefetched.  The caller holds every lock.
+ *
+ * Returns the number of entries added or changed in dst, or -1 with
+ * errno set: EINVAL for a value that is not an integer under
+ * HT_MERGE_INCR, ERANGE for a sum beyond a long long, ENOSPC if dst
+ * filled up (or an appended value got too large), ENOMEM.  dst keeps
+ * whatever was merged before the error.
+ */
+long ht_merge(hashtable *dst, hashtable **srcs, size_t n_srcs, int mode, int n_threads);
+
+#endif
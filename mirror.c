@@ -0,0 +1,469 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#ifdef __NR_io_uring_setup
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#include "mirror.h"
+
+//ranges are cut at this size so the writes can proceed in parallel
+#define mirror_max_write    (1024 * 1024)
+#define mirror_queue_depth  64
+
+struct mirror_range {
+    size_t offset, len;
+};
+
+#ifdef HAVE_IO_URING
+struct uring {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+};
+#endif
+
+struct _ht_mirror {
+    hashtable *ht;
+    int fd;
+    double interval;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;        //wakes the mirror thread, and sync() waiters
+    int stop, in_pass, sync_requested;
+    size_t passes, bytes;
+    int error;
+
+    //ranges collected by the current pass
+    struct mirror_range *ranges;
+    size_t n_ranges, max_ranges;
+
+#ifdef HAVE_IO_URING
+    int use_uring, have_ring;   //have_ring stays set after falling back to the pool
+    struct uring ring;
+#endif
+
+    //pwrite pool, started when it is first needed
+    int pool_size, n_workers;
+    pthread_t *workers;
+    pthread_cond_t work_cond, done_cond;
+    unsigned generation;
+    int workers_done, pool_stop;
+    size_t next_range;
+};
+
+static void mirror_pwrite(ht_mirror *m, const struct mirror_range *r) {
+    const char *src = (const char *)m->ht + r->offset;
+    size_t done = 0;
+    while (done < r->len) {
+        ssize_t n = pwrite(m->fd, src + done, r->len - done, r->offset + done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            __sync_bool_compare_and_swap(&m->error, 0, errno);
+            return;
+        }
+        done += n;
+    }
+}
+
+#ifdef HAVE_IO_URING
+static int uring_init(struct uring *r, unsigned entries) {
+    struct io_uring_params p;
+    bzero(&p, sizeof(p));
+    bzero(r, sizeof(struct uring));
+
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return False;
+
+    r->sq_size   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->sq_size = r->cq_size = r->sq_size > r->cq_size ? r->sq_size : r->cq_size;
+
+    r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        goto init_failed;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cq_ptr = r->sq_ptr;
+    else {
+        r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED)
+            goto init_failed;
+    }
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto init_failed;
+
+    r->entries  = p.sq_entries;
+    r->sq_head  = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+    r->sq_tail  = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask  = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+    r->cq_head  = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail  = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask  = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+    return True;
+
+init_failed:
+    if (r->sq_ptr != NULL && r->sq_ptr != MAP_FAILED)
+        munmap(r->sq_ptr, r->sq_size);
+    if (r->cq_ptr != NULL && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_size);
+    close(r->fd);
+    return False;
+}
+
+static void uring_exit(struct uring *r) {
+    munmap(r->sqes, r->sqes_size);
+    if (r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_size);
+    munmap(r->sq_ptr, r->sq_size);
+    close(r->fd);
+}
+
+/*
+ * Submit the ranges as one batch of writes straight from the mapping and
+ * wait for all of them.  Anything io_uring does not finish (short write,
+ * an old kernel without IORING_OP_WRITE) is redone with pwrite().
+ */
+static void uring_write_ranges(ht_mirror *m, struct mirror_range *ranges, size_t n) {
+    struct uring *r = &m->ring;
+    unsigned tail = *r->sq_tail, i;
+
+    for (i = 0; i < n; i++) {
+        unsigned idx = tail & *r->sq_mask;
+        struct io_uring_sqe *sqe = &r->sqes[idx];
+        bzero(sqe, sizeof(*sqe));
+        sqe->opcode    = IORING_OP_WRITE;
+        sqe->fd        = m->fd;
+        sqe->addr      = (unsigned long)((char *)m->ht + ranges[i].offset);
+        sqe->len       = ranges[i].len;
+        sqe->off       = ranges[i].offset;
+        sqe->user_data = i;
+        r->sq_array[idx] = idx;
+        tail++;
+    }
+    __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+    unsigned to_submit = n, reaped = 0;
+    while (reaped < n) {
+        int ret = syscall(__NR_io_uring_enter, r->fd, to_submit, n - reaped, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            //the ring is unusable; this batch is finished here, the
+            //rest of the pass and the passes after it go to the pool
+            m->use_uring = False;
+            for (i = 0; i < n; i++)
+                mirror_pwrite(m, &ranges[i]);
+            return;
+        }
+        to_submit = 0;
+
+        unsigned head = *r->cq_head;
+        while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            struct mirror_range *range = &ranges[cqe->user_data];
+            if (cqe->res != (int)range->len) {
+                if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)
+                    m->use_uring = False;
+                mirror_pwrite(m, range);
+            }
+            head++;
+            reaped++;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+#endif
+
+static void * pool_worker(void *arg) {
+    ht_mirror *m = (ht_mirror *)arg;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&m->mutex);
+    while (True) {
+        while (m->generation == seen && !m->pool_stop)
+            pthread_cond_wait(&m->work_cond, &m->mutex);
+        if (m->pool_stop)
+            break;
+        seen = m->generation;
+        pthread_mutex_unlock(&m->mutex);
+
+        size_t i;
+        while ((i = __sync_fetch_and_add(&m->next_range, 1)) < m->n_ranges)
+            mirror_pwrite(m, &m->ranges[i]);
+
+        pthread_mutex_lock(&m->mutex);
+        if (++m->workers_done == m->n_workers)
+            pthread_cond_signal(&m->done_cond);
+    }
+    pthread_mutex_unlock(&m->mutex);
+    return NULL;
+}
+
+static void start_pool(ht_mirror *m) {
+    int i;
+    m->workers = ALLOC(pthread_t, m->pool_size + 1);
+    for (i = 0; m->workers != NULL && i < m->pool_size; i++) {
+        if (pthread_create(&m->workers[i], NULL, pool_worker, m) != 0)
+            break;
+    }
+    m->n_workers = m->workers != NULL ? i : 0;
+}
+
+//write the ranges from first on
+static void pool_write_ranges(ht_mirror *m, size_t first) {
+    size_t i;
+    if (m->workers == NULL && m->pool_size > 0)
+        start_pool(m);
+    if (m->n_workers == 0) {
+        for (i = first; i < m->n_ranges; i++)
+            mirror_pwrite(m, &m->ranges[i]);
+        return;
+    }
+    pthread_mutex_lock(&m->mutex);
+    m->next_range   = first;
+    m->workers_done = 0;
+    m->generation++;
+    pthread_cond_broadcast(&m->work_cond);
+    while (m->workers_done < m->n_workers)
+        pthread_cond_wait(&m->done_cond, &m->mutex);
+    pthread_mutex_unlock(&m->mutex);
+}
+
+static void collect_range(void *arg, size_t offset, size_t len) {
+    ht_mirror *m = (ht_mirror *)arg;
+    if (m->n_ranges == m->max_ranges) {
+        size_t max_ranges = m->max_ranges ? m->max_ranges * 2 : 256;
+        struct mirror_range *ranges = realloc(m->ranges, max_ranges * sizeof(struct mirror_range));
+        if (ranges == NULL) {
+            //can't queue it: fall back to writing it right away
+            struct mirror_range r = { offset, len };
+            mirror_pwrite(m, &r);
+            m->bytes += len;
+            return;
+        }
+        m->ranges = ranges, m->max_ranges = max_ranges;
+    }
+    m->ranges[m->n_ranges].offset = offset;
+    m->ranges[m->n_ranges].len    = len;
+    m->n_ranges++;
+    m->bytes += len;
+}
+
+static void mirror_write_ranges(ht_mirror *m) {
+    size_t i = 0;
+#ifdef HAVE_IO_URING
+    for (; m->use_uring && i < m->n_ranges; i += m->ring.entries) {
+        size_t n = m->n_ranges - i;
+        uring_write_ranges(m, m->ranges + i, n < m->ring.entries ? n : m->ring.entries);
+    }
+#endif
+    if (i < m->n_ranges)
+        pool_write_ranges(m, i);
+}
+
+//one round: take the marked chunks, write them out, make them durable
+static void mirror_pass(ht_mirror *m, int full) {
+    m->n_ranges = 0;
+    if (full) {
+        size_t offset;
+        ht_mirror_reset(m->ht);
+        for (offset = 0; offset < m->ht->data_size; offset += mirror_max_write) {
+            size_t len = m->ht->data_size - offset;
+            collect_range(m, offset, len < mirror_max_write ? len : mirror_max_write);
+        }
+    }
+    else
+        ht_mirror_changes(m->ht, mirror_max_write, collect_range, m);
+
+    if (m->n_ranges > 0) {
+        mirror_write_ranges(m);
+        if (fdatasync(m->fd) != 0)
+            __sync_bool_compare_and_swap(&m->error, 0, errno);
+    }
+}
+
+static void * mirror_main(void *arg) {
+    ht_mirror *m = (ht_mirror *)arg;
+    struct timeval now;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&m->mutex);
+    while (!m->stop) {
+        if (!m->sync_requested) {
+            gettimeofday(&now, NULL);
+            double t = now.tv_sec + now.tv_usec / 1000000.0 + m->interval;
+            deadline.tv_sec  = (time_t)t;
+            deadline.tv_nsec = (long)((t - deadline.tv_sec) * 1000000000.0);
+            pthread_cond_timedwait(&m->cond, &m->mutex, &deadline);
+        }
+        m->sync_requested = False;
+        m->in_pass = True;
+        pthread_mutex_unlock(&m->mutex);
+
+        mirror_pass(m, False);
+
+        pthread_mutex_lock(&m->mutex);
+        m->in_pass = False;
+        m->passes++;
+        pthread_cond_broadcast(&m->cond);
+    }
+    pthread_mutex_unlock(&m->mutex);
+    return NULL;
+}
+
+ht_mirror* ht_mirror_start(hashtable *ht, const char *path, double interval, int n_workers) {
+    ht_mirror *m = ALLOC(ht_mirror, 1);
+    int i, err;
+
+    if (m == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    bzero(m, sizeof(ht_mirror));
+    m->ht        = ht;
+    m->interval  = interval > 0 ? interval : 0.1;
+    m->pool_size = n_workers > 0 ? n_workers : 0;
+
+    if (!ht_mirror_claim(ht)) {
+        free(m);
+        return NULL;
+    }
+    pthread_mutex_init(&m->mutex, NULL);
+    pthread_cond_init(&m->cond, NULL);
+    pthread_cond_init(&m->work_cond, NULL);
+    pthread_cond_init(&m->done_cond, NULL);
+
+    m->fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (m->fd < 0 || ftruncate(m->fd, ht->data_size) != 0)
+        goto start_failed;
+
+#ifdef HAVE_IO_URING
+    m->use_uring = m->have_ring = uring_init(&m->ring, mirror_queue_depth);
+    if (!m->use_uring)
+#endif
+        start_pool(m);
+
+    //bring the file up to date before following the changes
+    mirror_pass(m, True);
+
+    err = pthread_create(&m->thread, NULL, mirror_main, m);
+    if (err != 0) {
+        m->stop = True;
+        errno = err;
+        goto start_failed;
+    }
+    return m;
+
+start_failed:
+    err = errno;
+    pthread_mutex_lock(&m->mutex);
+    m->pool_stop = True;
+    pthread_cond_broadcast(&m->work_cond);
+    pthread_mutex_unlock(&m->mutex);
+    for (i = 0; i < m->n_workers; i++)
+        pthread_join(m->workers[i], NULL);
+#ifdef HAVE_IO_URING
+    if (m->have_ring)
+        uring_exit(&m->ring);
+#endif
+    if (m->fd >= 0)
+        close(m->fd);
+    ht_mirror_release(ht);
+    pthread_cond_destroy(&m->done_cond);
+    pthread_cond_destroy(&m->work_cond);
+    pthread_cond_destroy(&m->cond);
+    pthread_mutex_destroy(&m->mutex);
+    free(m->workers);
+    free(m->ranges);
+    free(m);
+    errno = err;
+    return NULL;
+}
+
+int ht_mirror_sync(ht_mirror *m) {
+    pthread_mutex_lock(&m->mutex);
+    //a pass already under way may have looked at the bits before our
+    //changes were marked, so wait for one that starts after this point
+    size_t target = m->passes + (m->in_pass ? 2 : 1);
+    m->sync_requested = True;
+    pthread_cond_broadcast(&m->cond);
+    while (m->passes < target && !m->stop)
+        pthread_cond_wait(&m->cond, &m->mutex);
+    pthread_mutex_unlock(&m->mutex);
+    return m->error;
+}
+
+int ht_mirror_stop(ht_mirror *m) {
+    int i, err;
+
+    ht_mirror_sync(m);
+
+    pthread_mutex_lock(&m->mutex);
+    m->stop = True;
+    pthread_cond_broadcast(&m->cond);
+    pthread_mutex_unlock(&m->mutex);
+    pthread_join(m->thread, NULL);
+
+    pthread_mutex_lock(&m->mutex);
+    m->pool_stop = True;
+    pthread_cond_broadcast(&m->work_cond);
+    pthread_mutex_unlock(&m->mutex);
+    for (i = 0; i < m->n_workers; i++)
+        pthread_join(m->workers[i], NULL);
+
+#ifdef HAVE_IO_URING
+    if (m->have_ring)
+        uring_exit(&m->ring);
+#endif
+    close(m->fd);
+    ht_mirror_release(m->ht);
+
+    pthread_cond_destroy(&m->done_cond);
+    pthread_cond_destroy(&m->work_cond);
+    pthread_cond_destroy(&m->cond);
+    pthread_mutex_destroy(&m->mutex);
+    err = m->error;
+    free(m->workers);
+    free(m->ranges);
+    free(m);
+    return err;
+}
+
+const char* ht_mirror_engine(ht_mirror *m) {
+#ifdef HAVE_IO_URING
+    if (m->use_uring)
+        return "io_uring";
+#endif
+    return "pwrite";
+}
+
+size_t ht_mirror_bytes(ht_mirror *m) {
+    return m->bytes;
+}
@@ -0,0 +1,32 @@
+#ifndef __HT_MIRROR__
+#define __HT_MIRROR__
+
+#include "hashtable.h"
+
+/*
+ * Keeps a disk file in step with a table that lives somewhere faster
+ * (typically /dev/shm).  A background thread picks up the chunks marked
+ * by the table's writers and writes them from the mapping to the same
+ * offsets of the disk file, with io_uring when the kernel has it and a
+ * small pool of pwrite() threads otherwise.  Nothing on the request path
+ * waits for the disk; the file is an eventually consistent image that
+ * shmht.open() can use as it is (or after copying it back to tmpfs).
+ *
+ * Only one mirror per table at a time, in any process.
+ */
+
+typedef struct _ht_mirror ht_mirror;
+
+//NULL with errno set on failure (EBUSY: the table is mirrored already)
+ht_mirror* ht_mirror_start(hashtable *ht, const char *path, double interval, int n_workers);
+
+//write out everything changed before the call and fdatasync; returns the first write error, 0 if none
+int ht_mirror_sync(ht_mirror *m);
+
+//final sync, then stop the thread(s) and close the file
+int ht_mirror_stop(ht_mirror *m);
+
+const char* ht_mirror_engine(ht_mirror *m);
+size_t ht_mirror_bytes(ht_mirror *m);
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "multimap.h"
+
+#define multi_max_key   247     //ht_set takes keys below 252 bytes anyway
+#define multi_suffix    (sizeof(u_int32) + 1)
+#define multi_head      0
+#define multi_member    1
+
+//the key of the head of key (member 0) or of its value i (member 1)
+static u_int32 multi_key(char *buf, const char *key, u_int32 key_size, int member, u_int32 i) {
+    memcpy(buf, key, key_size);
+    if (member == multi_head) {
+        buf[key_size] = multi_head;
+        return key_size + 1;
+    }
+    memcpy(buf + key_size, &i, sizeof(u_int32));
+    buf[key_size + sizeof(u_int32)] = multi_member;
+    return key_size + multi_suffix;
+}
+
+static int multi_set_count(hashtable *ht, const char *key, u_int32 key_size, u_int32 n) {
+    char buf[multi_max_key + multi_suffix];
+    u_int32 head_size = multi_key(buf, key, key_size, multi_head, 0);
+    if (n == 0)
+        return ht_remove(ht, buf, head_size);
+    return ht_set(ht, buf, head_size, (const char *)&n, sizeof(u_int32));
+}
+
+u_int32 ht_multi_count(hashtable *ht, const char *key, u_int32 key_size) {
+    char buf[multi_max_key + multi_suffix];
+    u_int32 n;
+
+    if (key_size >= multi_max_key)
+        return 0;
+    ht_str *head = ht_get(ht, buf, multi_key(buf, key, key_size, multi_head, 0));
+    if (head == NULL || head->size != sizeof(u_int32))
+        return 0;
+    memcpy(&n, head->str, sizeof(u_int32));
+    return n;
+}
+
+ht_str* ht_multi_get(hashtable *ht, const char *key, u_int32 key_size, u_int32 i) {
+    char buf[multi_max_key + multi_suffix];
+    if (key_size >= multi_max_key)
+        return NULL;
+    return ht_get(ht, buf, multi_key(buf, key, key_size, multi_member, i));
+}
+
+int ht_multi_add(hashtable *ht, const char *key, u_int32 key_size, const char *value, u_int32 value_size) {
+    char buf[multi_max_key + multi_suffix];
+
+    if (key_size >= multi_max_key) {
+        errno = E2BIG;
+        return False;
+    }
+    u_int32 n = ht_multi_count(ht, key, key_size);
+    u_int32 member_size = multi_key(buf, key, key_size, multi_member, n);
+    if (!ht_set(ht, buf, member_size, value, value_size))
+        return False;
+    if (!multi_set_count(ht, key, key_size, n + 1)) {
+        ht_remove(ht, buf, member_size);
+        return False;
+    }
+    return True;
+}
+
+int ht_multi_set(hashtable *ht, const char *key, u_int32 key_size, const char *value, u_int32 value_size) {
+    char buf[multi_max_key + multi_suffix];
+    u_int32 i, n = ht_multi_count(ht, key, key_size);
+
+    if (n == 0)
+        return ht_multi_add(ht, key, key_size, value, value_size);
+    //the first value is replaced in place, so a failure leaves them all
+    if (!ht_set(ht, buf, multi_key(buf, key, key_size, multi_member, 0), value, value_size))
+        return False;
+    for (i = 1; i < n; i++)
+        ht_remove(ht, buf, multi_key(buf, key, key_size, multi_member, i));
+    return n == 1 || multi_set_count(ht, key, key_size, 1);
+}
+
+int ht_multi_remove(hashtable *ht, const char *key, u_int32 key_size) {
+    char buf[multi_max_key + multi_suffix];
+    u_int32 i, n = ht_multi_count(ht, key, key_size);
+
+    if (n == 0)
+        return False;
+    for (i = 0; i < n; i++)
+        ht_remove(ht, buf, multi_key(buf, key, key_size, multi_member, i));
+    return multi_set_count(ht, key, key_size, 0);
+}
+
+int ht_multi_discard(hashtable *ht, const char *key, u_int32 key_size, const char *value, u_int32 value_size) {
+    char buf[multi_max_key + multi_suffix];
+    u_int32 i, n = ht_multi_count(ht, key, key_size);
+
+    for (i = 0; i < n; i++) {
+        ht_str *v = ht_multi_get(ht, key, key_size, i);
+        if (v != NULL && v->size == value_size && memcmp(v->str, value, value_size) == 0)
+            break;
+    }
+    if (i == n)
+        return False;
+    for (; i + 1 < n; i++) {
+        ht_str *next = ht_multi_get(ht, key, key_size, i + 1);
+        if (next == NULL)
+            return False;
+        if (!ht_set(ht, buf, multi_key(buf, key, key_size, multi_member, i), next->str, next->size))
+            return False;
+    }
+    ht_remove(ht, buf, multi_key(buf, key, key_size, multi_member, n - 1));
+    return multi_set_count(ht, key, key_size, n - 1);
+}
+
+int ht_multi_next(ht_iter *iter, const char **key, u_int32 *key_size) {
+    while (ht_iter_next(iter)) {
+        ht_str *k = iter->key;
+        if (k->size >= multi_suffix && k->str[k->size - 1] == multi_member) {
+            *key      = k->str;
+            *key_size = k->size - multi_suffix;
+            return True;
+        }
+    }
+    return False;
+}
@@ -0,0 +1,39 @@
+#ifndef __HT_MULTIMAP__
+#define __HT_MULTIMAP__
+
+#include "hashtable.h"
+
+/*
+ * HT_MULTI tables keep several values per key as ordinary entries of one
+ * index: a head entry, the key and a 0 byte, whose value is the number
+ * of values n; and member entries, the key, a u_int32 index below n and
+ * a 1 byte, one per value in the order they were added.  Appending is one
+ * insert and one rewrite of the head, and a value is reached by its
+ * index without reading the others.  The caller holds the table lock.
+ */
+
+//the number of values of key, 0 if there are none
+u_int32 ht_multi_count(hashtable *ht, const char *key, u_int32 key_size);
+
+//value i of key, or NULL
+ht_str* ht_multi_get(hashtable *ht, const char *key, u_int32 key_size, u_int32 i);
+
+//append a value to key; False with errno E2BIG for a key too long
+int ht_multi_add(hashtable *ht, const char *key, u_int32 key_size, const char *value, u_int32 value_size);
+
+//make value the only value of key
+int ht_multi_set(hashtable *ht, const char *key, u_int32 key_size, const char *value, u_int32 value_size);
+
+//drop key with all its values; False if it had none
+int ht_multi_remove(hashtable *ht, const char *key, u_int32 key_size);
+
+/*
+ * Drop the first value of key equal to value; the later ones move down
+ * one index, so the order stays.  False if there is no such value.
+ */
+int ht_multi_discard(hashtable *ht, const char *key, u_int32 key_size, const char *value, u_int32 value_size);
+
+//the next (key, value) of the table, with the key as the caller gave it
+int ht_multi_next(ht_iter *iter, const char **key, u_int32 *key_size);
+
+#endif
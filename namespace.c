@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "namespace.h"
+
+#define ns_max_key  255     //ht_set takes keys below 252 bytes anyway
+
+//the key as stored: namespace number, then the key
+static int ns_key(char *buf, int ns, const char *key, u_int32 key_size) {
+    if (key_size >= ns_max_key) {
+        errno = E2BIG;
+        return False;
+    }
+    buf[0] = (char)ns;
+    memcpy(buf + 1, key, key_size);
+    return True;
+}
+
+int ht_ns_find(hashtable *ht, const char *name, int create) {
+    int ns, free_ns = -1;
+
+    if (name == NULL || name[0] == 0)
+        return 0;
+    if (strlen(name) >= HT_NAMESPACE_NAME) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    for (ns = 1; ns < HT_MAX_NAMESPACES; ns++) {
+        ht_namespace *n = ht_namespace_at(ht, ns);
+        if (n->name[0] == 0) {
+            if (free_ns < 0)
+                free_ns = ns;
+        }
+        else if (strcmp(n->name, name) == 0)
+            return ns;
+    }
+    if (!create) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (free_ns < 0) {
+        errno = ENOSPC;
+        return -1;
+    }
+    ht_namespace *n = ht_namespace_at(ht, free_ns);
+    bzero(n, sizeof(ht_namespace));
+    strcpy(n->name, name);
+    ht_namespace_changed(ht, free_ns);
+    return free_ns;
+}
+
+void ht_ns_set_quota(hashtable *ht, int ns, size_t quota) {
+    ht_namespace_at(ht, ns)->quota = quota;
+    ht_namespace_changed(ht, ns);
+}
+
+ht_str* ht_ns_get(hashtable *ht, int ns, const char *key, u_int32 key_size) {
+    char buf[ns_max_key + 1];
+    if (!ns_key(buf, ns, key, key_size))
+        return NULL;
+    return ht_get(ht, buf, key_size + 1);
+}
+
+int ht_ns_set(hashtable *ht, int ns, const char *key, u_int32 key_size, const char *value, u_int32 value_size) {
+    ht_namespace *n = ht_namespace_at(ht, ns);
+    char buf[ns_max_key + 1];
+
+    if (!ns_key(buf, ns, key, key_size))
+        return False;
+    ht_str *old = ht_get(ht, buf, key_size + 1);
+    size_t old_bytes = old != NULL ? key_size + old->size : 0;
+    size_t bytes = n->bytes - old_bytes + key_size + value_size;
+    if (n->quota != 0 && bytes > n->quota && bytes > n->bytes) {
+        errno = EDQUOT;
+        return False;
+    }
+    if (!ht_set(ht, buf, key_size + 1, value, value_size))
+        return False;
+    n->bytes = bytes;
+    if (old == NULL)
+        n->size += 1;
+    ht_namespace_changed(ht, ns);
+    return True;
+}
+
+int ht_ns_remove(hashtable *ht, int ns, const char *key, u_int32 key_size) {
+    ht_namespace *n = ht_namespace_at(ht, ns);
+    char buf[ns_max_key + 1];
+
+    if (!ns_key(buf, ns, key, key_size))
+        return False;
+    ht_str *old = ht_get(ht, buf, key_size + 1);
+    if (old == NULL)
+        return False;
+    size_t old_bytes = key_size + old->size;
+    if (!ht_remove(ht, buf, key_size + 1))
+        return False;
+    n->bytes -= old_bytes;
+    n->size -= 1;
+    ht_namespace_changed(ht, ns);
+    return True;
+}
+
+int ht_ns_next(ht_iter *iter, int ns, const char **key, u_int32 *key_size) {
+    while (ht_iter_next(iter)) {
+        if (iter->key->size > 0 && (unsigned char)iter->key->str[0] == ns) {
+            *key      = iter->key->str + 1;
+            *key_size = iter->key->size - 1;
+            return True;
+        }
+    }
+    return False;
+}
+
+void ht_ns_recount(hashtable *ht) {
+    int ns;
+    for (ns = 0; ns < HT_MAX_NAMESPACES; ns++) {
+        ht_namespace *n = ht_namespace_at(ht, ns);
+        n->size = n->bytes = 0;
+    }
+    ht_iter *iter = ht_get_iterator(ht);
+    while (ht_iter_next(iter)) {
+        if (iter->key->size == 0)
+            continue;
+        ht_namespace *n = ht_namespace_at(ht, (unsigned char)iter->key->str[0]);
+        n->size += 1;
+        n->bytes += iter->key->size - 1 + iter->value->size;
+    }
+    free(iter);
+    for (ns = 0; ns < HT_MAX_NAMESPACES; ns++)
+        ht_namespace_changed(ht, ns);
+}
+
+void ht_ns_copy_names(hashtable *to, hashtable *from) {
+    int ns;
+    for (ns = 0; ns < HT_MAX_NAMESPACES; ns++) {
+        ht_namespace *t = ht_namespace_at(to, ns), *f = ht_namespace_at(from, ns);
+        if (strcmp(t->name, f->name) == 0 && t->quota == f->quota)
+            continue;
+        memcpy(t->name, f->name, HT_NAMESPACE_NAME);
+        t->quota = f->quota;
+        ht_namespace_changed(to, ns);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef __HT_NAMESPACE__
+#define __HT_NAMESPACE__
+
+#include "hashtable.h"
+
+/*
+ * HT_NAMESPACES tables hold the keys of up to HT_MAX_NAMESPACES tables
+ * in one index: a stored key is its namespace number, one byte, and then
+ * the key.  The slots, and the log of an HT_LOG table, are shared by all
+ * of them; the directory after the header keeps the name, the number of
+ * entries, the key and value bytes and the byte quota of each.  Namespace
+ * 0 has no name.  The caller holds the table lock throughout.
+ */
+
+/*
+ * Number of the namespace called name (0 for NULL or ""), added to the
+ * directory if create is set and it is not there yet.  Returns -1 with
+ * errno set: ENOENT, ENOSPC for a full directory, ENAMETOOLONG.
+ */
+int ht_ns_find(hashtable *ht, const char *name, int create);
+void ht_ns_set_quota(hashtable *ht, int ns, size_t quota);
+
+ht_str* ht_ns_get(hashtable *ht, int ns, const char *key, u_int32 key_size);
+
+/*
+ * Like ht_set, and False with errno EDQUOT if the bytes of the namespace
+ * would go over its quota.  A value that does not grow is always allowed,
+ * so a namespace over a lowered quota can still shrink.
+ */
+int ht_ns_set(hashtable *ht, int ns, const char *key, u_int32 key_size, const char *value, u_int32 value_size);
+int ht_ns_remove(hashtable *ht, int ns, const char *key, u_int32 key_size);
+
+//the next entry of namespace ns, with the key as the caller gave it
+int ht_ns_next(ht_iter *iter, int ns, const char **key, u_int32 *key_size);
+
+/*
+ * Count the entries and bytes of every namespace again, after the
+ * entries were replaced wholesale (restore, follow).
+ */
+void ht_ns_recount(hashtable *ht);
+
+//take over the names and quotas of the namespaces of another table
+void ht_ns_copy_names(hashtable *to, hashtable *from);
+
+#endif
@@ -5,7 +5,8 @@ from distutils.core import setup, Extension
 #os.putenv("CFLAGS", "-g")
 
 shmht = Extension('ext_shmht/_shmht',
-        sources = ['shmht.c', 'hashtable.c']
+        sources = ['shmht.c', 'hashtable.c', 'snapshot.c', 'mirror.c', 'journal.c', 'digest.c', 'frozen.c', 'load.c', 'namespace.c', 'merge.c', 'sketch.c', 'multimap.c'],
+        libraries = ['pthread']
 )
 
 setup(
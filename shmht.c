@@ -6,27 +6,141 @@
 #include <pthread.h>
 #include <sys/mman.h>
 #include <sys/file.h>
+#include <sys/time.h>
 
 #include <Python.h>
 
 #include "hashtable.h"
+#include "snapshot.h"
+#include "mirror.h"
+#include "journal.h"
+#include "digest.h"
+#include "frozen.h"
+#include "load.h"
+#include "namespace.h"
+#include "merge.h"
+#include "sketch.h"
+#include "multimap.h"
+
+// background msync() of the dirty chunks of one table; runs without the
+// table lock and without the GIL
+struct flusher {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int stop;
+    hashtable *ht;
+    double interval;
+    size_t threshold;
+};
+
+#define flusher_poll_interval 0.05
+
+// background compaction of the log of an HT_LOG table; locks the table
+// through a descriptor of its own, one segment at a time
+struct compactor {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int stop, fd;
+    hashtable *ht;
+    double interval, ratio;
+};
+
+#define compactor_min_garbage (1024 * 1024)
 
 struct mapnode {
     int fd;
+    char *name;
     size_t mem_size;
     hashtable *ht;
+    struct flusher *flusher;
+    ht_mirror *mirror;
+    struct compactor *compactor;
+    int busy;       // operations running without the GIL; see switch_table
+    int readonly;   // O_RDONLY and PROT_READ; the file is never written
+    int refs;       // handles on it: the namespaces of one file share a node
+    int promote;    // HT_TIERED: reads bring cold values back into the log
+    pthread_mutex_t mutex;  // threads of this process, under the flock; see node_lock
+    int waiting;    // threads waiting for the mutex without the GIL
+    int closing;    // close is tearing it down; its idents are no longer valid
 };
 
 #define max_ht_map_entries 2048
 static struct mapnode ht_map[max_ht_map_entries];
 static int ht_idx = -1;
 
+// an ht id is the index in ht_map, with the namespace above ident_ns_shift
+#define ident_ns_shift      16
+#define ident_of(idx, ns)   ((ns) << ident_ns_shift | (idx))
+#define ident_ns(ident)     ((ident) >> ident_ns_shift)
+
+// strips the namespace off an ht id; False if it names no open table
+static int valid_ident(int *idx)
+{
+    int i = *idx & ((1 << ident_ns_shift) - 1);
+    if (*idx < 0 || i >= max_ht_map_entries || ht_map[i].ht == NULL || ht_map[i].closing)
+        return False;
+    *idx = i;
+    return True;
+}
+
 static PyObject * shmht_open(PyObject *self, PyObject *args);
 static PyObject * shmht_close(PyObject *self, PyObject *args);
 static PyObject * shmht_getval(PyObject *self, PyObject *args);
 static PyObject * shmht_setval(PyObject *self, PyObject *args);
 static PyObject * shmht_remove(PyObject *self, PyObject *args);
 static PyObject * shmht_foreach(PyObject *self, PyObject *args);
+static PyObject * shmht_flush(PyObject *self, PyObject *args);
+static PyObject * shmht_start_flusher(PyObject *self, PyObject *args);
+static PyObject * shmht_stop_flusher(PyObject *self, PyObject *args);
+static PyObject * shmht_snapshot(PyObject *self, PyObject *args);
+static PyObject * shmht_restore(PyObject *self, PyObject *args);
+static PyObject * shmht_backup(PyObject *self, PyObject *args);
+static PyObject * shmht_start_mirror(PyObject *self, PyObject *args);
+static PyObject * shmht_sync_mirror(PyObject *self, PyObject *args);
+static PyObject * shmht_stop_mirror(PyObject *self, PyObject *args);
+static PyObject * shmht_compact(PyObject *self, PyObject *args);
+static PyObject * shmht_start_compactor(PyObject *self, PyObject *args);
+static PyObject * shmht_stop_compactor(PyObject *self, PyObject *args);
+static PyObject * shmht_log_usage(PyObject *self, PyObject *args);
+static PyObject * shmht_read_journal(PyObject *self, PyObject *args);
+static PyObject * shmht_follow(PyObject *self, PyObject *args);
+static PyObject * shmht_digest(PyObject *self, PyObject *args);
+static PyObject * shmht_diff(PyObject *self, PyObject *args);
+static PyObject * shmht_publish(PyObject *self, PyObject *args);
+static PyObject * shmht_generation(PyObject *self, PyObject *args);
+static PyObject * shmht_seal(PyObject *self, PyObject *args);
+static PyObject * shmht_freeze(PyObject *self, PyObject *args);
+static PyObject * shmht_load(PyObject *self, PyObject *args);
+static PyObject * shmht_getvals(PyObject *self, PyObject *args);
+static PyObject * shmht_setvals(PyObject *self, PyObject *args);
+static PyObject * shmht_shard(PyObject *self, PyObject *args);
+static PyObject * shmht_grow(PyObject *self, PyObject *args);
+static PyObject * shmht_namespaces(PyObject *self, PyObject *args);
+static PyObject * shmht_merge(PyObject *self, PyObject *args);
+static PyObject * shmht_hll_open(PyObject *self, PyObject *args);
+static PyObject * shmht_cms_open(PyObject *self, PyObject *args);
+static PyObject * shmht_sketch_close(PyObject *self, PyObject *args);
+static PyObject * shmht_hll_add(PyObject *self, PyObject *args);
+static PyObject * shmht_hll_count(PyObject *self, PyObject *args);
+static PyObject * shmht_cms_add(PyObject *self, PyObject *args);
+static PyObject * shmht_cms_estimate(PyObject *self, PyObject *args);
+static PyObject * shmht_sketch_merge(PyObject *self, PyObject *args);
+static PyObject * shmht_sketch_clear(PyObject *self, PyObject *args);
+static PyObject * shmht_add(PyObject *self, PyObject *args);
+static PyObject * shmht_count(PyObject *self, PyObject *args);
+static PyObject * shmht_values(PyObject *self, PyObject *args);
+static PyObject * shmht_discard(PyObject *self, PyObject *args);
+static PyObject * shmht_igetval(PyObject *self, PyObject *args);
+static PyObject * shmht_isetval(PyObject *self, PyObject *args);
+static PyObject * shmht_iremove(PyObject *self, PyObject *args);
+static PyObject * shmht_demote(PyObject *self, PyObject *args);
+static PyObject * shmht_tier_usage(PyObject *self, PyObject *args);
+static PyObject * shmht_set_promote(PyObject *self, PyObject *args);
+static PyObject * shmht_find(PyObject *self, PyObject *args);
+static PyObject * shmht_slot_get(PyObject *self, PyObject *args);
+static PyObject * shmht_slot_set(PyObject *self, PyObject *args);
 
 static PyObject *shmht_error;
 PyMODINIT_FUNC init_shmht(void);
@@ -38,6 +152,56 @@ static PyMethodDef shmht_methods[] = {
     {"setval", shmht_setval, METH_VARARGS, ""},
     {"remove", shmht_remove, METH_VARARGS, ""},
     {"foreach", shmht_foreach, METH_VARARGS, ""},
+    {"flush", shmht_flush, METH_VARARGS, "msync the dirty parts of the table"},
+    {"start_flusher", shmht_start_flusher, METH_VARARGS, "start a background msync thread"},
+    {"stop_flusher", shmht_stop_flusher, METH_VARARGS, ""},
+    {"snapshot", shmht_snapshot, METH_VARARGS, "write the live entries to a compact file"},
+    {"restore", shmht_restore, METH_VARARGS, "replace the table contents from a snapshot file"},
+    {"backup", shmht_backup, METH_VARARGS, "point-in-time snapshot that does not stop writers"},
+    {"start_mirror", shmht_start_mirror, METH_VARARGS, "keep a disk file in step with the table in the background"},
+    {"sync_mirror", shmht_sync_mirror, METH_VARARGS, "wait until the disk mirror has every change made so far"},
+    {"stop_mirror", shmht_stop_mirror, METH_VARARGS, ""},
+    {"compact", shmht_compact, METH_VARARGS, "reclaim the log space of overwritten and removed values"},
+    {"start_compactor", shmht_start_compactor, METH_VARARGS, "compact the log in a background thread"},
+    {"stop_compactor", shmht_stop_compactor, METH_VARARGS, ""},
+    {"log_usage", shmht_log_usage, METH_VARARGS, "(used, live, size) bytes of the log of one half"},
+    {"read_journal", shmht_read_journal, METH_VARARGS, "changes recorded since a journal position"},
+    {"follow", shmht_follow, METH_VARARGS, "bring a replica up to date with a journaled table"},
+    {"digest", shmht_digest, METH_VARARGS, "hash of the whole contents of the table"},
+    {"diff", shmht_diff, METH_VARARGS, "keys whose entries differ between two tables"},
+    {"publish", shmht_publish, METH_VARARGS, "atomically put a new table file in place of a name"},
+    {"generation", shmht_generation, METH_VARARGS, "how many tables were published under this name before"},
+    {"seal", shmht_seal, METH_VARARGS, "make the table immutable, so readers need no lock"},
+    {"freeze", shmht_freeze, METH_VARARGS, "write a perfect-hash table file of a table or of (key, value) pairs"},
+    {"load", shmht_load, METH_VARARGS, "build a table file from a key/value file or (key, value) pairs, in parallel"},
+    {"getvals", shmht_getvals, METH_VARARGS, "values of several keys, under one lock"},
+    {"setvals", shmht_setvals, METH_VARARGS, "set several (key, value) pairs, under one lock"},
+    {"shard", shmht_shard, METH_VARARGS, "which of n shards a key belongs to"},
+    {"grow", shmht_grow, METH_VARARGS, "rebuild the table with a larger capacity and publish it under its name"},
+    {"namespaces", shmht_namespaces, METH_VARARGS, "(name, entries, bytes, quota) of each namespace of the table"},
+    {"merge", shmht_merge, METH_VARARGS, "merge the entries of other tables into one"},
+    {"hll_open", shmht_hll_open, METH_VARARGS, "create or attach a shared HyperLogLog sketch"},
+    {"cms_open", shmht_cms_open, METH_VARARGS, "create or attach a shared count-min sketch"},
+    {"sketch_close", shmht_sketch_close, METH_VARARGS, ""},
+    {"hll_add", shmht_hll_add, METH_VARARGS, "add a key, or a sequence of keys, to a HyperLogLog"},
+    {"hll_count", shmht_hll_count, METH_VARARGS, "estimated number of distinct keys added"},
+    {"cms_add", shmht_cms_add, METH_VARARGS, "count a key, or a sequence of keys, in a count-min sketch"},
+    {"cms_estimate", shmht_cms_estimate, METH_VARARGS, "estimated count of a key, or list of counts of several"},
+    {"sketch_merge", shmht_sketch_merge, METH_VARARGS, "fold one sketch into another of the same shape"},
+    {"sketch_clear", shmht_sketch_clear, METH_VARARGS, "reset a sketch to empty"},
+    {"add", shmht_add, METH_VARARGS, "add a key to a set, or a value to the values of a key"},
+    {"count", shmht_count, METH_VARARGS, "number of values of a key"},
+    {"values", shmht_values, METH_VARARGS, "some or all of the values of a key, in order"},
+    {"discard", shmht_discard, METH_VARARGS, "drop one value of a key of a MULTI table"},
+    {"igetval", shmht_igetval, METH_VARARGS, "value of an integer key, as a string or as an integer"},
+    {"isetval", shmht_isetval, METH_VARARGS, "set the value of an integer key to a string or an integer"},
+    {"iremove", shmht_iremove, METH_VARARGS, ""},
+    {"demote", shmht_demote, METH_VARARGS, "move values idle for some seconds to the cold file of a TIERED table"},
+    {"tier_usage", shmht_tier_usage, METH_VARARGS, "(log live, cold live, cold used, cold size) bytes of a TIERED table"},
+    {"set_promote", shmht_set_promote, METH_VARARGS, "whether reads through this handle bring cold values back into the log"},
+    {"find", shmht_find, METH_VARARGS, "handle on the slot of a key, for slot_get and slot_set"},
+    {"slot_get", shmht_slot_get, METH_VARARGS, "(handle, value) of a key, through its slot handle"},
+    {"slot_set", shmht_slot_set, METH_VARARGS, "set the value of a key through its slot handle; returns the handle"},
     {NULL, NULL, 0, NULL}
 };
 
@@ -54,6 +218,51 @@ static void myunlock(fd) {
     // bug: not handling error condition
 }
 
+/*
+ * flock() keeps other processes out, but the threads of this one share
+ * the fd of a table and with it the lock; they take the mutex of its
+ * node first.  The mutex is recursive, as taking the flock twice was
+ * harmless.  Some operations hold the lock with the GIL released, so a
+ * thread that has the GIL waits for the mutex without it.
+ */
+static void node_mutex_lock(struct mapnode *node, int has_gil)
+{
+    if (pthread_mutex_trylock(&node->mutex) == 0)
+        return;
+    if (has_gil) {
+        node->waiting++;
+        Py_BEGIN_ALLOW_THREADS
+        pthread_mutex_lock(&node->mutex);
+        Py_END_ALLOW_THREADS
+        node->waiting--;
+    }
+    else
+        pthread_mutex_lock(&node->mutex);
+}
+
+static void node_lock(struct mapnode *node, int has_gil)
+{
+    node_mutex_lock(node, has_gil);
+    mylock(node->fd);
+}
+
+static void node_unlock(struct mapnode *node)
+{
+    myunlock(node->fd);
+    pthread_mutex_unlock(&node->mutex);
+}
+
+// node_lock for ht_follow and friends, which call it without the GIL
+static void table_lock(void *arg)
+{
+    node_lock((struct mapnode *)arg, False);
+}
+
+static void table_unlock(void *arg)
+{
+    node_unlock((struct mapnode *)arg);
+}
+
 
 PyMODINIT_FUNC init_shmht(void)
 {
@@ -65,20 +274,158 @@ PyMODINIT_FUNC init_shmht(void)
     Py_INCREF(shmht_error);
     PyModule_AddObject(m, "error", shmht_error);
 
+    PyModule_AddIntConstant(m, "BACKUP", HT_BACKUP);
+    PyModule_AddIntConstant(m, "LOG", HT_LOG);
+    PyModule_AddIntConstant(m, "JOURNAL", HT_JOURNAL);
+    PyModule_AddIntConstant(m, "DIGEST", HT_DIGEST);
+    PyModule_AddIntConstant(m, "FROZEN", HT_FROZEN);
+    PyModule_AddIntConstant(m, "NAMESPACES", HT_NAMESPACES);
+    PyModule_AddIntConstant(m, "BLOOM", HT_BLOOM);
+    PyModule_AddIntConstant(m, "SET", HT_SET);
+    PyModule_AddIntConstant(m, "MULTI", HT_MULTI);
+    PyModule_AddIntConstant(m, "INTKEY", HT_INTKEY);
+    PyModule_AddIntConstant(m, "SPLIT", HT_SPLIT);
+    PyModule_AddIntConstant(m, "PAGED", HT_PAGED);
+    PyModule_AddIntConstant(m, "TIERED", HT_TIERED);
+
     bzero(ht_map, sizeof(ht_map));
 }
 
+static hashtable* map_table_file(int fd, int prot, size_t *mem_size);
+static hashtable* map_tiered(int fd, int prot, const char *cold_path, size_t cold_offset, size_t cold_size, size_t *mem_size);
+static int open_cold(hashtable *ht, const char *cold_path, size_t cold_size);
+static int add_mapnode(int fd, const char *name, size_t mem_size, hashtable *ht, int readonly);
+static PyObject * open_namespace(int idx, const char *namespace, size_t quota);
+static int find_namespaces(const char *name, int readonly);
+
+/*
+ * Map an existing table without writing to the file at all: no ref_cnt,
+ * no dirty bits.  Until the table is sealed, reads still take the lock.
+ */
+static int open_readonly(const char *name, int force_init)
+{
+    size_t mem_size;
+
+    if (force_init) {
+        PyErr_Format(shmht_error, "cannot force_init a table opened read-only");
+        return -1;
+    }
+
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        PyErr_Format(shmht_error, "open file(%s) failed: [%d] %s", name, errno, strerror(errno));
+        return -1;
+    }
+
+    mylock(fd);
+    hashtable *ht = map_table_file(fd, PROT_READ, &mem_size);
+    myunlock(fd);
+    if (ht == NULL) {
+        PyErr_Format(shmht_error, "file(%s) is not a table: [%d] %s", name, errno, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    int idx = add_mapnode(fd, name, mem_size, ht, True);
+    if (idx < 0) {
+        munmap(ht, mem_size);
+        close(fd);
+    }
+    return idx;
+}
+
+// returns the new ht id, or -1 with a Python error set
+static int add_mapnode(int fd, const char *name, size_t mem_size, hashtable *ht, int readonly)
+{
+    int count;
+    for (count = 0; count < max_ht_map_entries; count++)
+    {
+        ht_idx = (ht_idx + 1) % max_ht_map_entries;
+        count += 1;
+        if (ht_map[ht_idx].ht == NULL)
+            break;
+    }
+    if (count >= max_ht_map_entries) {
+        PyErr_Format(shmht_error, "exceeded max_ht_map_entries(%d) in one process", max_ht_map_entries);
+        return -1;
+    }
+    ht_map[ht_idx].fd       = fd;
+    ht_map[ht_idx].name     = strdup(name);
+    ht_map[ht_idx].mem_size = mem_size;
+    ht_map[ht_idx].ht       = ht;
+    ht_map[ht_idx].readonly = readonly;
+    ht_map[ht_idx].refs     = 1;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&ht_map[ht_idx].mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return ht_idx;
+}
+
 static PyObject * shmht_open(PyObject *self, PyObject *args)
 {
     int fd = 0;
-    size_t mem_size = 0;
+    size_t mem_size = 0, frozen_size = 0;
     hashtable *ht = NULL;
 
     const char *name;
-    size_t i_capacity = 0;
+    Py_ssize_t i_capacity = 0;
     int force_init = 0;
-    if (!PyArg_ParseTuple(args, "s|ii:shmht.create", &name, &i_capacity, &force_init))
+    unsigned flags = 0;
+    Py_ssize_t log_size = 0, journal_size = 0;
+    int readonly = 0;
+    const char *namespace = NULL;
+    Py_ssize_t quota = 0;
+    const char *cold_path = NULL;
+    Py_ssize_t cold_size = 0;
+    if (!PyArg_ParseTuple(args, "s|niInniznzn:shmht.create", &name, &i_capacity, &force_init, &flags, &log_size, &journal_size, &readonly, &namespace, &quota, &cold_path, &cold_size))
+        return NULL;
+
+    if (i_capacity < 0 || (size_t)i_capacity > ht_max_capacity()) {
+        PyErr_Format(shmht_error, "capacity %ld is out of range; the largest is %lu", (long)i_capacity, ht_max_capacity());
+        return NULL;
+    }
+    if (cold_path != NULL && !readonly)
+        flags |= HT_TIERED;
+    if ((flags & HT_TIERED) && ((flags & HT_MULTI) || namespace != NULL)) {
+        PyErr_Format(shmht_error, "a TIERED table cannot also be MULTI or have namespaces");
+        return NULL;
+    }
+
+    if ((flags & HT_MULTI) && ((flags & HT_SET) || namespace != NULL)) {
+        PyErr_Format(shmht_error, "a MULTI table cannot also be a SET or have namespaces");
+        return NULL;
+    }
+    if ((flags & HT_INTKEY) && ((flags & HT_MULTI) || namespace != NULL)) {
+        PyErr_Format(shmht_error, "an INTKEY table cannot also be MULTI or have namespaces");
+        return NULL;
+    }
+    if ((flags & HT_PAGED) && !(flags & (HT_SPLIT | HT_INTKEY))) {
+        PyErr_Format(shmht_error, "a PAGED table must also be SPLIT or INTKEY");
+        return NULL;
+    }
+    if ((flags & HT_BACKUP) && (flags & (HT_LOG | HT_SPLIT | HT_TIERED))) {
+        PyErr_Format(shmht_error, "a BACKUP table cannot also be LOG, SPLIT or TIERED");
         return NULL;
+    }
+
+    if (namespace != NULL) {
+        // another namespace of a file this process has open already
+        int idx = force_init ? -1 : find_namespaces(name, readonly);
+        if (idx >= 0) {
+            ht_map[idx].refs++;
+            return open_namespace(idx, namespace, quota);
+        }
+        if (!readonly)
+            flags |= HT_NAMESPACES;
+    }
+
+    if (readonly) {
+        int idx = open_readonly(name, force_init);
+        return idx < 0 ? NULL : open_namespace(idx, namespace, 0);
+    }
 
     size_t capacity = i_capacity;
 
@@ -106,22 +453,33 @@ static PyObject * shmht_open(PyObject *self, PyObject *args)
             if (ht_is_valid(ht)) {
                 // may not ask for larger capacity than is already in file
                 if (capacity != 0 && capacity > ht->orig_capacity) {
-                    PyErr_Format(shmht_error, "file has smaller capacity than requested (req %d, have %d); specify force_init=1 to overwrite an existing shmht", (int)capacity, (int)ht->orig_capacity);
+                    PyErr_Format(shmht_error, "file has smaller capacity than requested (req %lu, have %lu); specify force_init=1 to overwrite an existing shmht", capacity, ht->orig_capacity);
+                    goto create_failed;
+                }
+                // nor for features the file was not laid out for
+                if ((flags & ht->flags) != flags) {
+                    PyErr_Format(shmht_error, "file was created without some of the requested flags (req 0x%x, have 0x%x); specify force_init=1 to overwrite an existing shmht", flags, (unsigned)ht->flags);
                     goto create_failed;
                 }
                 capacity = ht->orig_capacity; //loaded capacity
+                flags    = ht->flags;
+                log_size = ht->log_half;
+                journal_size = ht->journal_size;
+                if (flags & HT_FROZEN)
+                    frozen_size = ht_file_size(ht);
             }
             munmap(ht, sizeof(hashtable));
             ht = NULL;
         }
     }
 
-    if (capacity == 0) {
+    if (capacity == 0 && frozen_size == 0) {
         PyErr_Format(shmht_error, "please specify 'capacity' when you try to create a shmht");
         goto create_failed;
     }
 
-    mem_size = ht_memory_size(capacity);
+    // a frozen table is sized by its contents, not its capacity
+    mem_size = frozen_size ? frozen_size : ht_memory_size(capacity, flags, log_size, journal_size);
 
     if (buf.st_size < mem_size) {
         if (lseek(fd, mem_size - 1, SEEK_SET) == -1) {
@@ -142,25 +500,32 @@ static PyObject * shmht_open(PyObject *self, PyObject *args)
         goto create_failed;
     }
 
-    ht_init(ht, capacity, force_init);
-    int count;
-    for (count = 0; count < max_ht_map_entries; count++)
-    {
-        ht_idx = (ht_idx + 1) % max_ht_map_entries;
-        count += 1;
-        if (ht_map[ht_idx].ht == NULL)
-            break;
+    ht_init(ht, capacity, flags, log_size, journal_size, force_init);
+    if (ht->flags & HT_TIERED) {
+        // now map it again, with its cold file
+        size_t span;
+        hashtable *whole = NULL;
+        if (open_cold(ht, cold_path, cold_size)) {
+            whole = map_table_file(fd, PROT_READ|PROT_WRITE, &span);
+            if (whole == NULL)
+                PyErr_Format(shmht_error, "cannot map the cold file of %s: [%d] %s", name, errno, strerror(errno));
+        }
+        if (whole == NULL) {
+            ht_destroy(ht);
+            goto create_failed;
+        }
+        munmap(ht, mem_size);
+        ht = whole;
+        mem_size = span;
     }
-    if (count >= max_ht_map_entries) {
-        PyErr_Format(shmht_error, "exceeded max_ht_map_entries(%d) in one process", max_ht_map_entries);
+    int idx = add_mapnode(fd, name, mem_size, ht, False);
+    if (idx < 0) {
+        ht_destroy(ht);
         goto create_failed;
     }
-    ht_map[ht_idx].fd       = fd;
-    ht_map[ht_idx].mem_size = mem_size;
-    ht_map[ht_idx].ht       = ht;
 
     myunlock(fd);
-    return PyInt_FromLong(ht_idx);
+    return open_namespace(idx, namespace, quota);
 
 create_failed:
     if (fd >= 0) {
@@ -172,37 +537,230 @@ create_failed:
     return NULL;
 }
 
-static PyObject * shmht_close(PyObject *self, PyObject *args)
+/*
+ * HT_TIERED: a new table gets its cold file here, zero-filled to
+ * cold_size bytes (by default twice the log), under an absolute path
+ * so that every process finds it.  Tables that have one keep it.
+ */
+static int open_cold(hashtable *ht, const char *cold_path, size_t cold_size)
 {
-    int idx;
-    if (!PyArg_ParseTuple(args, "i:shmht.create", &idx))
-        return NULL;
+    char path[PATH_MAX];
 
-    if (idx < 0 || idx >= max_ht_map_entries || ht_map[idx].ht == NULL) {
-        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
-        return NULL;
+    if (ht->cold_size != 0)
+        return True;
+    if (cold_path == NULL) {
+        PyErr_Format(shmht_error, "a TIERED table needs a cold_path");
+        return False;
     }
+    if (cold_size == 0)
+        cold_size = 4 * ht->log_half;
+
+    int fd = open(cold_path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0 || realpath(cold_path, path) == NULL || !ht_tier_init(ht, path, cold_size)
+        || ftruncate(fd, ht->cold_size) != 0) {
+        PyErr_Format(shmht_error, "cannot create cold file(%s): [%d] %s", cold_path, errno, strerror(errno));
+        ht->cold_size = 0;
+        if (fd >= 0)
+            close(fd);
+        return False;
+    }
+    close(fd);
+    return True;
+}
 
+static void stop_flusher(struct mapnode *node);
+static void stop_compactor(struct mapnode *node);
+static hashtable* lock_table(int idx);
+static void unlock_table(int idx, hashtable *ht);
+static int check_published(int idx);
+static int check_writable(int idx, int contents);
+
+static void close_table(int idx)
+{
     hashtable *ht = ht_map[idx].ht;
 
-    size_t ref_cnt = ht_destroy(ht);
+    if (--ht_map[idx].refs > 0)
+        return;
 
-    if (munmap(ht, ht_map[idx].mem_size) != 0) {
-        PyErr_Format(shmht_error, "munmap failed: [%d] %s", errno, strerror(errno));
-        //return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    stop_flusher(&ht_map[idx]);
+    stop_compactor(&ht_map[idx]);
+    Py_END_ALLOW_THREADS
+    if (ht_map[idx].mirror != NULL) {
+        Py_BEGIN_ALLOW_THREADS
+        ht_mirror_stop(ht_map[idx].mirror);
+        Py_END_ALLOW_THREADS
     }
 
+    if (!ht_map[idx].readonly)
+        ht_destroy(ht);
+
+    // a failed munmap leaks the mapping at worst; nothing to tell the caller
+    munmap(ht, ht_map[idx].mem_size);
+
     // Do not delete the mapping file - somebody else might still
     // want it.  If the application knows that the shared memory
     // should not persist, it can delete the file.
 
     close(ht_map[idx].fd);
+    free(ht_map[idx].name);
+    pthread_mutex_destroy(&ht_map[idx].mutex);
 
     memset(&ht_map[idx], 0, sizeof(struct mapnode));
+}
+
+static PyObject * shmht_close(PyObject *self, PyObject *args)
+{
+    int idx;
+    if (!PyArg_ParseTuple(args, "i:shmht.create", &idx))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    /*
+     * Other threads may share the handle.  Wait for the one that has the
+     * table locked; refuse to close while another one still works on it
+     * without the GIL or waits for the lock.  Once closing is set, no new
+     * operation starts on it.
+     */
+    struct mapnode *node = &ht_map[idx];
+    node_mutex_lock(node, True);
+    if (node->closing) {
+        pthread_mutex_unlock(&node->mutex);
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+    if (node->refs == 1 && (node->busy || node->waiting)) {
+        pthread_mutex_unlock(&node->mutex);
+        PyErr_Format(shmht_error, "table(%s) is in use by another thread", node->name);
+        return NULL;
+    }
+    node->closing = node->refs == 1;
+    pthread_mutex_unlock(&node->mutex);
+
+    close_table(idx);
 
     Py_RETURN_TRUE;
 }
 
+// an open table with namespaces, under name; -1 if there is none
+static int find_namespaces(const char *name, int readonly)
+{
+    int idx;
+    for (idx = 0; idx < max_ht_map_entries; idx++) {
+        struct mapnode *node = &ht_map[idx];
+        if (node->ht != NULL && !node->closing && node->readonly == readonly && (node->ht->flags & HT_NAMESPACES)
+                && strcmp(node->name, name) == 0)
+            return idx;
+    }
+    return -1;
+}
+
+/*
+ * The ht id of namespace of the table just opened as idx, which is
+ * added unless the handle is read-only; a quota above 0 replaces the
+ * one it had.  Gives the handle up again on failure.
+ */
+static PyObject * open_namespace(int idx, const char *namespace, size_t quota)
+{
+    if (namespace == NULL)
+        return PyInt_FromLong(idx);
+
+    if (!(ht_map[idx].ht->flags & HT_NAMESPACES)) {
+        PyErr_Format(shmht_error, "table(%s) was created without namespaces", ht_map[idx].name);
+        close_table(idx);
+        return NULL;
+    }
+
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL) {
+        close_table(idx);
+        return NULL;
+    }
+    BOOL writable = !ht_map[idx].readonly && !ht_is_sealed(ht);
+    int ns = ht_ns_find(ht, namespace, writable);
+    if (ns >= 0 && quota > 0 && writable)
+        ht_ns_set_quota(ht, ns, quota);
+    unlock_table(idx, ht);
+
+    if (ns < 0) {
+        PyErr_Format(shmht_error, "namespace(%s) of table(%s): [%d] %s", namespace, ht_map[idx].name, errno, strerror(errno));
+        close_table(idx);
+        return NULL;
+    }
+    return PyInt_FromLong(ident_of(idx, ns));
+}
+
+// entries of namespace ns of an ht id; tables without namespaces only have
+// 0.  in a MULTI table the value of a key is its first one, setting it
+// drops the others, and each of them is an entry of its own to foreach
+static ht_str* entry_get(hashtable *ht, int ns, const char *key, u_int32 key_size)
+{
+    if (ht->flags & HT_NAMESPACES)
+        return ht_ns_get(ht, ns, key, key_size);
+    if (ht->flags & HT_MULTI)
+        return ht_multi_get(ht, key, key_size, 0);
+    return ht_get(ht, key, key_size);
+}
+
+// a read for the caller: on a writable handle of an HT_TIERED table it
+// also counts as an access, and may bring the value back from the cold file
+static ht_str* entry_access(int idx, hashtable *ht, int ns, const char *key, u_int32 key_size)
+{
+    if ((ht->flags & HT_TIERED) && !ht_map[idx].readonly)
+        return ht_access(ht, key, key_size, ht_map[idx].promote);
+    return entry_get(ht, ns, key, key_size);
+}
+
+static int entry_set(hashtable *ht, int ns, const char *key, u_int32 key_size, const char *value, u_int32 value_size)
+{
+    errno = 0;
+    if ((ht->flags & HT_SET) && value_size > 0) {
+        errno = EINVAL;
+        return False;
+    }
+    if (ht->flags & HT_NAMESPACES)
+        return ht_ns_set(ht, ns, key, key_size, value, value_size);
+    if (ht->flags & HT_MULTI)
+        return ht_multi_set(ht, key, key_size, value, value_size);
+    return ht_set(ht, key, key_size, value, value_size);
+}
+
+static int entry_remove(hashtable *ht, int ns, const char *key, u_int32 key_size)
+{
+    if (ht->flags & HT_NAMESPACES)
+        return ht_ns_remove(ht, ns, key, key_size);
+    if (ht->flags & HT_MULTI)
+        return ht_multi_remove(ht, key, key_size);
+    return ht_remove(ht, key, key_size);
+}
+
+static int entry_next(ht_iter *iter, int ns, const char **key, u_int32 *key_size)
+{
+    if (iter->ht->flags & HT_NAMESPACES)
+        return ht_ns_next(iter, ns, key, key_size);
+    if (iter->ht->flags & HT_MULTI)
+        return ht_multi_next(iter, key, key_size);
+    if (!ht_iter_next(iter))
+        return False;
+    *key      = iter->key->str;
+    *key_size = iter->key->size;
+    return True;
+}
+
+static void set_insert_error(const char *key)
+{
+    if (errno == EDQUOT)
+        PyErr_Format(shmht_error, "namespace quota exceeded by key(%s)", key);
+    else if (errno == EINVAL)
+        PyErr_Format(shmht_error, "a SET table holds no values, not even for key(%s)", key);
+    else
+        PyErr_Format(shmht_error, "insert failed for key(%s)", key);
+}
+
 static PyObject * shmht_getval(PyObject *self, PyObject *args)
 {
     int idx, key_size;
@@ -212,23 +770,26 @@ static PyObject * shmht_getval(PyObject *self, PyObject *args)
     if (!PyArg_ParseTuple(args, "is#:shmht.getval", &idx, &key, &key_size))
         return NULL;
 
-    if (idx < 0 || idx >= max_ht_map_entries || ht_map[idx].ht == NULL) {
+    int ns = ident_ns(idx);
+    if (!valid_ident(&idx)) {
         PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
         return NULL;
     }
 
-    mylock(ht_map[idx].fd);
-
-    hashtable *ht = ht_map[idx].ht;
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL)
+        return NULL;
 
-    ht_str* value = ht_get(ht, key, key_size);
+    ht_str* value = entry_access(idx, ht, ns, key, key_size);
     if (value == NULL) {
-        myunlock(ht_map[idx].fd);
+        unlock_table(idx, ht);
         Py_RETURN_NONE;
     }
 
-    myunlock(ht_map[idx].fd);
-    return PyString_FromStringAndSize(value->str, value->size);
+    // copy it while still locked: a compaction may move the value
+    return_value = PyString_FromStringAndSize(value->str, value->size);
+    unlock_table(idx, ht);
+    return return_value;
 }
 
 static PyObject * shmht_setval(PyObject *self, PyObject *args)
@@ -239,21 +800,25 @@ static PyObject * shmht_setval(PyObject *self, PyObject *args)
         return NULL;
     }
 
-    if (idx < 0 || idx >= max_ht_map_entries || ht_map[idx].ht == NULL) {
+    int ns = ident_ns(idx);
+    if (!valid_ident(&idx)) {
         PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
         return NULL;
     }
 
-    hashtable *ht = ht_map[idx].ht;
+    if (!check_writable(idx, True))
+        return NULL;
 
-    mylock(ht_map[idx].fd);
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL)
+        return NULL;
 
-    int result = ht_set(ht, key, key_size, value, value_size);
+    int result = entry_set(ht, ns, key, key_size, value, value_size);
 
-    myunlock(ht_map[idx].fd);
+    unlock_table(idx, ht);
 
     if (result == False ) {
-        PyErr_Format(shmht_error, "insert failed for key(%s)", key);
+        set_insert_error(key);
         return NULL;
     }
 
@@ -267,17 +832,22 @@ static PyObject * shmht_remove(PyObject *self, PyObject *args)
     if (!PyArg_ParseTuple(args, "is#:shmht.remove", &idx, &key, &key_size))
         return NULL;
 
-    if (idx < 0 || idx >= max_ht_map_entries || ht_map[idx].ht == NULL) {
+    int ns = ident_ns(idx);
+    if (!valid_ident(&idx)) {
         PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
         return NULL;
     }
 
-    hashtable *ht = ht_map[idx].ht;
-    mylock(ht_map[idx].fd);
+    if (!check_writable(idx, True))
+        return NULL;
+
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL)
+        return NULL;
 
-    int result = ht_remove(ht, key, key_size);
+    int result = entry_remove(ht, ns, key, key_size);
 
-    myunlock(ht_map[idx].fd);
+    unlock_table(idx, ht);
 
     if ( result == False)
         Py_RETURN_FALSE;
@@ -293,7 +863,8 @@ static PyObject * shmht_foreach(PyObject *self, PyObject *args)
     if (!PyArg_ParseTuple(args, "iO:shmht.foreach", &idx, &cb))
         return NULL;
 
-    if (idx < 0 || idx >= max_ht_map_entries || ht_map[idx].ht == NULL) {
+    int ns = ident_ns(idx);
+    if (!valid_ident(&idx)) {
         PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
         return NULL;
     }
@@ -304,17 +875,23 @@ static PyObject * shmht_foreach(PyObject *self, PyObject *args)
     }
 
 
-    hashtable *ht = ht_map[idx].ht;
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL)
+        return NULL;
     ht_iter *iter = ht_get_iterator(ht);
 
-    mylock(ht_map[idx].fd);
-    while (ht_iter_next(iter)) {
-        ht_str *key = iter->key, *value = iter->value;
-        PyObject *arglist = Py_BuildValue("(s#s#)", key->str, key->size, value->str, value->size);
+    // the callback may call back into us; stay on this table meanwhile
+    ht_map[idx].busy++;
+    const char *key;
+    u_int32 key_size;
+    while (entry_next(iter, ns, &key, &key_size)) {
+        ht_str *value = iter->value;
+        PyObject *arglist = Py_BuildValue("(s#s#)", key, key_size, value->str, value->size);
         PyEval_CallObject(cb, arglist);
         Py_DECREF(arglist);
     }
-    myunlock(ht_map[idx].fd);
+    ht_map[idx].busy--;
+    unlock_table(idx, ht);
 
     free(iter);
 
@@ -322,5 +899,2595 @@ static PyObject * shmht_foreach(PyObject *self, PyObject *args)
 }
 
 
-// TODO: add an msync() operation.  see https://docs.python.org/2/c-api/init.html#thread-state-and-the-global-interpreter-lock for releasing the GIL during blocking I/O
-// TODO: add a find_slot() / put_slot_data() operation, so you don't need to hash the key again when you use the same key repeatedly
+static PyObject * shmht_flush(PyObject *self, PyObject *args)
+{
+    int idx;
+    size_t flushed;
+
+    if (!PyArg_ParseTuple(args, "i:shmht.flush", &idx))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_writable(idx, False))
+        return NULL;
+
+    hashtable *ht = ht_map[idx].ht;
+
+    // no table lock: dirty bits are cleared atomically before each msync
+    ht_map[idx].busy++;
+    Py_BEGIN_ALLOW_THREADS
+    flushed = ht_flush_dirty(ht);
+    Py_END_ALLOW_THREADS
+    ht_map[idx].busy--;
+
+    return PyLong_FromSize_t(flushed);
+}
+
+static double now_seconds(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void * flusher_main(void *arg)
+{
+    struct flusher *f = (struct flusher *)arg;
+    double last_flush = now_seconds();
+
+    pthread_mutex_lock(&f->mutex);
+    while (!f->stop) {
+        double wait = f->interval;
+        if (f->threshold > 0 && (wait <= 0 || wait > flusher_poll_interval))
+            wait = flusher_poll_interval;
+
+        double deadline = now_seconds() + wait;
+        struct timespec ts;
+        ts.tv_sec  = (time_t)deadline;
+        ts.tv_nsec = (long)((deadline - ts.tv_sec) * 1000000000.0);
+        pthread_cond_timedwait(&f->cond, &f->mutex, &ts);
+        if (f->stop)
+            break;
+
+        double now = now_seconds();
+        if ((f->interval > 0 && now - last_flush >= f->interval) ||
+            (f->threshold > 0 && ht_dirty_bytes(f->ht) >= f->threshold)) {
+            pthread_mutex_unlock(&f->mutex);
+            ht_flush_dirty(f->ht);
+            pthread_mutex_lock(&f->mutex);
+            last_flush = now;
+        }
+    }
+    pthread_mutex_unlock(&f->mutex);
+
+    ht_flush_dirty(f->ht); //final flush, so stopping never loses a write-back
+    return NULL;
+}
+
+static void stop_flusher(struct mapnode *node)
+{
+    struct flusher *f = node->flusher;
+    if (f == NULL)
+        return;
+
+    pthread_mutex_lock(&f->mutex);
+    f->stop = 1;
+    pthread_cond_signal(&f->cond);
+    pthread_mutex_unlock(&f->mutex);
+
+    pthread_join(f->thread, NULL);
+    pthread_cond_destroy(&f->cond);
+    pthread_mutex_destroy(&f->mutex);
+    free(f);
+    node->flusher = NULL;
+}
+
+// returns 0 or an errno value
+static int start_flusher(struct mapnode *node, double interval, size_t threshold)
+{
+    struct flusher *f = ALLOC(struct flusher, 1);
+    if (f == NULL)
+        return ENOMEM;
+    bzero(f, sizeof(struct flusher));
+    f->ht        = node->ht;
+    f->interval  = interval;
+    f->threshold = threshold;
+    pthread_mutex_init(&f->mutex, NULL);
+    pthread_cond_init(&f->cond, NULL);
+
+    int err = pthread_create(&f->thread, NULL, flusher_main, f);
+    if (err != 0) {
+        pthread_cond_destroy(&f->cond);
+        pthread_mutex_destroy(&f->mutex);
+        free(f);
+        return err;
+    }
+    node->flusher = f;
+    return 0;
+}
+
+static PyObject * shmht_start_flusher(PyObject *self, PyObject *args)
+{
+    int idx;
+    double interval = 1.0;
+    Py_ssize_t threshold = 0;
+
+    if (!PyArg_ParseTuple(args, "i|dn:shmht.start_flusher", &idx, &interval, &threshold))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_writable(idx, False))
+        return NULL;
+
+    if (interval <= 0 && threshold <= 0) {
+        PyErr_Format(shmht_error, "flusher needs a positive interval or threshold");
+        return NULL;
+    }
+
+    if (ht_map[idx].flusher != NULL) {
+        PyErr_Format(shmht_error, "flusher already running for ht id: (%d)", idx);
+        return NULL;
+    }
+
+    int err = start_flusher(&ht_map[idx], interval, threshold > 0 ? (size_t)threshold : 0);
+    if (err != 0) {
+        PyErr_Format(shmht_error, "pthread_create failed: [%d] %s", err, strerror(err));
+        return NULL;
+    }
+
+    Py_RETURN_TRUE;
+}
+
+static PyObject * shmht_stop_flusher(PyObject *self, PyObject *args)
+{
+    int idx;
+
+    if (!PyArg_ParseTuple(args, "i:shmht.stop_flusher", &idx))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (ht_map[idx].flusher == NULL)
+        Py_RETURN_FALSE;
+
+    ht_map[idx].busy++;
+    Py_BEGIN_ALLOW_THREADS
+    stop_flusher(&ht_map[idx]);
+    Py_END_ALLOW_THREADS
+    ht_map[idx].busy--;
+
+    Py_RETURN_TRUE;
+}
+
+static PyObject * shmht_snapshot(PyObject *self, PyObject *args)
+{
+    int idx;
+    const char *path, *since = NULL;
+    long count;
+
+    if (!PyArg_ParseTuple(args, "is|z:shmht.snapshot", &idx, &path, &since))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_published(idx))
+        return NULL;
+
+    hashtable *ht = ht_map[idx].ht;
+
+    ht_map[idx].busy++;
+    Py_BEGIN_ALLOW_THREADS
+    node_lock(&ht_map[idx], False);
+    count = ht_snapshot(ht, path, since);
+    node_unlock(&ht_map[idx]);
+    Py_END_ALLOW_THREADS
+    ht_map[idx].busy--;
+
+    if (count < 0 && errno == EINVAL) {
+        PyErr_Format(shmht_error, "snapshot %s was not taken from this table", since);
+        return NULL;
+    }
+    if (count < 0) {
+        PyErr_Format(shmht_error, "snapshot to %s failed: [%d] %s", path, errno, strerror(errno));
+        return NULL;
+    }
+    return PyInt_FromLong(count);
+}
+
+static PyObject * shmht_restore(PyObject *self, PyObject *args)
+{
+    int idx, n_threads = 0;
+    const char *path;
+    long count;
+
+    if (!PyArg_ParseTuple(args, "is|i:shmht.restore", &idx, &path, &n_threads))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_writable(idx, True))
+        return NULL;
+
+    hashtable *ht = ht_map[idx].ht;
+
+    ht_map[idx].busy++;
+    Py_BEGIN_ALLOW_THREADS
+    node_lock(&ht_map[idx], False);
+    count = ht_restore(ht, path, n_threads);
+    if (count >= 0 && (ht->flags & HT_NAMESPACES))
+        ht_ns_recount(ht);
+    node_unlock(&ht_map[idx]);
+    Py_END_ALLOW_THREADS
+    ht_map[idx].busy--;
+
+    if (count < 0 && errno == EINVAL) {
+        PyErr_Format(shmht_error, "delta %s does not follow the last snapshot restored into this table", path);
+        return NULL;
+    }
+    if (count < 0) {
+        PyErr_Format(shmht_error, "restore from %s failed: [%d] %s", path, errno, strerror(errno));
+        return NULL;
+    }
+    return PyInt_FromLong(count);
+}
+
+static void backup_lock(void *arg)
+{
+    mylock(*(int *)arg);
+}
+
+static void backup_unlock(void *arg)
+{
+    myunlock(*(int *)arg);
+}
+
+static PyObject * shmht_backup(PyObject *self, PyObject *args)
+{
+    int idx, fd;
+    const char *path;
+    long count;
+
+    if (!PyArg_ParseTuple(args, "is:shmht.backup", &idx, &path))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_writable(idx, False))
+        return NULL;
+
+    hashtable *ht = ht_map[idx].ht;
+
+    // flock() does not exclude users of the same open file, so lock
+    // through a descriptor of our own; writers in this process then wait
+    // for the short backup critical sections like everybody else
+    fd = open(ht_map[idx].name, O_RDWR);
+    if (fd < 0) {
+        PyErr_Format(shmht_error, "open file(%s) failed: [%d] %s", ht_map[idx].name, errno, strerror(errno));
+        return NULL;
+    }
+
+    ht_map[idx].busy++;
+    Py_BEGIN_ALLOW_THREADS
+    count = ht_backup(ht, path, backup_lock, backup_unlock, &fd);
+    Py_END_ALLOW_THREADS
+    ht_map[idx].busy--;
+
+    close(fd);
+
+    if (count < 0) {
+        if (errno == ENOTSUP)
+            PyErr_Format(shmht_error, "online backup needs a table created with shmht.BACKUP");
+        else
+            PyErr_Format(shmht_error, "backup to %s failed: [%d] %s", path, errno, strerror(errno));
+        return NULL;
+    }
+    return PyInt_FromLong(count);
+}
+
+static PyObject * shmht_start_mirror(PyObject *self, PyObject *args)
+{
+    int idx, workers = 2;
+    const char *path;
+    double interval = 0.1;
+    ht_mirror *m;
+
+    if (!PyArg_ParseTuple(args, "is|di:shmht.start_mirror", &idx, &path, &interval, &workers))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_writable(idx, False))
+        return NULL;
+
+    if (ht_map[idx].mirror != NULL) {
+        PyErr_Format(shmht_error, "mirror already running for ht id: (%d)", idx);
+        return NULL;
+    }
+
+    hashtable *ht = ht_map[idx].ht;
+
+    // the first pass copies the whole table, which can take a while
+    ht_map[idx].busy++;
+    Py_BEGIN_ALLOW_THREADS
+    m = ht_mirror_start(ht, path, interval, workers);
+    Py_END_ALLOW_THREADS
+    ht_map[idx].busy--;
+
+    if (m == NULL) {
+        if (errno == EBUSY)
+            PyErr_Format(shmht_error, "table is already mirrored by another process");
+        else
+            PyErr_Format(shmht_error, "mirror to %s failed: [%d] %s", path, errno, strerror(errno));
+        return NULL;
+    }
+    ht_map[idx].mirror = m;
+
+    return PyString_FromString(ht_mirror_engine(m));
+}
+
+static PyObject * shmht_sync_mirror(PyObject *self, PyObject *args)
+{
+    int idx, err;
+
+    if (!PyArg_ParseTuple(args, "i:shmht.sync_mirror", &idx))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (ht_map[idx].mirror == NULL) {
+        PyErr_Format(shmht_error, "no mirror running for ht id: (%d)", idx);
+        return NULL;
+    }
+
+    ht_map[idx].busy++;
+    Py_BEGIN_ALLOW_THREADS
+    err = ht_mirror_sync(ht_map[idx].mirror);
+    Py_END_ALLOW_THREADS
+    ht_map[idx].busy--;
+
+    if (err != 0) {
+        PyErr_Format(shmht_error, "mirror write failed: [%d] %s", err, strerror(err));
+        return NULL;
+    }
+    return PyLong_FromSize_t(ht_mirror_bytes(ht_map[idx].mirror));
+}
+
+static PyObject * shmht_stop_mirror(PyObject *self, PyObject *args)
+{
+    int idx, err;
+
+    if (!PyArg_ParseTuple(args, "i:shmht.stop_mirror", &idx))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (ht_map[idx].mirror == NULL)
+        Py_RETURN_FALSE;
+
+    ht_map[idx].busy++;
+    Py_BEGIN_ALLOW_THREADS
+    err = ht_mirror_stop(ht_map[idx].mirror);
+    Py_END_ALLOW_THREADS
+    ht_map[idx].busy--;
+    ht_map[idx].mirror = NULL;
+
+    if (err != 0) {
+        PyErr_Format(shmht_error, "mirror write failed: [%d] %s", err, strerror(err));
+        return NULL;
+    }
+    Py_RETURN_TRUE;
+}
+
+static PyObject * shmht_compact(PyObject *self, PyObject *args)
+{
+    int idx, fd;
+    long moved;
+
+    if (!PyArg_ParseTuple(args, "i:shmht.compact", &idx))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_writable(idx, True))
+        return NULL;
+
+    hashtable *ht = ht_map[idx].ht;
+
+    // own descriptor, for the same reason as in shmht_backup
+    fd = open(ht_map[idx].name, O_RDWR);
+    if (fd < 0) {
+        PyErr_Format(shmht_error, "open file(%s) failed: [%d] %s", ht_map[idx].name, errno, strerror(errno));
+        return NULL;
+    }
+
+    ht_map[idx].busy++;
+    Py_BEGIN_ALLOW_THREADS
+    moved = ht_compact(ht, backup_lock, backup_unlock, &fd);
+    Py_END_ALLOW_THREADS
+    ht_map[idx].busy--;
+
+    close(fd);
+
+    if (moved < 0) {
+        if (errno == ENOTSUP)
+            PyErr_Format(shmht_error, "compaction needs a table created with shmht.LOG or shmht.BLOOM");
+        else if (errno == EBUSY)
+            PyErr_Format(shmht_error, "the log is being compacted by another process");
+        else
+            PyErr_Format(shmht_error, "compaction failed: [%d] %s", errno, strerror(errno));
+        return NULL;
+    }
+    return PyInt_FromLong(moved);
+}
+
+static void * compactor_main(void *arg)
+{
+    struct compactor *c = (struct compactor *)arg;
+    hashtable *ht = c->ht;
+
+    pthread_mutex_lock(&c->mutex);
+    while (!c->stop) {
+        double deadline = now_seconds() + c->interval;
+        struct timespec ts;
+        ts.tv_sec  = (time_t)deadline;
+        ts.tv_nsec = (long)((deadline - ts.tv_sec) * 1000000000.0);
+        pthread_cond_timedwait(&c->cond, &c->mutex, &ts);
+        if (c->stop)
+            break;
+
+        if (ht_is_sealed(ht))
+            break;
+        size_t used = ht_log_used(ht), live = ht->log_live;
+        size_t garbage = used > live ? used - live : 0;
+        size_t min_garbage = ht->log_half / 4 < compactor_min_garbage ? ht->log_half / 4 : compactor_min_garbage;
+        if (garbage == 0 || garbage < min_garbage || garbage < c->ratio * used)
+            continue;
+
+        pthread_mutex_unlock(&c->mutex);
+        if (ht_compact(ht, backup_lock, backup_unlock, &c->fd) < 0 && errno != EBUSY)
+            fprintf(stderr, "compaction failed: [%d] %s\n", errno, strerror(errno));
+        pthread_mutex_lock(&c->mutex);
+    }
+    pthread_mutex_unlock(&c->mutex);
+    return NULL;
+}
+
+static void stop_compactor(struct mapnode *node)
+{
+    struct compactor *c = node->compactor;
+    if (c == NULL)
+        return;
+
+    pthread_mutex_lock(&c->mutex);
+    c->stop = 1;
+    pthread_cond_signal(&c->cond);
+    pthread_mutex_unlock(&c->mutex);
+
+    pthread_join(c->thread, NULL);
+    pthread_cond_destroy(&c->cond);
+    pthread_mutex_destroy(&c->mutex);
+    close(c->fd);
+    free(c);
+    node->compactor = NULL;
+}
+
+// returns 0 or an errno value
+static int start_compactor(struct mapnode *node, double interval, double ratio)
+{
+    struct compactor *c = ALLOC(struct compactor, 1);
+    if (c == NULL)
+        return ENOMEM;
+    bzero(c, sizeof(struct compactor));
+    c->ht       = node->ht;
+    c->interval = interval;
+    c->ratio    = ratio;
+    c->fd       = open(node->name, O_RDWR);
+    if (c->fd < 0) {
+        int err = errno;
+        free(c);
+        return err;
+    }
+    pthread_mutex_init(&c->mutex, NULL);
+    pthread_cond_init(&c->cond, NULL);
+
+    int err = pthread_create(&c->thread, NULL, compactor_main, c);
+    if (err != 0) {
+        pthread_cond_destroy(&c->cond);
+        pthread_mutex_destroy(&c->mutex);
+        close(c->fd);
+        free(c);
+        return err;
+    }
+    node->compactor = c;
+    return 0;
+}
+
+static PyObject * shmht_start_compactor(PyObject *self, PyObject *args)
+{
+    int idx;
+    double interval = 1.0, ratio = 0.5;
+
+    if (!PyArg_ParseTuple(args, "i|dd:shmht.start_compactor", &idx, &interval, &ratio))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_writable(idx, True))
+        return NULL;
+
+    if (!(ht_map[idx].ht->flags & HT_LOG)) {
+        PyErr_Format(shmht_error, "compaction needs a table created with shmht.LOG");
+        return NULL;
+    }
+
+    if (interval <= 0) {
+        PyErr_Format(shmht_error, "compactor needs a positive interval");
+        return NULL;
+    }
+
+    if (ht_map[idx].compactor != NULL) {
+        PyErr_Format(shmht_error, "compactor already running for ht id: (%d)", idx);
+        return NULL;
+    }
+
+    int err = start_compactor(&ht_map[idx], interval, ratio);
+    if (err != 0) {
+        PyErr_Format(shmht_error, "compactor failed to start: [%d] %s", err, strerror(err));
+        return NULL;
+    }
+
+    Py_RETURN_TRUE;
+}
+
+static PyObject * shmht_stop_compactor(PyObject *self, PyObject *args)
+{
+    int idx;
+
+    if (!PyArg_ParseTuple(args, "i:shmht.stop_compactor", &idx))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (ht_map[idx].compactor == NULL)
+        Py_RETURN_FALSE;
+
+    ht_map[idx].busy++;
+    Py_BEGIN_ALLOW_THREADS
+    stop_compactor(&ht_map[idx]);
+    Py_END_ALLOW_THREADS
+    ht_map[idx].busy--;
+
+    Py_RETURN_TRUE;
+}
+
+static PyObject * shmht_log_usage(PyObject *self, PyObject *args)
+{
+    int idx;
+
+    if (!PyArg_ParseTuple(args, "i:shmht.log_usage", &idx))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_published(idx))
+        return NULL;
+
+    hashtable *ht = ht_map[idx].ht;
+    return Py_BuildValue("(nnn)", (Py_ssize_t)ht_log_used(ht), (Py_ssize_t)ht->log_live, (Py_ssize_t)ht->log_half);
+}
+
+#define journal_read_buffer (256 * 1024)
+
+static PyObject * shmht_read_journal(PyObject *self, PyObject *args)
+{
+    int idx;
+    PyObject *py_pos = Py_None;
+    Py_ssize_t max_records = 1000;
+    size_t pos;
+    long n;
+
+    if (!PyArg_ParseTuple(args, "i|On:shmht.read_journal", &idx, &py_pos, &max_records))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_published(idx))
+        return NULL;
+
+    hashtable *ht = ht_map[idx].ht;
+
+    if (py_pos == Py_None)
+        pos = ht_journal_position(ht);
+    else {
+        pos = PyInt_AsSsize_t(py_pos);
+        if (PyErr_Occurred())
+            return NULL;
+    }
+
+    char *buf = ALLOC(char, journal_read_buffer);
+    if (buf == NULL)
+        return PyErr_NoMemory();
+
+    // no lock: the journal is read optimistically
+    n = ht_journal_read(ht, &pos, buf, journal_read_buffer, max_records > 0 ? max_records : 1);
+    if (n < 0) {
+        if (errno == ENOTSUP)
+            PyErr_Format(shmht_error, "the journal needs a table created with shmht.JOURNAL");
+        else if (errno == ESTALE)
+            PyErr_Format(shmht_error, "journal position %lu was overwritten; resync", (unsigned long)pos);
+        else
+            PyErr_Format(shmht_error, "invalid journal position %lu", (unsigned long)pos);
+        free(buf);
+        return NULL;
+    }
+
+    PyObject *records = PyList_New(0);
+    size_t offset = 0;
+    ht_journal_entry e;
+    while (records != NULL && ht_journal_next(buf, n, &offset, &e)) {
+        PyObject *record;
+        if (e.value_size == HT_JOURNAL_RESET)
+            record = Py_BuildValue("(nOO)", (Py_ssize_t)e.seq, Py_None, Py_None);
+        else if (e.value_size == HT_JOURNAL_REMOVE)
+            record = Py_BuildValue("(ns#O)", (Py_ssize_t)e.seq, e.key, (int)e.key_size, Py_None);
+        else
+            record = Py_BuildValue("(ns#s#)", (Py_ssize_t)e.seq, e.key, (int)e.key_size, e.value, (int)e.value_size);
+        if (record == NULL || PyList_Append(records, record) != 0) {
+            Py_XDECREF(record);
+            Py_CLEAR(records);
+            break;
+        }
+        Py_DECREF(record);
+    }
+    free(buf);
+    if (records == NULL)
+        return NULL;
+
+    PyObject *result = Py_BuildValue("(nO)", (Py_ssize_t)pos, records);
+    Py_DECREF(records);
+    return result;
+}
+
+static PyObject * shmht_follow(PyObject *self, PyObject *args)
+{
+    int idx, primary_idx;
+    long applied;
+
+    if (!PyArg_ParseTuple(args, "ii:shmht.follow", &idx, &primary_idx))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!valid_ident(&primary_idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", primary_idx);
+        return NULL;
+    }
+
+    if (!check_writable(idx, True) || !check_published(primary_idx))
+        return NULL;
+
+    if (ht_map[idx].ht == ht_map[primary_idx].ht || strcmp(ht_map[idx].name, ht_map[primary_idx].name) == 0) {
+        PyErr_Format(shmht_error, "a table cannot follow itself");
+        return NULL;
+    }
+
+    hashtable *ht = ht_map[idx].ht;
+
+    ht_map[idx].busy++;
+    ht_map[primary_idx].busy++;
+    Py_BEGIN_ALLOW_THREADS
+    node_lock(&ht_map[idx], False);
+    applied = ht_follow(ht, ht_map[primary_idx].ht, table_lock, table_unlock, &ht_map[primary_idx]);
+    if (applied > 0 && (ht->flags & ht_map[primary_idx].ht->flags & HT_NAMESPACES)) {
+        table_lock(&ht_map[primary_idx]);
+        ht_ns_copy_names(ht, ht_map[primary_idx].ht);
+        table_unlock(&ht_map[primary_idx]);
+        ht_ns_recount(ht);
+    }
+    node_unlock(&ht_map[idx]);
+    Py_END_ALLOW_THREADS
+    ht_map[primary_idx].busy--;
+    ht_map[idx].busy--;
+
+    if (applied < 0) {
+        if (errno == ENOTSUP)
+            PyErr_Format(shmht_error, "the journal needs a table created with shmht.JOURNAL");
+        else if (errno == ENOSPC)
+            PyErr_Format(shmht_error, "replica is too small for the primary");
+        else
+            PyErr_Format(shmht_error, "follow failed: [%d] %s", errno, strerror(errno));
+        return NULL;
+    }
+    return PyInt_FromLong(applied);
+}
+
+static PyObject * shmht_digest(PyObject *self, PyObject *args)
+{
+    int idx;
+    size_t digest;
+
+    if (!PyArg_ParseTuple(args, "i:shmht.digest", &idx))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_published(idx))
+        return NULL;
+
+    hashtable *ht = ht_map[idx].ht;
+
+    if (!(ht->flags & HT_DIGEST)) {
+        PyErr_Format(shmht_error, "the digest needs a table created with shmht.DIGEST");
+        return NULL;
+    }
+
+    node_lock(&ht_map[idx], True);
+    digest = ht_digest(ht);
+    node_unlock(&ht_map[idx]);
+
+    return PyLong_FromUnsignedLongLong(digest);
+}
+
+static void diff_collect(void *arg, const char *key, u_int32 key_size)
+{
+    PyObject *keys = (PyObject *)arg;
+    PyObject *k = PyString_FromStringAndSize(key, key_size);
+    if (k != NULL) {
+        PyList_Append(keys, k);
+        Py_DECREF(k);
+    }
+}
+
+static PyObject * shmht_diff(PyObject *self, PyObject *args)
+{
+    int idx, other_idx;
+    long reported;
+
+    if (!PyArg_ParseTuple(args, "ii:shmht.diff", &idx, &other_idx))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!valid_ident(&other_idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", other_idx);
+        return NULL;
+    }
+
+    if (!check_published(idx) || !check_published(other_idx))
+        return NULL;
+
+    PyObject *keys = PyList_New(0);
+    if (keys == NULL)
+        return NULL;
+
+    // lock in a fixed order, so two processes diffing the same pair
+    // the other way around cannot deadlock
+    int first = idx, second = other_idx;
+    if (strcmp(ht_map[first].name, ht_map[second].name) > 0)
+        first = other_idx, second = idx;
+    BOOL same = strcmp(ht_map[first].name, ht_map[second].name) == 0;
+
+    node_lock(&ht_map[first], True);
+    if (!same)
+        node_lock(&ht_map[second], True);
+    reported = ht_diff(ht_map[idx].ht, ht_map[other_idx].ht, diff_collect, keys);
+    if (!same)
+        node_unlock(&ht_map[second]);
+    node_unlock(&ht_map[first]);
+
+    if (reported < 0) {
+        Py_DECREF(keys);
+        PyErr_Format(shmht_error, "diff needs tables created with shmht.DIGEST");
+        return NULL;
+    }
+    if (PyErr_Occurred()) {
+        Py_DECREF(keys);
+        return NULL;
+    }
+    return keys;
+}
+
+// mappings of superseded tables, kept for a while in case another thread
+// of this process still looks at them
+#define retire_grace    1.0
+#define max_retired     64
+
+struct retired {
+    void *addr;
+    size_t size;
+    double since;
+};
+
+static struct retired retired[max_retired];
+static int n_retired = 0;
+
+static void reap_retired(double grace)
+{
+    double now = now_seconds();
+    int i = 0;
+    while (i < n_retired) {
+        if (now - retired[i].since >= grace) {
+            munmap(retired[i].addr, retired[i].size);
+            retired[i] = retired[--n_retired];
+        }
+        else
+            i++;
+    }
+}
+
+static void retire(void *addr, size_t size)
+{
+    if (n_retired == max_retired)
+        reap_retired(0);
+    retired[n_retired].addr  = addr;
+    retired[n_retired].size  = size;
+    retired[n_retired].since = now_seconds();
+    n_retired++;
+}
+
+// map a file that already holds a table; NULL with errno set otherwise
+static hashtable* map_table_file(int fd, int prot, size_t *mem_size)
+{
+    struct stat buf;
+    if (fstat(fd, &buf) != 0)
+        return NULL;
+    if ((size_t)buf.st_size < sizeof(hashtable)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    hashtable *ht = mmap(NULL, sizeof(hashtable), PROT_READ, MAP_SHARED, fd, 0);
+    if (ht == MAP_FAILED)
+        return NULL;
+    if (!ht_is_valid(ht)) {
+        munmap(ht, sizeof(hashtable));
+        errno = EINVAL;
+        return NULL;
+    }
+    *mem_size = ht_file_size(ht);
+    size_t cold_offset = 0, cold_size = 0;
+    char cold_path[HT_COLD_PATH];
+    if ((ht->flags & HT_TIERED) && ht->cold_size != 0) {
+        cold_offset = ht->cold_offset;
+        cold_size   = ht->cold_size;
+        memcpy(cold_path, ht->cold_path, HT_COLD_PATH);
+        cold_path[HT_COLD_PATH - 1] = 0;
+    }
+    munmap(ht, sizeof(hashtable));
+    if ((size_t)buf.st_size < *mem_size) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (cold_size != 0)
+        return map_tiered(fd, prot, cold_path, cold_offset, cold_size, mem_size);
+    ht = mmap(NULL, *mem_size, prot, MAP_SHARED, fd, 0);
+    return ht == MAP_FAILED ? NULL : ht;
+}
+
+/*
+ * HT_TIERED: the table, and its cold file cold_offset bytes after it, in
+ * one reservation of address space, so that record offsets reach both.
+ * *mem_size is the table size on the way in and the whole span on the
+ * way out; one munmap undoes it all.
+ */
+static hashtable* map_tiered(int fd, int prot, const char *cold_path, size_t cold_offset, size_t cold_size, size_t *mem_size)
+{
+    struct stat buf;
+    size_t span = cold_offset + cold_size;
+    int saved_errno;
+
+    int cold_fd = open(cold_path, (prot & PROT_WRITE) ? O_RDWR : O_RDONLY);
+    if (cold_fd < 0)
+        return NULL;
+    if (fstat(cold_fd, &buf) != 0 || (size_t)buf.st_size < cold_size) {
+        close(cold_fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    char *base = mmap(NULL, span, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        close(cold_fd);
+        return NULL;
+    }
+    if (mmap(base, *mem_size, prot, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+        || mmap(base + cold_offset, cold_size, prot, MAP_SHARED | MAP_FIXED, cold_fd, 0) == MAP_FAILED) {
+        saved_errno = errno;
+        munmap(base, span);
+        close(cold_fd);
+        errno = saved_errno;
+        return NULL;
+    }
+    // the mapping keeps the file; the descriptor is not needed
+    close(cold_fd);
+    *mem_size = span;
+    return (hashtable *)base;
+}
+
+/*
+ * Another table was published under the name of table idx: map that one
+ * instead, move the flusher and compactor over, and retire the old
+ * mapping.  A mirror belongs to the old table and is stopped.  Stays put
+ * while an operation without the GIL still works on the old table.
+ * Returns False with a Python error set.
+ */
+static int switch_mapping(int idx)
+{
+    struct mapnode *node = &ht_map[idx];
+    size_t mem_size;
+    hashtable *ht;
+
+    if (node->busy)
+        return True;
+
+    int fd = open(node->name, node->readonly ? O_RDONLY : O_RDWR);
+    if (fd < 0) {
+        PyErr_Format(shmht_error, "open file(%s) failed: [%d] %s", node->name, errno, strerror(errno));
+        return False;
+    }
+    mylock(fd);
+    ht = map_table_file(fd, node->readonly ? PROT_READ : PROT_READ|PROT_WRITE, &mem_size);
+    if (ht != NULL && !node->readonly)
+        ht_init(ht, ht->orig_capacity, ht->flags, ht->log_half, ht->journal_size, 0);
+    myunlock(fd);
+    if (ht == NULL) {
+        PyErr_Format(shmht_error, "published file(%s) is not a table: [%d] %s", node->name, errno, strerror(errno));
+        close(fd);
+        return False;
+    }
+
+    double flush_interval = 0, compact_interval = 0, compact_ratio = 0;
+    size_t flush_threshold = 0;
+    if (node->flusher != NULL)
+        flush_interval = node->flusher->interval, flush_threshold = node->flusher->threshold;
+    if (node->compactor != NULL)
+        compact_interval = node->compactor->interval, compact_ratio = node->compactor->ratio;
+    BOOL flushing = node->flusher != NULL, compacting = node->compactor != NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    stop_flusher(node);
+    stop_compactor(node);
+    if (node->mirror != NULL) {
+        ht_mirror_stop(node->mirror);
+        node->mirror = NULL;
+    }
+    Py_END_ALLOW_THREADS
+
+    if (!node->readonly) {
+        mylock(node->fd);
+        ht_destroy(node->ht);
+        myunlock(node->fd);
+    }
+    retire(node->ht, node->mem_size);
+    close(node->fd);
+
+    node->fd       = fd;
+    node->ht       = ht;
+    node->mem_size = mem_size;
+    if (flushing)
+        start_flusher(node, flush_interval, flush_threshold);
+    if (compacting && (ht->flags & HT_LOG))
+        start_compactor(node, compact_interval, compact_ratio);
+    return True;
+}
+
+// switch_mapping under the mutex of the node, unless another thread has switched already
+static int switch_table(int idx)
+{
+    struct mapnode *node = &ht_map[idx];
+
+    if (node->busy)
+        return True;
+    node_mutex_lock(node, True);
+    int ok = !__atomic_load_n(&node->ht->superseded, __ATOMIC_ACQUIRE) || switch_mapping(idx);
+    pthread_mutex_unlock(&node->mutex);
+    return ok;
+}
+
+// cheap check at the start of an operation
+static int check_published(int idx)
+{
+    if (n_retired > 0)
+        reap_retired(retire_grace);
+    if (!__atomic_load_n(&ht_map[idx].ht->superseded, __ATOMIC_ACQUIRE))
+        return True;
+    return switch_table(idx);
+}
+
+/*
+ * Returns False with a Python error set if table idx may not be written.
+ * With contents, the operation changes entries, which a sealed table
+ * refuses; without, it only keeps the books (dirty bits, backup state).
+ */
+static int check_writable(int idx, int contents)
+{
+    if (!check_published(idx))
+        return False;
+    if (ht_map[idx].readonly) {
+        PyErr_Format(shmht_error, "table(%s) was opened read-only", ht_map[idx].name);
+        return False;
+    }
+    if (contents && ht_is_sealed(ht_map[idx].ht)) {
+        PyErr_Format(shmht_error, "table(%s) is sealed", ht_map[idx].name);
+        return False;
+    }
+    return True;
+}
+
+/*
+ * Lock the table, after moving to a newly published one if need be.  A
+ * sealed table never changes, so it is not locked at all.
+ */
+static hashtable* lock_table(int idx)
+{
+    if (n_retired > 0)
+        reap_retired(retire_grace);
+    while (True) {
+        hashtable *ht = ht_map[idx].ht;
+        BOOL sealed = ht_is_sealed(ht);
+        if (!sealed) {
+            node_lock(&ht_map[idx], True);
+            // sealed by somebody else while we waited: then it needs no lock
+            if (ht_is_sealed(ht))
+                node_unlock(&ht_map[idx]);
+        }
+        if (!__atomic_load_n(&ht->superseded, __ATOMIC_ACQUIRE) || ht_map[idx].busy)
+            return ht;
+        if (!ht_is_sealed(ht))
+            node_unlock(&ht_map[idx]);
+        if (!switch_table(idx))
+            return NULL;
+    }
+}
+
+/*
+ * ht is what lock_table returned.  lock_table left it locked unless it
+ * was sealed, and sealing happens under the lock, so it is still not
+ * sealed if it was locked.
+ */
+static void unlock_table(int idx, hashtable *ht)
+{
+    if (!ht_is_sealed(ht))
+        node_unlock(&ht_map[idx]);
+}
+
+/*
+ * Rename the table file path to name.  The caller holds the lock of the
+ * table now under name, old (NULL if there is none), so no write to it
+ * slips in between the rename and the superseded mark.  With
+ * keep_namespaces, the new table takes over the namespace directory of
+ * old.  Returns the generation of the new table, or 0 with a Python
+ * error set.
+ */
+static size_t replace_table(const char *path, const char *name, hashtable *old, int keep_namespaces)
+{
+    size_t mem_size, generation = old != NULL ? old->generation + 1 : 1;
+    hashtable *ht;
+
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        PyErr_Format(shmht_error, "open file(%s) failed: [%d] %s", path, errno, strerror(errno));
+        return 0;
+    }
+    ht = map_table_file(fd, PROT_READ|PROT_WRITE, &mem_size);
+    if (ht == NULL) {
+        PyErr_Format(shmht_error, "%s is not a table: [%d] %s", path, errno, strerror(errno));
+        close(fd);
+        return 0;
+    }
+    ht_set_generation(ht, generation);
+    if (keep_namespaces && old != NULL && (ht->flags & old->flags & HT_NAMESPACES))
+        memcpy(ht_namespace_at(ht, 0), ht_namespace_at(old, 0), sizeof(ht_namespace) * HT_MAX_NAMESPACES);
+    msync(ht, ht->flag_offset, MS_SYNC);
+    munmap(ht, mem_size);
+    close(fd);
+
+    if (rename(path, name) != 0) {
+        PyErr_Format(shmht_error, "rename(%s, %s) failed: [%d] %s", path, name, errno, strerror(errno));
+        return 0;
+    }
+    if (old != NULL)
+        ht_supersede(old);
+    return generation;
+}
+
+static PyObject * shmht_publish(PyObject *self, PyObject *args)
+{
+    const char *path, *name;
+    size_t old_size = 0, generation;
+    hashtable *old = NULL;
+    int old_fd;
+
+    if (!PyArg_ParseTuple(args, "ss:shmht.publish", &path, &name))
+        return NULL;
+
+    old_fd = open(name, O_RDWR);
+    if (old_fd >= 0) {
+        mylock(old_fd);
+        old = map_table_file(old_fd, PROT_READ|PROT_WRITE, &old_size);
+    }
+
+    generation = replace_table(path, name, old, False);
+
+    if (old != NULL)
+        munmap(old, old_size);
+    if (old_fd >= 0) {
+        myunlock(old_fd);
+        close(old_fd);
+    }
+
+    if (generation == 0)
+        return NULL;
+    return PyInt_FromLong(generation);
+}
+
+static PyObject * shmht_generation(PyObject *self, PyObject *args)
+{
+    int idx;
+
+    if (!PyArg_ParseTuple(args, "i:shmht.generation", &idx))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_published(idx))
+        return NULL;
+
+    return PyInt_FromLong(ht_map[idx].ht->generation);
+}
+
+static PyObject * shmht_seal(PyObject *self, PyObject *args)
+{
+    int idx;
+
+    if (!PyArg_ParseTuple(args, "i:shmht.seal", &idx))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_writable(idx, False))
+        return NULL;
+
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL)
+        return NULL;
+    if (ht_is_sealed(ht))
+        Py_RETURN_TRUE;
+    ht_seal(ht);
+    node_unlock(&ht_map[idx]);
+
+    Py_RETURN_TRUE;
+}
+
+// pairs pointing into the strings of items, which must stay alive
+static ht_pair* pairs_from_items(PyObject *items, size_t *n)
+{
+    Py_ssize_t i, count = PyList_GET_SIZE(items);
+    ht_pair *pairs = ALLOC(ht_pair, count + 1);
+    if (pairs == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    for (i = 0; i < count; i++) {
+        PyObject *item = PyList_GET_ITEM(items, i);
+        char *key, *value;
+        Py_ssize_t key_size, value_size;
+        if (!PyTuple_Check(item) || PyTuple_GET_SIZE(item) != 2
+                || PyString_AsStringAndSize(PyTuple_GET_ITEM(item, 0), &key, &key_size) != 0
+                || PyString_AsStringAndSize(PyTuple_GET_ITEM(item, 1), &value, &value_size) != 0) {
+            PyErr_Clear();
+            PyErr_Format(PyExc_TypeError, "expected (key, value) pairs of strings");
+            free(pairs);
+            return NULL;
+        }
+        pairs[i].key        = key;
+        pairs[i].key_size   = key_size;
+        pairs[i].value      = value;
+        pairs[i].value_size = value_size;
+    }
+    *n = count;
+    return pairs;
+}
+
+// pairs pointing into the entries of a locked table
+static ht_pair* pairs_from_table(hashtable *ht, size_t *n)
+{
+    ht_pair *pairs = ALLOC(ht_pair, ht->size + 1);
+    if (pairs == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    ht_iter *iter = ht_get_iterator(ht);
+    *n = 0;
+    while (*n < ht->size && ht_iter_next(iter)) {
+        pairs[*n].key        = iter->key->str;
+        pairs[*n].key_size   = iter->key->size;
+        pairs[*n].value      = iter->value->str;
+        pairs[*n].value_size = iter->value->size;
+        (*n)++;
+    }
+    free(iter);
+    return pairs;
+}
+
+static PyObject * shmht_freeze(PyObject *self, PyObject *args)
+{
+    const char *path;
+    PyObject *source, *items = NULL;
+    ht_pair *pairs = NULL;
+    hashtable *ht = NULL;
+    size_t n = 0;
+    long count;
+    int idx = -1;
+
+    if (!PyArg_ParseTuple(args, "sO:shmht.freeze", &path, &source))
+        return NULL;
+
+    if (PyInt_Check(source)) {
+        idx = PyInt_AsLong(source);
+        if (!valid_ident(&idx)) {
+            PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+            return NULL;
+        }
+        if (ht_map[idx].ht->flags & (HT_NAMESPACES | HT_MULTI)) {
+            PyErr_Format(shmht_error, "tables with namespaces or MULTI cannot be frozen");
+            return NULL;
+        }
+        ht = lock_table(idx);
+        if (ht == NULL)
+            return NULL;
+        // the pairs point into the table, which stays locked until written
+        pairs = pairs_from_table(ht, &n);
+        if (pairs == NULL) {
+            unlock_table(idx, ht);
+            return NULL;
+        }
+    }
+    else {
+        items = PySequence_List(source);
+        if (items == NULL)
+            return NULL;
+        pairs = pairs_from_items(items, &n);
+        if (pairs == NULL) {
+            Py_DECREF(items);
+            return NULL;
+        }
+    }
+
+    if (idx >= 0)
+        ht_map[idx].busy++;
+    Py_BEGIN_ALLOW_THREADS
+    count = ht_freeze(path, pairs, n);
+    Py_END_ALLOW_THREADS
+    if (idx >= 0) {
+        ht_map[idx].busy--;
+        unlock_table(idx, ht);
+    }
+
+    free(pairs);
+    Py_XDECREF(items);
+
+    if (count < 0 && errno == EINVAL) {
+        PyErr_Format(shmht_error, "freeze to %s failed: duplicate key", path);
+        return NULL;
+    }
+    if (count < 0) {
+        PyErr_Format(shmht_error, "freeze to %s failed: [%d] %s", path, errno, strerror(errno));
+        return NULL;
+    }
+    return PyInt_FromLong(count);
+}
+
+static PyObject * shmht_load(PyObject *self, PyObject *args)
+{
+    const char *path, *delimiter = "\t";
+    PyObject *source, *items = NULL;
+    ht_pair *pairs = NULL;
+    char *buf = MAP_FAILED;
+    size_t buf_size = 0, n = 0;
+    unsigned flags = 0;
+    Py_ssize_t journal_size = 0;
+    int n_threads = 0;
+    long count;
+
+    if (!PyArg_ParseTuple(args, "sO|iInz:shmht.load", &path, &source, &n_threads, &flags, &journal_size, &delimiter))
+        return NULL;
+
+    if (flags & HT_FROZEN) {
+        PyErr_Format(shmht_error, "use freeze for frozen tables");
+        return NULL;
+    }
+    if (flags & (HT_NAMESPACES | HT_MULTI | HT_TIERED)) {
+        PyErr_Format(shmht_error, "tables with namespaces, MULTI or TIERED cannot be loaded");
+        return NULL;
+    }
+    if ((flags & HT_PAGED) && !(flags & (HT_SPLIT | HT_INTKEY))) {
+        PyErr_Format(shmht_error, "a PAGED table must also be SPLIT or INTKEY");
+        return NULL;
+    }
+    if ((flags & HT_BACKUP) && (flags & (HT_LOG | HT_SPLIT | HT_TIERED))) {
+        PyErr_Format(shmht_error, "a BACKUP table cannot also be LOG, SPLIT or TIERED");
+        return NULL;
+    }
+    if (delimiter != NULL && strlen(delimiter) != 1) {
+        PyErr_Format(shmht_error, "the delimiter must be one character, or None for length-prefixed records");
+        return NULL;
+    }
+
+    if (PyString_Check(source)) {
+        const char *name = PyString_AS_STRING(source);
+        struct stat st;
+        int fd = open(name, O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            PyErr_Format(shmht_error, "open file(%s) failed: [%d] %s", name, errno, strerror(errno));
+            if (fd >= 0)
+                close(fd);
+            return NULL;
+        }
+        buf_size = st.st_size;
+        if (buf_size > 0)
+            buf = mmap(NULL, buf_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (buf_size > 0 && buf == MAP_FAILED) {
+            PyErr_Format(shmht_error, "mmap failed, size=%lu: [%d] %s", buf_size, errno, strerror(errno));
+            return NULL;
+        }
+        if (buf_size > 0)
+            madvise(buf, buf_size, MADV_SEQUENTIAL);
+        long parsed = buf_size > 0 ? ht_load_parse(buf, buf_size, delimiter ? (unsigned char)delimiter[0] : -1, &pairs) : 0;
+        if (parsed < 0) {
+            PyErr_Format(shmht_error, "%s is not a key/value file: [%d] %s", name, errno, strerror(errno));
+            munmap(buf, buf_size);
+            return NULL;
+        }
+        n = parsed;
+    }
+    else {
+        items = PySequence_List(source);
+        if (items == NULL)
+            return NULL;
+        pairs = pairs_from_items(items, &n);
+        if (pairs == NULL) {
+            Py_DECREF(items);
+            return NULL;
+        }
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    count = ht_build(path, pairs, n, 0, flags, journal_size, n_threads);
+    Py_END_ALLOW_THREADS
+
+    free(pairs);
+    Py_XDECREF(items);
+    if (buf != MAP_FAILED)
+        munmap(buf, buf_size);
+
+    if (count < 0) {
+        PyErr_Format(shmht_error, "load to %s failed: [%d] %s", path, errno, strerror(errno));
+        return NULL;
+    }
+    return PyInt_FromLong(count);
+}
+
+static PyObject * shmht_getvals(PyObject *self, PyObject *args)
+{
+    int idx;
+    PyObject *keys, *values;
+    Py_ssize_t i, n;
+
+    if (!PyArg_ParseTuple(args, "iO:shmht.getvals", &idx, &keys))
+        return NULL;
+
+    int ns = ident_ns(idx);
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    keys = PySequence_Fast(keys, "getvals needs a sequence of keys");
+    if (keys == NULL)
+        return NULL;
+    n = PySequence_Fast_GET_SIZE(keys);
+    values = PyList_New(n);
+    if (values == NULL) {
+        Py_DECREF(keys);
+        return NULL;
+    }
+
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL) {
+        Py_DECREF(keys);
+        Py_DECREF(values);
+        return NULL;
+    }
+    for (i = 0; i < n; i++) {
+        char *key;
+        Py_ssize_t key_size;
+        PyObject *value;
+        if (PyString_AsStringAndSize(PySequence_Fast_GET_ITEM(keys, i), &key, &key_size) != 0)
+            break;
+        ht_str *found = entry_access(idx, ht, ns, key, key_size);
+        if (found == NULL) {
+            Py_INCREF(Py_None);
+            value = Py_None;
+        }
+        else if ((value = PyString_FromStringAndSize(found->str, found->size)) == NULL)
+            break;
+        PyList_SET_ITEM(values, i, value);
+    }
+    unlock_table(idx, ht);
+
+    Py_DECREF(keys);
+    if (i < n) {
+        Py_DECREF(values);
+        return NULL;
+    }
+    return values;
+}
+
+static PyObject * shmht_setvals(PyObject *self, PyObject *args)
+{
+    int idx;
+    PyObject *source, *items;
+    size_t i, n;
+
+    if (!PyArg_ParseTuple(args, "iO:shmht.setvals", &idx, &source))
+        return NULL;
+
+    int ns = ident_ns(idx);
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_writable(idx, True))
+        return NULL;
+
+    items = PySequence_List(source);
+    if (items == NULL)
+        return NULL;
+    ht_pair *pairs = pairs_from_items(items, &n);
+    if (pairs == NULL) {
+        Py_DECREF(items);
+        return NULL;
+    }
+
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL) {
+        free(pairs);
+        Py_DECREF(items);
+        return NULL;
+    }
+    for (i = 0; i < n; i++)
+        if (!entry_set(ht, ns, pairs[i].key, pairs[i].key_size, pairs[i].value, pairs[i].value_size))
+            break;
+    unlock_table(idx, ht);
+
+    if (i < n)
+        set_insert_error(pairs[i].key);
+    free(pairs);
+    Py_DECREF(items);
+    if (i < n)
+        return NULL;
+    return PyInt_FromLong(n);
+}
+
+#define shard_seed 0x5a4d5eedULL
+
+static PyObject * shmht_shard(PyObject *self, PyObject *args)
+{
+    const char *key;
+    int key_size, n;
+
+    if (!PyArg_ParseTuple(args, "s#i:shmht.shard", &key, &key_size, &n))
+        return NULL;
+    if (n <= 0) {
+        PyErr_Format(shmht_error, "invalid shard count: (%d)", n);
+        return NULL;
+    }
+    // not the hash of the home slot, so the keys of one shard still
+    // spread over all of its slots
+    return PyInt_FromLong(ht_frozen_hash(shard_seed, key, key_size) % n);
+}
+
+static PyObject * shmht_grow(PyObject *self, PyObject *args)
+{
+    int idx, n_threads = 0;
+    Py_ssize_t capacity;
+    char path[PATH_MAX];
+    size_t n = 0, generation = 0;
+    long count;
+
+    if (!PyArg_ParseTuple(args, "in|i:shmht.grow", &idx, &capacity, &n_threads))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_writable(idx, True))
+        return NULL;
+    if (ht_map[idx].ht->flags & HT_FROZEN) {
+        PyErr_Format(shmht_error, "table(%s) is frozen", ht_map[idx].name);
+        return NULL;
+    }
+    if (ht_map[idx].ht->flags & HT_TIERED) {
+        // its cold file belongs to it; a grown table would need one of its own
+        PyErr_Format(shmht_error, "table(%s) is TIERED and cannot grow", ht_map[idx].name);
+        return NULL;
+    }
+    if (snprintf(path, sizeof(path), "%s.grown", ht_map[idx].name) >= (int)sizeof(path)) {
+        PyErr_Format(shmht_error, "file name too long: %s", ht_map[idx].name);
+        return NULL;
+    }
+
+    // the table stays locked from the copy until the new one has its name
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL)
+        return NULL;
+    if (capacity < 0 || (size_t)capacity < ht->size) {
+        PyErr_Format(shmht_error, "capacity %ld is below the %lu entries of the table", (long)capacity, ht->size);
+        unlock_table(idx, ht);
+        return NULL;
+    }
+    ht_pair *pairs = pairs_from_table(ht, &n);
+    if (pairs == NULL) {
+        unlock_table(idx, ht);
+        return NULL;
+    }
+
+    ht_map[idx].busy++;
+    Py_BEGIN_ALLOW_THREADS
+    count = ht_build(path, pairs, n, capacity, ht->flags, ht->journal_size, n_threads);
+    Py_END_ALLOW_THREADS
+    ht_map[idx].busy--;
+    free(pairs);
+
+    if (count < 0)
+        PyErr_Format(shmht_error, "grow of %s failed: [%d] %s", ht_map[idx].name, errno, strerror(errno));
+    else
+        generation = replace_table(path, ht_map[idx].name, ht, True);
+    unlock_table(idx, ht);
+
+    if (generation == 0) {
+        unlink(path);
+        return NULL;
+    }
+    return PyInt_FromLong(generation);
+}
+
+static PyObject * shmht_namespaces(PyObject *self, PyObject *args)
+{
+    int idx, ns;
+
+    if (!PyArg_ParseTuple(args, "i:shmht.namespaces", &idx))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    PyObject *list = PyList_New(0);
+    if (list == NULL)
+        return NULL;
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL) {
+        Py_DECREF(list);
+        return NULL;
+    }
+    if (ht->flags & HT_NAMESPACES) {
+        for (ns = 0; ns < HT_MAX_NAMESPACES; ns++) {
+            ht_namespace *n = ht_namespace_at(ht, ns);
+            if (ns > 0 && n->name[0] == 0)
+                continue;
+            PyObject *item = Py_BuildValue("(sKKK)", n->name, (unsigned long long)n->size,
+                                           (unsigned long long)n->bytes, (unsigned long long)n->quota);
+            if (item == NULL || PyList_Append(list, item) != 0) {
+                Py_XDECREF(item);
+                Py_DECREF(list);
+                list = NULL;
+                break;
+            }
+            Py_DECREF(item);
+        }
+    }
+    unlock_table(idx, ht);
+    return list;
+}
+
+static const char *merge_modes[] = { "overwrite", "keep", "incr", "append", NULL };
+
+static PyObject * shmht_merge(PyObject *self, PyObject *args)
+{
+    int idx, n_threads = 0, mode;
+    const char *on_conflict = "overwrite";
+    PyObject *sources;
+    Py_ssize_t i, j, n_srcs;
+    long changed;
+
+    if (!PyArg_ParseTuple(args, "iO|si:shmht.merge", &idx, &sources, &on_conflict, &n_threads))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+    for (mode = 0; merge_modes[mode] != NULL; mode++)
+        if (strcmp(merge_modes[mode], on_conflict) == 0)
+            break;
+    if (merge_modes[mode] == NULL) {
+        PyErr_Format(shmht_error, "on_conflict must be overwrite, keep, incr or append, not %s", on_conflict);
+        return NULL;
+    }
+
+    sources = PySequence_Fast(sources, "merge needs a sequence of ht ids");
+    if (sources == NULL)
+        return NULL;
+    n_srcs = PySequence_Fast_GET_SIZE(sources);
+    int *src_idx = ALLOC(int, n_srcs + 1);
+    hashtable **srcs = ALLOC(hashtable *, n_srcs + 1);
+    if (src_idx == NULL || srcs == NULL) {
+        free(src_idx), free(srcs);
+        Py_DECREF(sources);
+        return PyErr_NoMemory();
+    }
+
+    // each file locked once, the destination not as a source: flock
+    // locks of two descriptors of one file would wait for each other
+    for (i = 0; i < n_srcs; i++) {
+        src_idx[i] = PyInt_AsLong(PySequence_Fast_GET_ITEM(sources, i));
+        if (PyErr_Occurred())
+            goto bad_sources;
+        if (!valid_ident(&src_idx[i])) {
+            PyErr_Format(shmht_error, "invalid ht id: (%d)", src_idx[i]);
+            goto bad_sources;
+        }
+        if (strcmp(ht_map[src_idx[i]].name, ht_map[idx].name) == 0) {
+            PyErr_Format(shmht_error, "cannot merge table(%s) into itself", ht_map[idx].name);
+            goto bad_sources;
+        }
+        for (j = 0; j < i; j++)
+            if (strcmp(ht_map[src_idx[i]].name, ht_map[src_idx[j]].name) == 0) {
+                PyErr_Format(shmht_error, "table(%s) is given twice", ht_map[src_idx[i]].name);
+                goto bad_sources;
+            }
+        if ((ht_map[src_idx[i]].ht->flags | ht_map[idx].ht->flags) & (HT_NAMESPACES | HT_MULTI)) {
+            PyErr_Format(shmht_error, "tables with namespaces or MULTI cannot be merged");
+            goto bad_sources;
+        }
+    }
+    Py_DECREF(sources);
+
+    if (!check_writable(idx, True)) {
+        free(src_idx), free(srcs);
+        return NULL;
+    }
+
+    // the destination goes last; all of them are locked in a fixed
+    // order, by name, so two processes merging each other's tables the
+    // other way around cannot deadlock
+    src_idx[n_srcs] = idx;
+    Py_ssize_t *order = ALLOC(Py_ssize_t, n_srcs + 1);
+    if (order == NULL) {
+        free(src_idx), free(srcs);
+        return PyErr_NoMemory();
+    }
+    for (i = 0; i <= n_srcs; i++) {
+        for (j = i; j > 0 && strcmp(ht_map[src_idx[order[j - 1]]].name, ht_map[src_idx[i]].name) > 0; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+
+    for (i = 0; i <= n_srcs; i++) {
+        srcs[order[i]] = lock_table(src_idx[order[i]]);
+        if (srcs[order[i]] == NULL)
+            break;
+    }
+    if (i <= n_srcs) {
+        while (i-- > 0)
+            unlock_table(src_idx[order[i]], srcs[order[i]]);
+        free(src_idx), free(srcs), free(order);
+        return NULL;
+    }
+
+    for (i = 0; i <= n_srcs; i++)
+        ht_map[src_idx[i]].busy++;
+    Py_BEGIN_ALLOW_THREADS
+    changed = ht_merge(srcs[n_srcs], srcs, n_srcs, mode, n_threads);
+    Py_END_ALLOW_THREADS
+    for (i = n_srcs + 1; i-- > 0; ) {
+        ht_map[src_idx[order[i]]].busy--;
+        unlock_table(src_idx[order[i]], srcs[order[i]]);
+    }
+    free(src_idx), free(srcs), free(order);
+
+    if (changed < 0 && errno == EINVAL) {
+        PyErr_Format(shmht_error, "merge into %s failed: a value is not an integer", ht_map[idx].name);
+        return NULL;
+    }
+    if (changed < 0 && errno == ERANGE) {
+        PyErr_Format(shmht_error, "merge into %s failed: a sum is out of range", ht_map[idx].name);
+        return NULL;
+    }
+    if (changed < 0) {
+        PyErr_Format(shmht_error, "merge into %s failed: [%d] %s", ht_map[idx].name, errno, strerror(errno));
+        return NULL;
+    }
+    return PyInt_FromLong(changed);
+
+bad_sources:
+    Py_DECREF(sources);
+    free(src_idx), free(srcs);
+    return NULL;
+}
+
+static PyObject * shmht_add(PyObject *self, PyObject *args)
+{
+    int idx, key_size, value_size = 0;
+    const char *key, *value = "";
+    if (!PyArg_ParseTuple(args, "is#|s#:shmht.add", &idx, &key, &key_size, &value, &value_size))
+        return NULL;
+
+    int ns = ident_ns(idx);
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_writable(idx, True))
+        return NULL;
+
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL)
+        return NULL;
+
+    int result;
+    if (ht->flags & HT_MULTI) {
+        errno = 0;
+        result = ht_multi_add(ht, key, key_size, value, value_size);
+    }
+    else
+        result = entry_set(ht, ns, key, key_size, value, value_size);
+
+    unlock_table(idx, ht);
+
+    if (result == False) {
+        set_insert_error(key);
+        return NULL;
+    }
+    Py_RETURN_TRUE;
+}
+
+static PyObject * shmht_count(PyObject *self, PyObject *args)
+{
+    int idx, key_size;
+    const char *key;
+    if (!PyArg_ParseTuple(args, "is#:shmht.count", &idx, &key, &key_size))
+        return NULL;
+
+    int ns = ident_ns(idx);
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL)
+        return NULL;
+    long n;
+    if (ht->flags & HT_MULTI)
+        n = ht_multi_count(ht, key, key_size);
+    else
+        n = entry_get(ht, ns, key, key_size) != NULL;
+    unlock_table(idx, ht);
+
+    return PyInt_FromLong(n);
+}
+
+/*
+ * Values start .. start + count - 1 of a key, as far as there are any;
+ * count < 0 for all the rest.  Only the values asked for are read, so a
+ * caller can walk a long chain a few at a time.
+ */
+static PyObject * shmht_values(PyObject *self, PyObject *args)
+{
+    int idx, key_size;
+    const char *key;
+    Py_ssize_t start = 0, count = -1, i, n;
+    if (!PyArg_ParseTuple(args, "is#|nn:shmht.values", &idx, &key, &key_size, &start, &count))
+        return NULL;
+
+    int ns = ident_ns(idx);
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+    if (start < 0) {
+        PyErr_Format(shmht_error, "values start at 0, not at (%ld)", (long)start);
+        return NULL;
+    }
+
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL)
+        return NULL;
+
+    BOOL multi = ht->flags & HT_MULTI;
+    n = multi ? ht_multi_count(ht, key, key_size) : entry_get(ht, ns, key, key_size) != NULL;
+    if (start > n)
+        start = n;
+    if (count >= 0 && start + count < n)
+        n = start + count;
+
+    PyObject *values = PyList_New(n - start);
+    for (i = start; values != NULL && i < n; i++) {
+        ht_str *found = multi ? ht_multi_get(ht, key, key_size, i) : entry_get(ht, ns, key, key_size);
+        PyObject *value = found != NULL ? PyString_FromStringAndSize(found->str, found->size) : PyString_FromString("");
+        if (value == NULL) {
+            Py_CLEAR(values);
+            break;
+        }
+        PyList_SET_ITEM(values, i - start, value);
+    }
+    unlock_table(idx, ht);
+    return values;
+}
+
+static PyObject * shmht_discard(PyObject *self, PyObject *args)
+{
+    int idx, key_size, value_size;
+    const char *key, *value;
+    if (!PyArg_ParseTuple(args, "is#s#:shmht.discard", &idx, &key, &key_size, &value, &value_size))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+    if (!(ht_map[idx].ht->flags & HT_MULTI)) {
+        PyErr_Format(shmht_error, "table(%s) was created without MULTI", ht_map[idx].name);
+        return NULL;
+    }
+
+    if (!check_writable(idx, True))
+        return NULL;
+
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL)
+        return NULL;
+    int result = ht_multi_discard(ht, key, key_size, value, value_size);
+    unlock_table(idx, ht);
+
+    if (result == False)
+        Py_RETURN_FALSE;
+    Py_RETURN_TRUE;
+}
+
+/*
+ * Integer keys and values go in as their 8 bytes in native order, which
+ * is the key of an INTKEY table; other tables take them as 8-byte strings.
+ */
+static PyObject * shmht_igetval(PyObject *self, PyObject *args)
+{
+    int idx, as_int = 0;
+    unsigned long long key;
+    PyObject *return_value;
+
+    if (!PyArg_ParseTuple(args, "iK|i:shmht.igetval", &idx, &key, &as_int))
+        return NULL;
+
+    int ns = ident_ns(idx);
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL)
+        return NULL;
+
+    ht_str *value = entry_access(idx, ht, ns, (const char *)&key, sizeof(key));
+    if (value == NULL) {
+        unlock_table(idx, ht);
+        Py_RETURN_NONE;
+    }
+    if (as_int) {
+        unsigned long long n = 0;
+        if (value->size != sizeof(n)) {
+            unlock_table(idx, ht);
+            PyErr_Format(shmht_error, "the value of key(%llu) is not an integer", key);
+            return NULL;
+        }
+        memcpy(&n, value->str, sizeof(n));
+        return_value = PyLong_FromUnsignedLongLong(n);
+    }
+    else
+        return_value = PyString_FromStringAndSize(value->str, value->size);
+    unlock_table(idx, ht);
+    return return_value;
+}
+
+static PyObject * shmht_isetval(PyObject *self, PyObject *args)
+{
+    int idx;
+    unsigned long long key, n;
+    PyObject *obj;
+    char *value;
+    Py_ssize_t value_size;
+
+    if (!PyArg_ParseTuple(args, "iKO:shmht.isetval", &idx, &key, &obj))
+        return NULL;
+
+    int ns = ident_ns(idx);
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (PyInt_Check(obj) || PyLong_Check(obj)) {
+        n = PyInt_Check(obj) ? (unsigned long long)PyInt_AsLong(obj) : PyLong_AsUnsignedLongLongMask(obj);
+        if (n == (unsigned long long)-1 && PyErr_Occurred())
+            return NULL;
+        value = (char *)&n;
+        value_size = sizeof(n);
+    }
+    else if (PyString_AsStringAndSize(obj, &value, &value_size) != 0)
+        return NULL;
+
+    if (!check_writable(idx, True))
+        return NULL;
+
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL)
+        return NULL;
+
+    int result = entry_set(ht, ns, (const char *)&key, sizeof(key), value, value_size);
+
+    unlock_table(idx, ht);
+
+    if (result == False) {
+        PyErr_Format(shmht_error, "insert failed for key(%llu)", key);
+        return NULL;
+    }
+    Py_RETURN_TRUE;
+}
+
+static PyObject * shmht_iremove(PyObject *self, PyObject *args)
+{
+    int idx;
+    unsigned long long key;
+    if (!PyArg_ParseTuple(args, "iK:shmht.iremove", &idx, &key))
+        return NULL;
+
+    int ns = ident_ns(idx);
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_writable(idx, True))
+        return NULL;
+
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL)
+        return NULL;
+
+    int result = entry_remove(ht, ns, (const char *)&key, sizeof(key));
+
+    unlock_table(idx, ht);
+
+    if (result == False)
+        Py_RETURN_FALSE;
+    Py_RETURN_TRUE;
+}
+
+static PyObject * shmht_demote(PyObject *self, PyObject *args)
+{
+    int idx;
+    Py_ssize_t idle_seconds, max_bytes = 0;
+    long moved;
+
+    if (!PyArg_ParseTuple(args, "in|n:shmht.demote", &idx, &idle_seconds, &max_bytes))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_writable(idx, True))
+        return NULL;
+    if (!(ht_map[idx].ht->flags & HT_TIERED)) {
+        PyErr_Format(shmht_error, "table(%s) is not TIERED", ht_map[idx].name);
+        return NULL;
+    }
+    if (idle_seconds < 0 || max_bytes < 0) {
+        PyErr_Format(shmht_error, "invalid idle time (%ld) or byte limit (%ld)", (long)idle_seconds, (long)max_bytes);
+        return NULL;
+    }
+
+    size_t now = time(NULL), cutoff = (size_t)idle_seconds < now ? now - idle_seconds : 0;
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL)
+        return NULL;
+    ht_map[idx].busy++;
+    Py_BEGIN_ALLOW_THREADS
+    moved = ht_tier_demote(ht, cutoff, max_bytes);
+    Py_END_ALLOW_THREADS
+    ht_map[idx].busy--;
+    unlock_table(idx, ht);
+
+    if (moved < 0 && errno == ENOSPC)
+        return PyInt_FromLong(0);   // nothing more fits; the caller sees tier_usage()
+    if (moved < 0) {
+        PyErr_Format(shmht_error, "demote failed: [%d] %s", errno, strerror(errno));
+        return NULL;
+    }
+    return PyInt_FromLong(moved);
+}
+
+static PyObject * shmht_tier_usage(PyObject *self, PyObject *args)
+{
+    int idx;
+
+    if (!PyArg_ParseTuple(args, "i:shmht.tier_usage", &idx))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    if (!check_published(idx))
+        return NULL;
+
+    // cold live is the memory the cold file saves: values no longer in the log
+    hashtable *ht = ht_map[idx].ht;
+    return Py_BuildValue("(nnnn)", (Py_ssize_t)ht->log_live, (Py_ssize_t)ht->cold_live,
+                         (Py_ssize_t)ht->cold_tail, (Py_ssize_t)ht->cold_size);
+}
+
+static PyObject * shmht_set_promote(PyObject *self, PyObject *args)
+{
+    int idx, promote;
+
+    if (!PyArg_ParseTuple(args, "ii:shmht.set_promote", &idx, &promote))
+        return NULL;
+
+    if (!valid_ident(&idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", idx);
+        return NULL;
+    }
+
+    int was = ht_map[idx].promote;
+    ht_map[idx].promote = promote != 0;
+    return PyBool_FromLong(was);
+}
+
+/*
+ * Slot handles, (slot, table_id, slot_epoch): while the table is the
+ * same one and has dropped no key since, the slot still holds the key
+ * it was found for, and reads and writes go straight to it.  A slot of
+ * -1 is a key that was not there; stale handles are looked up again,
+ * and the caller gets the fresh handle back with the result.
+ */
+typedef struct {
+    Py_ssize_t slot;
+    unsigned long long table_id, epoch;
+} slot_handle;
+
+static int slot_table(int *idx)
+{
+    if (!valid_ident(idx)) {
+        PyErr_Format(shmht_error, "invalid ht id: (%d)", *idx);
+        return False;
+    }
+    if (ht_map[*idx].ht->flags & (HT_NAMESPACES | HT_MULTI)) {
+        PyErr_Format(shmht_error, "slot handles work on tables without namespaces or MULTI");
+        return False;
+    }
+    return True;
+}
+
+static size_t slot_of(hashtable *ht, const slot_handle *handle)
+{
+    if (handle->slot < 0 || (size_t)handle->slot >= ht->capacity
+        || handle->table_id != ht->table_id || handle->epoch != ht->slot_epoch)
+        return ht->capacity;
+    return handle->slot;
+}
+
+static PyObject * slot_ref(hashtable *ht, size_t i)
+{
+    return Py_BuildValue("(nKK)", i == ht->capacity ? (Py_ssize_t)-1 : (Py_ssize_t)i,
+                         (unsigned long long)ht->table_id, (unsigned long long)ht->slot_epoch);
+}
+
+static PyObject * shmht_find(PyObject *self, PyObject *args)
+{
+    int idx, key_size;
+    const char *key;
+
+    if (!PyArg_ParseTuple(args, "is#:shmht.find", &idx, &key, &key_size))
+        return NULL;
+    if (!slot_table(&idx))
+        return NULL;
+
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL)
+        return NULL;
+    PyObject *ref = slot_ref(ht, ht_find(ht, key, key_size));
+    unlock_table(idx, ht);
+    return ref;
+}
+
+static PyObject * shmht_slot_get(PyObject *self, PyObject *args)
+{
+    int idx, key_size;
+    const char *key;
+    slot_handle handle;
+    ht_str *value = NULL;
+
+    if (!PyArg_ParseTuple(args, "is#(nKK):shmht.slot_get", &idx, &key, &key_size,
+                          &handle.slot, &handle.table_id, &handle.epoch))
+        return NULL;
+    if (!slot_table(&idx))
+        return NULL;
+
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL)
+        return NULL;
+
+    size_t i = slot_of(ht, &handle);
+    if (i == ht->capacity)
+        i = ht_find(ht, key, key_size);
+    if (i != ht->capacity) {
+        // a read through a writable handle of an HT_TIERED table is noted, as in entry_access
+        if ((ht->flags & HT_TIERED) && !ht_map[idx].readonly)
+            value = ht_slot_access(ht, i, ht_map[idx].promote);
+        else
+            value = ht_slot_value(ht, i);
+    }
+
+    // copy it while still locked: a compaction may move the value
+    PyObject *result;
+    if (value == NULL)
+        result = Py_BuildValue("(NO)", slot_ref(ht, i), Py_None);
+    else
+        result = Py_BuildValue("(Ns#)", slot_ref(ht, i), value->str, (int)value->size);
+    unlock_table(idx, ht);
+    return result;
+}
+
+static PyObject * shmht_slot_set(PyObject *self, PyObject *args)
+{
+    int idx, key_size, value_size, result;
+    const char *key, *value;
+    slot_handle handle;
+
+    if (!PyArg_ParseTuple(args, "is#s#(nKK):shmht.slot_set", &idx, &key, &key_size, &value, &value_size,
+                          &handle.slot, &handle.table_id, &handle.epoch))
+        return NULL;
+    if (!slot_table(&idx))
+        return NULL;
+
+    if (!check_writable(idx, True))
+        return NULL;
+
+    hashtable *ht = lock_table(idx);
+    if (ht == NULL)
+        return NULL;
+
+    errno = 0;
+    size_t i = slot_of(ht, &handle);
+    if ((ht->flags & HT_SET) && value_size > 0) {
+        errno = EINVAL;
+        result = False;
+    }
+    else if (i != ht->capacity)
+        result = ht_slot_set(ht, i, value, value_size);
+    else
+        result = ht_upsert(ht, key, key_size, value, value_size, &i);
+
+    PyObject *ref = result ? slot_ref(ht, i) : NULL;
+    unlock_table(idx, ht);
+
+    if (result == False) {
+        set_insert_error(key);
+        return NULL;
+    }
+    return ref;
+}
+
+/*
+ * Sketches are mapped like tables: one file, created and initialized
+ * under its flock, MAP_SHARED by every process that opens it.  They have
+ * a map of their own, since nothing that works on a table applies.
+ */
+struct sketchnode {
+    int fd;
+    char *name;
+    ht_sketch *sk;
+    int busy;       //merges using it without the GIL; it cannot be closed meanwhile
+};
+
+#define max_sketch_entries 256
+static struct sketchnode sketch_map[max_sketch_entries];
+
+static ht_sketch* valid_sketch(int id, int kind)
+{
+    if (id < 0 || id >= max_sketch_entries || sketch_map[id].sk == NULL) {
+        PyErr_Format(shmht_error, "invalid sketch id: (%d)", id);
+        return NULL;
+    }
+    if (kind && sketch_map[id].sk->kind != (unsigned)kind) {
+        PyErr_Format(shmht_error, "sketch(%s) is not a %s", sketch_map[id].name, kind == HT_SKETCH_HLL ? "HyperLogLog" : "count-min sketch");
+        return NULL;
+    }
+    return sketch_map[id].sk;
+}
+
+/*
+ * Attach the sketch of kind in name, or create it there.  Parameters of 0
+ * attach to whatever the file holds; others must match it unless
+ * force_init is given.  Returns the sketch id, or NULL with an error set.
+ */
+static PyObject * open_sketch(const char *name, int kind, size_t a, size_t b, int force_init)
+{
+    ht_sketch *sk = NULL;
+    size_t mem_size = 0;
+    int id;
+
+    for (id = 0; id < max_sketch_entries && sketch_map[id].sk != NULL; id++)
+        ;
+    if (id == max_sketch_entries) {
+        PyErr_Format(shmht_error, "exceeded max_sketch_entries(%d) in one process", max_sketch_entries);
+        return NULL;
+    }
+    if (a != 0 && ht_sketch_memory_size(kind, a, b) == 0) {
+        PyErr_Format(shmht_error, "invalid sketch parameters (%lu, %lu)", a, b);
+        return NULL;
+    }
+
+    int fd = open(name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        PyErr_Format(shmht_error, "open file(%s) failed: [%d] %s", name, errno, strerror(errno));
+        return NULL;
+    }
+
+    mylock(fd);
+
+    struct stat buf;
+    fstat(fd, &buf);
+
+    int init = True;
+    if (!force_init && buf.st_size >= sizeof(ht_sketch)) {
+        sk = mmap(NULL, sizeof(ht_sketch), PROT_READ, MAP_SHARED, fd, 0);
+        if (sk == MAP_FAILED) {
+            sk = NULL;
+            PyErr_Format(shmht_error, "mmap failed, map_size=sizeof(ht_sketch)=%lu: [%d] %s",
+                                        sizeof(ht_sketch), errno, strerror(errno));
+            goto open_failed;
+        }
+        if (ht_sketch_is_valid(sk) && buf.st_size >= sk->mem_size) {
+            if (sk->kind != (unsigned)kind || (a != 0 && !ht_sketch_matches(sk, kind, a, b))) {
+                PyErr_Format(shmht_error, "file(%s) holds a sketch of another kind or shape; specify force_init=1 to overwrite it", name);
+                goto open_failed;
+            }
+            mem_size = sk->mem_size;
+            init = False;
+        }
+        munmap(sk, sizeof(ht_sketch));
+        sk = NULL;
+    }
+
+    if (init) {
+        if (a == 0) {
+            PyErr_Format(shmht_error, "no sketch in file(%s); please specify its size to create one", name);
+            goto open_failed;
+        }
+        mem_size = ht_sketch_memory_size(kind, a, b);
+        if (ftruncate(fd, mem_size) == -1) {
+            PyErr_Format(shmht_error, "ftruncate failed: [%d] %s", errno, strerror(errno));
+            goto open_failed;
+        }
+    }
+
+    sk = mmap(NULL, mem_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (sk == MAP_FAILED) {
+        sk = NULL;
+        PyErr_Format(shmht_error, "mmap failed, mem_size=%lu: [%d] %s", mem_size, errno, strerror(errno));
+        goto open_failed;
+    }
+    if (init)
+        ht_sketch_init(sk, kind, a, b);
+
+    myunlock(fd);
+    sketch_map[id].fd   = fd;
+    sketch_map[id].name = strdup(name);
+    sketch_map[id].sk   = sk;
+    return PyInt_FromLong(id);
+
+open_failed:
+    if (sk != NULL)
+        munmap(sk, sizeof(ht_sketch));
+    myunlock(fd);
+    close(fd);
+    return NULL;
+}
+
+static PyObject * shmht_hll_open(PyObject *self, PyObject *args)
+{
+    const char *name;
+    Py_ssize_t precision = 0;
+    int force_init = 0;
+    if (!PyArg_ParseTuple(args, "s|ni:shmht.hll_open", &name, &precision, &force_init))
+        return NULL;
+    if (precision < 0) {
+        PyErr_Format(shmht_error, "invalid sketch parameters (%ld, 0)", (long)precision);
+        return NULL;
+    }
+    return open_sketch(name, HT_SKETCH_HLL, precision, 0, force_init);
+}
+
+static PyObject * shmht_cms_open(PyObject *self, PyObject *args)
+{
+    const char *name;
+    Py_ssize_t width = 0, depth = 0;
+    int force_init = 0;
+    if (!PyArg_ParseTuple(args, "s|nni:shmht.cms_open", &name, &width, &depth, &force_init))
+        return NULL;
+    if (width < 0 || depth < 0) {
+        PyErr_Format(shmht_error, "invalid sketch parameters (%ld, %ld)", (long)width, (long)depth);
+        return NULL;
+    }
+    return open_sketch(name, HT_SKETCH_CMS, width, depth, force_init);
+}
+
+static PyObject * shmht_sketch_close(PyObject *self, PyObject *args)
+{
+    int id;
+    if (!PyArg_ParseTuple(args, "i:shmht.sketch_close", &id))
+        return NULL;
+
+    ht_sketch *sk = valid_sketch(id, 0);
+    if (sk == NULL)
+        return NULL;
+    if (sketch_map[id].busy) {
+        PyErr_Format(shmht_error, "sketch(%s) is in use by another thread", sketch_map[id].name);
+        return NULL;
+    }
+
+    munmap(sk, sk->mem_size);
+    close(sketch_map[id].fd);
+    free(sketch_map[id].name);
+    memset(&sketch_map[id], 0, sizeof(struct sketchnode));
+
+    Py_RETURN_TRUE;
+}
+
+/*
+ * Call add on every key of keys, a string or a sequence of strings; no
+ * lock is taken, the sketch updates are atomic.  Returns how many keys
+ * were added, or -1 with an error set.
+ */
+static Py_ssize_t add_keys(ht_sketch *sk, PyObject *keys, size_t count,
+                           void (*add)(ht_sketch *sk, const char *key, u_int32 key_size, size_t count))
+{
+    char *key;
+    Py_ssize_t key_size, i, n;
+
+    if (PyString_Check(keys)) {
+        PyString_AsStringAndSize(keys, &key, &key_size);
+        add(sk, key, key_size, count);
+        return 1;
+    }
+    keys = PySequence_Fast(keys, "expected a key or a sequence of keys");
+    if (keys == NULL)
+        return -1;
+    n = PySequence_Fast_GET_SIZE(keys);
+    for (i = 0; i < n; i++) {
+        if (PyString_AsStringAndSize(PySequence_Fast_GET_ITEM(keys, i), &key, &key_size) != 0)
+            break;
+        add(sk, key, key_size, count);
+    }
+    Py_DECREF(keys);
+    return i < n ? -1 : n;
+}
+
+static void hll_add(ht_sketch *sk, const char *key, u_int32 key_size, size_t count)
+{
+    ht_hll_add(sk, key, key_size);
+}
+
+static PyObject * shmht_hll_add(PyObject *self, PyObject *args)
+{
+    int id;
+    PyObject *keys;
+    if (!PyArg_ParseTuple(args, "iO:shmht.hll_add", &id, &keys))
+        return NULL;
+
+    ht_sketch *sk = valid_sketch(id, HT_SKETCH_HLL);
+    if (sk == NULL)
+        return NULL;
+
+    Py_ssize_t n = add_keys(sk, keys, 1, hll_add);
+    return n < 0 ? NULL : PyInt_FromSsize_t(n);
+}
+
+static PyObject * shmht_hll_count(PyObject *self, PyObject *args)
+{
+    int id;
+    if (!PyArg_ParseTuple(args, "i:shmht.hll_count", &id))
+        return NULL;
+
+    ht_sketch *sk = valid_sketch(id, HT_SKETCH_HLL);
+    if (sk == NULL)
+        return NULL;
+
+    return PyFloat_FromDouble(ht_hll_count(sk));
+}
+
+static PyObject * shmht_cms_add(PyObject *self, PyObject *args)
+{
+    int id;
+    PyObject *keys;
+    Py_ssize_t count = 1;
+    if (!PyArg_ParseTuple(args, "iO|n:shmht.cms_add", &id, &keys, &count))
+        return NULL;
+
+    ht_sketch *sk = valid_sketch(id, HT_SKETCH_CMS);
+    if (sk == NULL)
+        return NULL;
+    if (count < 0) {
+        PyErr_Format(shmht_error, "a count-min sketch only counts up, not by (%ld)", (long)count);
+        return NULL;
+    }
+
+    Py_ssize_t n = add_keys(sk, keys, count, ht_cms_add);
+    return n < 0 ? NULL : PyInt_FromSsize_t(n);
+}
+
+static PyObject * shmht_cms_estimate(PyObject *self, PyObject *args)
+{
+    int id;
+    PyObject *keys, *counts;
+    char *key;
+    Py_ssize_t key_size, i, n;
+    if (!PyArg_ParseTuple(args, "iO:shmht.cms_estimate", &id, &keys))
+        return NULL;
+
+    ht_sketch *sk = valid_sketch(id, HT_SKETCH_CMS);
+    if (sk == NULL)
+        return NULL;
+
+    if (PyString_Check(keys)) {
+        PyString_AsStringAndSize(keys, &key, &key_size);
+        return PyLong_FromSize_t(ht_cms_estimate(sk, key, key_size));
+    }
+    keys = PySequence_Fast(keys, "expected a key or a sequence of keys");
+    if (keys == NULL)
+        return NULL;
+    n = PySequence_Fast_GET_SIZE(keys);
+    counts = PyList_New(n);
+    if (counts == NULL) {
+        Py_DECREF(keys);
+        return NULL;
+    }
+    for (i = 0; i < n; i++) {
+        PyObject *count;
+        if (PyString_AsStringAndSize(PySequence_Fast_GET_ITEM(keys, i), &key, &key_size) != 0)
+            break;
+        if ((count = PyLong_FromSize_t(ht_cms_estimate(sk, key, key_size))) == NULL)
+            break;
+        PyList_SET_ITEM(counts, i, count);
+    }
+    Py_DECREF(keys);
+    if (i < n) {
+        Py_DECREF(counts);
+        return NULL;
+    }
+    return counts;
+}
+
+static PyObject * shmht_sketch_merge(PyObject *self, PyObject *args)
+{
+    int id, src_id;
+    if (!PyArg_ParseTuple(args, "ii:shmht.sketch_merge", &id, &src_id))
+        return NULL;
+
+    ht_sketch *sk = valid_sketch(id, 0), *src = valid_sketch(src_id, 0);
+    if (sk == NULL || src == NULL)
+        return NULL;
+    if (sk == src) {
+        PyErr_Format(shmht_error, "cannot merge sketch(%s) into itself", sketch_map[id].name);
+        return NULL;
+    }
+
+    int merged;
+    sketch_map[id].busy++, sketch_map[src_id].busy++;
+    Py_BEGIN_ALLOW_THREADS
+    merged = ht_sketch_merge(sk, src);
+    Py_END_ALLOW_THREADS
+    sketch_map[id].busy--, sketch_map[src_id].busy--;
+    if (!merged) {
+        PyErr_Format(shmht_error, "sketch(%s) and sketch(%s) differ in kind or shape", sketch_map[id].name, sketch_map[src_id].name);
+        return NULL;
+    }
+    Py_RETURN_TRUE;
+}
+
+static PyObject * shmht_sketch_clear(PyObject *self, PyObject *args)
+{
+    int id;
+    if (!PyArg_ParseTuple(args, "i:shmht.sketch_clear", &id))
+        return NULL;
+
+    ht_sketch *sk = valid_sketch(id, 0);
+    if (sk == NULL)
+        return NULL;
+
+    // updates racing with a clear may or may not survive it
+    mylock(sketch_map[id].fd);
+    ht_sketch_clear(sk);
+    myunlock(sketch_map[id].fd);
+    Py_RETURN_TRUE;
+}
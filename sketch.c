@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "sketch.h"
+
+static const unsigned sketch_magic = 0x5CE7;
+
+#define sketch_header_size  64      //the data starts on a cache line of its own
+#define sketch_seed         0x5e7c4ULL
+#define hll_min_precision   4
+#define hll_max_precision   18
+#define cms_max_depth       16
+
+#define sketch_data(sk) ((char *)(sk) + (sk)->data_offset)
+
+static inline size_t sketch_mix64(size_t h) {
+    h ^= h >> 30, h *= 0xbf58476d1ce4e5b9ULL;  //splitmix64 finalizer
+    h ^= h >> 27, h *= 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+size_t ht_sketch_memory_size(int kind, size_t a, size_t b) {
+    if (kind == HT_SKETCH_HLL && a >= hll_min_precision && a <= hll_max_precision)
+        return sketch_header_size + ((size_t)1 << a);
+    if (kind == HT_SKETCH_CMS && a > 0 && b > 0 && b <= cms_max_depth && a <= ((size_t)1 << 40) / b)
+        return sketch_header_size + sizeof(size_t) * a * b;
+    errno = EINVAL;
+    return 0;
+}
+
+void ht_sketch_init(ht_sketch *sk, int kind, size_t a, size_t b) {
+    bzero(sk, sketch_header_size);
+    sk->kind        = kind;
+    sk->precision   = kind == HT_SKETCH_HLL ? a : 0;
+    sk->width       = kind == HT_SKETCH_CMS ? a : 0;
+    sk->depth       = kind == HT_SKETCH_CMS ? b : 0;
+    sk->data_offset = sketch_header_size;
+    sk->mem_size    = ht_sketch_memory_size(kind, a, b);
+    bzero(sketch_data(sk), sk->mem_size - sketch_header_size);
+    __atomic_store_n(&sk->magic, sketch_magic, __ATOMIC_RELEASE);
+}
+
+int ht_sketch_is_valid(ht_sketch *sk) {
+    return sk->magic == sketch_magic && (sk->kind == HT_SKETCH_HLL || sk->kind == HT_SKETCH_CMS)
+        && sk->mem_size == ht_sketch_memory_size(sk->kind, sk->kind == HT_SKETCH_HLL ? sk->precision : sk->width, sk->depth);
+}
+
+int ht_sketch_matches(ht_sketch *sk, int kind, size_t a, size_t b) {
+    if (sk->kind != (unsigned)kind)
+        return False;
+    if (kind == HT_SKETCH_HLL)
+        return sk->precision == a;
+    return sk->width == a && sk->depth == b;
+}
+
+void ht_sketch_clear(ht_sketch *sk) {
+    bzero(sketch_data(sk), sk->mem_size - sk->data_offset);
+    sk->total = 0;
+}
+
+void ht_hll_add(ht_sketch *sk, const char *key, u_int32 key_size) {
+    unsigned char *reg = (unsigned char *)sketch_data(sk);
+    size_t h = ht_frozen_hash(sketch_seed, key, key_size);
+    size_t i = h >> (64 - sk->precision), rest = h << sk->precision;
+    unsigned char rank = rest ? __builtin_clzll(rest) + 1 : 64 - sk->precision + 1;
+
+    //a register only grows; most adds find it high enough and write nothing
+    unsigned char old = __atomic_load_n(&reg[i], __ATOMIC_RELAXED);
+    while (rank > old && !__atomic_compare_exchange_n(&reg[i], &old, rank, True, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+double ht_hll_count(ht_sketch *sk) {
+    const unsigned char *reg = (const unsigned char *)sketch_data(sk);
+    size_t i, m = (size_t)1 << sk->precision, zeros = 0;
+    double sum = 0;
+
+    for (i = 0; i < m; i++) {
+        unsigned char r = __atomic_load_n(&reg[i], __ATOMIC_RELAXED);
+        sum += ldexp(1.0, -(int)r);
+        if (r == 0)
+            zeros++;
+    }
+    double alpha = m == 16 ? 0.673 : m == 32 ? 0.697 : m == 64 ? 0.709 : 0.7213 / (1 + 1.079 / m);
+    double estimate = alpha * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0)
+        estimate = m * log((double)m / zeros);  //linear counting for small sets
+    return estimate;
+}
+
+//counter of key in row r: double hashing over the rows
+static inline size_t cms_column(ht_sketch *sk, size_t h1, size_t h2, size_t r) {
+    return r * sk->width + (h1 + r * h2) % sk->width;
+}
+
+void ht_cms_add(ht_sketch *sk, const char *key, u_int32 key_size, size_t count) {
+    size_t *counters = (size_t *)sketch_data(sk);
+    size_t h1 = ht_frozen_hash(sketch_seed, key, key_size), h2 = sketch_mix64(h1) | 1, r;
+    for (r = 0; r < sk->depth; r++)
+        __sync_fetch_and_add(&counters[cms_column(sk, h1, h2, r)], count);
+    __sync_fetch_and_add(&sk->total, count);
+}
+
+size_t ht_cms_estimate(ht_sketch *sk, const char *key, u_int32 key_size) {
+    const size_t *counters = (const size_t *)sketch_data(sk);
+    size_t h1 = ht_frozen_hash(sketch_seed, key, key_size), h2 = sketch_mix64(h1) | 1, r;
+    size_t estimate = (size_t)-1;
+    for (r = 0; r < sk->depth; r++) {
+        size_t c = __atomic_load_n(&counters[cms_column(sk, h1, h2, r)], __ATOMIC_RELAXED);
+        if (c < estimate)
+            estimate = c;
+    }
+    return estimate;
+}
+
+int ht_sketch_merge(ht_sketch *dst, ht_sketch *src) {
+    size_t i;
+
+    if (!ht_sketch_matches(dst, src->kind, src->kind == HT_SKETCH_HLL ? src->precision : src->width, src->depth)) {
+        errno = EINVAL;
+        return False;
+    }
+    if (src->kind == HT_SKETCH_HLL) {
+        unsigned char *d = (unsigned char *)sketch_data(dst), *s = (unsigned char *)sketch_data(src);
+        for (i = 0; i < ((size_t)1 << src->precision); i++) {
+            unsigned char rank = __atomic_load_n(&s[i], __ATOMIC_RELAXED), old = __atomic_load_n(&d[i], __ATOMIC_RELAXED);
+            while (rank > old && !__atomic_compare_exchange_n(&d[i], &old, rank, True, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                ;
+        }
+    }
+    else {
+        size_t *d = (size_t *)sketch_data(dst), *s = (size_t *)sketch_data(src);
+        for (i = 0; i < src->width * src->depth; i++) {
+            size_t c = __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+            if (c)
+                __sync_fetch_and_add(&d[i], c);
+        }
+        __sync_fetch_and_add(&dst->total, __atomic_load_n(&src->total, __ATOMIC_RELAXED));
+    }
+    return True;
+}
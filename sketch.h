@@ -0,0 +1,53 @@
+#ifndef __HT_SKETCH__
+#define __HT_SKETCH__
+
+#include "hashtable.h"
+
+/*
+ * Probabilistic sketches in a shared mapping, next to the tables.  Every
+ * update is a few atomic instructions on the counters, so any number of
+ * processes and threads update one sketch without a lock; only opening
+ * (and initializing) one takes the file lock.
+ *
+ * HT_SKETCH_HLL: HyperLogLog cardinality estimate, 2^precision one-byte
+ * registers (precision 4..18; 14 is 16k registers and about 0.8% error).
+ * HT_SKETCH_CMS: count-min frequency estimate, depth rows of width
+ * counters; an estimate is never low, and high by at most 2.7 / width of
+ * the total count with probability 1 - e^-depth.
+ */
+#define HT_SKETCH_HLL   1
+#define HT_SKETCH_CMS   2
+
+typedef struct _ht_sketch {
+    unsigned magic, kind;
+    size_t precision;       //HLL
+    size_t width, depth;    //CMS
+    size_t total;           //CMS: sum of the counts added
+    size_t data_offset, mem_size;
+} ht_sketch;
+
+/*
+ * Bytes to map for a sketch of kind with parameters a, b (HLL:
+ * precision; CMS: width, depth), or 0 with errno EINVAL if they are out
+ * of range.
+ */
+size_t ht_sketch_memory_size(int kind, size_t a, size_t b);
+void ht_sketch_init(ht_sketch *sk, int kind, size_t a, size_t b);
+int ht_sketch_is_valid(ht_sketch *sk);
+int ht_sketch_matches(ht_sketch *sk, int kind, size_t a, size_t b);
+void ht_sketch_clear(ht_sketch *sk);
+
+void ht_hll_add(ht_sketch *sk, const char *key, u_int32 key_size);
+double ht_hll_count(ht_sketch *sk);
+
+void ht_cms_add(ht_sketch *sk, const char *key, u_int32 key_size, size_t count);
+size_t ht_cms_estimate(ht_sketch *sk, const char *key, u_int32 key_size);
+
+/*
+ * Fold src into dst, which may be in use: the register maximum of two
+ * HLLs, the counter sum of two CMSs.  False with errno EINVAL unless both
+ * have the same kind and parameters.
+ */
+int ht_sketch_merge(ht_sketch *dst, ht_sketch *src);
+
+#endif
@@ -0,0 +1,537 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+
+//blocks are closed once their payload reaches this size
+#define snap_block_target   (1024 * 1024)
+#define snap_record_header  (2 * sizeof(u_int32) + sizeof(unsigned long long))
+#define snap_record_max     (snap_record_header + 2048)
+#define snap_max_threads    64
+
+static unsigned crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void) {
+    unsigned i, j;
+    for (i = 0; i < 256; i++) {
+        unsigned c = i;
+        for (j = 0; j < 8; j++)
+            c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+unsigned ht_crc32(unsigned crc, const void *buf, size_t size) {
+    const unsigned char *p = (const unsigned char *)buf;
+    pthread_once(&crc_once, crc_init);
+    crc = ~crc;
+    while (size--)
+        crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static unsigned snap_header_crc(snap_header *header) {
+    snap_header h = *header;
+    h.header_crc = 0;
+    return ht_crc32(0, &h, sizeof(h));
+}
+
+static int snap_write_block(snap_writer *w) {
+    snap_block block;
+    block.payload_size = w->used;
+    block.n_records    = w->n_records;
+    block.crc          = ht_crc32(0, w->payload, w->used);
+    block.kind         = w->kind;
+    if (fwrite(&block, sizeof(block), 1, w->fp) != 1)
+        return False;
+    if (w->used > 0 && fwrite(w->payload, w->used, 1, w->fp) != 1)
+        return False;
+    w->header.n_blocks++;
+    w->used = 0, w->n_records = 0;
+    return True;
+}
+
+static void snap_writer_abort(snap_writer *w) {
+    int saved_errno = errno;
+    if (w->fp != NULL)
+        fclose(w->fp);
+    unlink(w->tmp_path);
+    free(w->payload);
+    w->fp = NULL, w->payload = NULL;
+    errno = saved_errno ? saved_errno : EIO;
+}
+
+int snap_writer_open(snap_writer *w, const char *path, hashtable *ht, size_t seq, size_t since_seq) {
+    bzero(w, sizeof(snap_writer));
+    if (snprintf(w->tmp_path, sizeof(w->tmp_path), "%s.tmp", path) >= (int)sizeof(w->tmp_path)) {
+        errno = ENAMETOOLONG;
+        return False;
+    }
+    w->path = path;
+
+    memcpy(w->header.magic, snap_magic, sizeof(w->header.magic));
+    w->header.version   = snap_version;
+    w->header.capacity  = ht->capacity;
+    w->header.table_id  = ht->table_id;
+    w->header.seq       = seq;
+    w->header.since_seq = since_seq;
+
+    w->room = snap_block_target + snap_record_max;
+    w->payload = ALLOC(char, w->room);
+    w->fp = fopen(w->tmp_path, "wb");
+    //placeholder, rewritten once the counts are known
+    if (w->payload == NULL || w->fp == NULL || fwrite(&w->header, sizeof(w->header), 1, w->fp) != 1) {
+        snap_writer_abort(w);
+        return False;
+    }
+    return True;
+}
+
+//blocks hold one kind of record; close the current one when switching
+static int snap_writer_kind(snap_writer *w, u_int32 kind) {
+    if (w->kind != kind && w->n_records > 0 && !snap_write_block(w)) {
+        snap_writer_abort(w);
+        return False;
+    }
+    w->kind = kind;
+    return True;
+}
+
+static int snap_writer_next(snap_writer *w) {
+    w->n_records++;
+    if (w->used >= snap_block_target && !snap_write_block(w)) {
+        snap_writer_abort(w);
+        return False;
+    }
+    return True;
+}
+
+/*
+ * A record of a log table can be larger than the rest of the block; it
+ * gets a block of its own, and the payload grows to hold it.
+ */
+static int snap_writer_room(snap_writer *w, size_t len) {
+    if (w->used + len <= w->room)
+        return True;
+    if (w->n_records > 0 && !snap_write_block(w)) {
+        snap_writer_abort(w);
+        return False;
+    }
+    if (len > w->room) {
+        char *payload = realloc(w->payload, len);
+        if (payload == NULL) {
+            errno = ENOMEM;
+            snap_writer_abort(w);
+            return False;
+        }
+        w->payload = payload, w->room = len;
+    }
+    return True;
+}
+
+int snap_writer_add(snap_writer *w, size_t slot, int flag, const ht_str *key, const ht_str *value) {
+    u_int32 key_size = 0, value_size = snap_tombstone;
+    unsigned long long slot64 = slot;
+    char *p;
+
+    if (!snap_writer_kind(w, snap_entries))
+        return False;
+    if (flag == HT_SLOT_USED && !snap_writer_room(w, snap_record_header + key->size + value->size))
+        return False;
+    p = w->payload + w->used;
+    if (flag == HT_SLOT_USED) {
+        key_size   = key->size;
+        value_size = value->size;
+        w->header.count++;
+    }
+    memcpy(p, &key_size, sizeof(u_int32));
+    memcpy(p + sizeof(u_int32), &value_size, sizeof(u_int32));
+    memcpy(p + 2 * sizeof(u_int32), &slot64, sizeof(slot64));
+    w->used += snap_record_header;
+    if (flag == HT_SLOT_USED) {
+        memcpy(w->payload + w->used, key->str, key_size);
+        memcpy(w->payload + w->used + key_size, value->str, value_size);
+        w->used += key_size + value_size;
+    }
+    return snap_writer_next(w);
+}
+
+int snap_writer_add_segment(snap_writer *w, size_t seg) {
+    unsigned long long seg64 = seg;
+
+    if (!snap_writer_kind(w, snap_segments))
+        return False;
+    memcpy(w->payload + w->used, &seg64, sizeof(seg64));
+    w->used += sizeof(seg64);
+    return snap_writer_next(w);
+}
+
+//flush the last block, fill in the header and move the file into place
+int snap_writer_close(snap_writer *w) {
+    FILE *fp = w->fp;
+
+    if (w->n_records > 0 && !snap_write_block(w))
+        goto close_failed;
+
+    w->header.header_crc = snap_header_crc(&w->header);
+    if (fseek(fp, 0, SEEK_SET) != 0 || fwrite(&w->header, sizeof(w->header), 1, fp) != 1)
+        goto close_failed;
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+        goto close_failed;
+    w->fp = NULL;
+    if (fclose(fp) != 0 || rename(w->tmp_path, w->path) != 0)
+        goto close_failed;
+
+    free(w->payload);
+    w->payload = NULL;
+    return True;
+
+close_failed:
+    snap_writer_abort(w);
+    return False;
+}
+
+static int snap_read_header(const char *path, snap_header *header) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return False;
+    ssize_t n = read(fd, header, sizeof(snap_header));
+    close(fd);
+    if (n != sizeof(snap_header)
+            || memcmp(header->magic, snap_magic, sizeof(header->magic)) != 0
+            || header->version != snap_version
+            || header->header_crc != snap_header_crc(header)) {
+        errno = EBADMSG;
+        return False;
+    }
+    return True;
+}
+
+long ht_snapshot(hashtable *ht, const char *path, const char *since) {
+    snap_writer w;
+    snap_header previous;
+    size_t seg, since_seq = 0;
+
+    //slot numbers of a frozen table mean nothing to an open-addressing one
+    if (ht->flags & HT_FROZEN) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    if (since != NULL) {
+        if (!snap_read_header(since, &previous))
+            return -1;
+        //a delta only makes sense against an earlier state of this very table
+        if (previous.table_id != ht->table_id || previous.capacity != ht->capacity
+                || previous.seq > ht->change_seq) {
+            errno = EINVAL;
+            return -1;
+        }
+        since_seq = previous.seq;
+    }
+
+    if (!snap_writer_open(&w, path, ht, ht->change_seq, since_seq))
+        return -1;
+
+    if (since != NULL) {
+        for (seg = 0; seg < ht_segment_count(ht); seg++) {
+            if (ht_segment_seq(ht, seg) > since_seq && !snap_writer_add_segment(&w, seg))
+                return -1;
+        }
+    }
+
+    for (seg = 0; seg < ht_segment_count(ht); seg++) {
+        size_t i, first = ht_segment_first_slot(seg), last = ht_segment_first_slot(seg + 1);
+        if (since != NULL && ht_segment_seq(ht, seg) <= since_seq)
+            continue;
+        if (last > ht->capacity)
+            last = ht->capacity;
+        for (i = first; i < last; i++) {
+            ht_str *key = NULL, *value = NULL;
+            int flag = ht_slot(ht, i, &key, &value);
+            if (flag != HT_SLOT_EMPTY && !snap_writer_add(&w, i, flag, key, value))
+                return -1;
+        }
+    }
+
+    if (!snap_writer_close(&w))
+        return -1;
+    return (long)w.header.count;
+}
+
+/*
+ * Point-in-time copy of the table as of ht_backup_begin().  The lock is
+ * only held to begin, to end, and to copy one segment at a time; writers
+ * keep going in between and preserve whatever they are about to change.
+ */
+long ht_backup(hashtable *ht, const char *path, void (*lock)(void *), void (*unlock)(void *), void *arg) {
+    snap_writer w;
+    char *buf = NULL;
+    size_t seg, n_slots, pos, seq;
+    ht_str *key, *value;
+    int ok, flag;
+
+    lock(arg);
+    ok = ht_backup_begin(ht);
+    seq = ht->change_seq;
+    unlock(arg);
+    if (!ok)
+        return -1;
+
+    ok = snap_writer_open(&w, path, ht, seq, 0);
+    if (ok) {
+        buf = ALLOC(char, ht_segment_buffer_size());
+        if (buf == NULL) {
+            errno = ENOMEM;
+            snap_writer_abort(&w);
+            ok = False;
+        }
+    }
+    for (seg = 0; ok && seg < ht_segment_count(ht); seg++) {
+        lock(arg);
+        n_slots = ht_backup_copy(ht, seg, buf);
+        unlock(arg);
+
+        pos = 0;
+        while (ok && (flag = ht_segment_next(buf, n_slots, &pos, &key, &value)) != HT_SLOT_EMPTY)
+            ok = snap_writer_add(&w, ht_segment_first_slot(seg) + pos - 1, flag, key, value);
+    }
+
+    int saved_errno = errno;
+    lock(arg);
+    ht_backup_end(ht);
+    unlock(arg);
+    free(buf);
+    errno = saved_errno;
+
+    if (!ok || !snap_writer_close(&w))
+        return -1;
+    return (long)w.header.count;
+}
+
+enum restore_mode {
+    restore_verify, restore_rehash, restore_place
+};
+
+struct restore_job {
+    hashtable *ht;
+    const char *base;
+    const size_t *block_offsets;
+    size_t n_blocks;
+    int mode;
+
+    size_t next_block;      //shared cursor, taken with atomic adds
+    size_t restored;
+    int error;
+};
+
+static int restore_block(struct restore_job *job, const snap_block *block, size_t *restored) {
+    const char *p = (const char *)(block + 1);
+    const char *end = p + block->payload_size;
+    u_int32 r;
+
+    if (job->mode == restore_verify)
+        return ht_crc32(0, p, block->payload_size) == block->crc ? 0 : EBADMSG;
+    if (block->kind != snap_entries)
+        return 0; //segment lists are applied before the entries
+
+    for (r = 0; r < block->n_records; r++) {
+        u_int32 key_size, value_size;
+        unsigned long long slot;
+        if ((size_t)(end - p) < snap_record_header)
+            return EBADMSG;
+        memcpy(&key_size, p, sizeof(u_int32));
+        memcpy(&value_size, p + sizeof(u_int32), sizeof(u_int32));
+        memcpy(&slot, p + 2 * sizeof(u_int32), sizeof(slot));
+        p += snap_record_header;
+
+        if (value_size == snap_tombstone) {
+            if (job->mode == restore_place && !ht_place(job->ht, slot, HT_SLOT_REMOVED, NULL, 0, NULL, 0))
+                return EBADMSG;
+            continue;
+        }
+        if ((size_t)(end - p) < (size_t)key_size + value_size)
+            return EBADMSG;
+        if (job->mode == restore_place) {
+            if (!ht_place(job->ht, slot, HT_SLOT_USED, p, key_size, p + key_size, value_size))
+                return EBADMSG;
+        }
+        else if (!ht_insert_unique(job->ht, p, key_size, p + key_size, value_size))
+            return ENOSPC;
+        p += key_size + value_size;
+        *restored += 1;
+    }
+    return 0;
+}
+
+static void * restore_worker(void *arg) {
+    struct restore_job *job = (struct restore_job *)arg;
+    size_t restored = 0;
+
+    while (!job->error) {
+        size_t b = __sync_fetch_and_add(&job->next_block, 1);
+        if (b >= job->n_blocks)
+            break;
+        int err = restore_block(job, (const snap_block *)(job->base + job->block_offsets[b]), &restored);
+        if (err)
+            __sync_bool_compare_and_swap(&job->error, 0, err);
+    }
+    __sync_fetch_and_add(&job->restored, restored);
+    return NULL;
+}
+
+static int restore_run(struct restore_job *job, int mode, int n_threads) {
+    pthread_t threads[snap_max_threads];
+    int i, started = 0;
+
+    job->mode       = mode;
+    job->next_block = 0;
+    job->restored   = 0;
+    job->error      = 0;
+    for (i = 1; i < n_threads; i++) {
+        if (pthread_create(&threads[started], NULL, restore_worker, job) != 0)
+            break; //the remaining threads pick up the slack
+        started++;
+    }
+    restore_worker(job);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    return job->error;
+}
+
+//empty the segments a delta replaces; returns the live entries dropped
+static size_t restore_clear_segments(struct restore_job *job) {
+    size_t b, dropped = 0;
+    for (b = 0; b < job->n_blocks; b++) {
+        const snap_block *block = (const snap_block *)(job->base + job->block_offsets[b]);
+        const char *p = (const char *)(block + 1);
+        u_int32 r;
+        if (block->kind != snap_segments)
+            continue;
+        for (r = 0; r < block->n_records && (r + 1) * sizeof(unsigned long long) <= block->payload_size; r++) {
+            unsigned long long seg;
+            memcpy(&seg, p + r * sizeof(seg), sizeof(seg));
+            if (seg < ht_segment_count(job->ht))
+                dropped += ht_clear_segment(job->ht, seg);
+        }
+    }
+    return dropped;
+}
+
+long ht_restore(hashtable *ht, const char *path, int n_threads) {
+    struct restore_job job;
+    struct stat st;
+    char *base = MAP_FAILED;
+    size_t *block_offsets = NULL;
+    size_t i, offset;
+    int fd, err = 0;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0) {
+        err = errno;
+        goto restore_done;
+    }
+    if ((size_t)st.st_size < sizeof(snap_header)) {
+        err = EBADMSG;
+        goto restore_done;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        err = errno;
+        goto restore_done;
+    }
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+    snap_header *header = (snap_header *)base;
+    if (memcmp(header->magic, snap_magic, sizeof(header->magic)) != 0
+            || header->version != snap_version
+            || header->header_crc != snap_header_crc(header)) {
+        err = EBADMSG;
+        goto restore_done;
+    }
+
+    BOOL delta = header->since_seq != 0;
+    BOOL same_layout = header->capacity == ht->capacity;
+    if (delta && (!same_layout || header->table_id != ht->source_id || header->since_seq != ht->source_seq)) {
+        err = EINVAL;
+        goto restore_done;
+    }
+    if (!delta && header->count > ht_max_size(ht)) {
+        err = ENOSPC;
+        goto restore_done;
+    }
+
+    block_offsets = ALLOC(size_t, header->n_blocks + 1);
+    if (block_offsets == NULL) {
+        err = ENOMEM;
+        goto restore_done;
+    }
+    offset = sizeof(snap_header);
+    for (i = 0; i < header->n_blocks; i++) {
+        if (offset + sizeof(snap_block) > (size_t)st.st_size) {
+            err = EBADMSG;
+            goto restore_done;
+        }
+        block_offsets[i] = offset;
+        offset += sizeof(snap_block) + ((snap_block *)(base + offset))->payload_size;
+    }
+    if (offset != (size_t)st.st_size) {
+        err = EBADMSG;
+        goto restore_done;
+    }
+
+    if (n_threads <= 0)
+        n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads > snap_max_threads)
+        n_threads = snap_max_threads;
+    if ((size_t)n_threads > header->n_blocks)
+        n_threads = header->n_blocks > 0 ? header->n_blocks : 1;
+
+    bzero(&job, sizeof(job));
+    job.ht            = ht;
+    job.base          = base;
+    job.block_offsets = block_offsets;
+    job.n_blocks      = header->n_blocks;
+
+    //verify every block before the table is touched, so a corrupt file
+    //leaves the current contents alone
+    if ((err = restore_run(&job, restore_verify, n_threads)) != 0)
+        goto restore_done;
+
+    size_t size = 0;
+    if (delta)
+        size = ht->size - restore_clear_segments(&job);
+    else
+        ht_clear(ht);
+    err = restore_run(&job, same_layout ? restore_place : restore_rehash, n_threads);
+    ht_set_size(ht, size + job.restored);
+    if (err == 0 && job.restored != header->count)
+        err = EBADMSG;
+
+    //only a slot-for-slot copy can take deltas later on
+    if (err == 0 && same_layout)
+        ht_set_source(ht, header->table_id, header->seq);
+    else
+        ht_set_source(ht, 0, 0);
+
+restore_done:
+    free(block_offsets);
+    if (base != MAP_FAILED)
+        munmap(base, st.st_size);
+    close(fd);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return (long)job.restored;
+}
@@ -0,0 +1,86 @@
+#ifndef __HT_SNAPSHOT__
+#define __HT_SNAPSHOT__
+
+#include <limits.h>
+
+#include "hashtable.h"
+
+/*
+ * Compact snapshot file: only live entries (and the tombstones that keep
+ * probe chains intact), length-prefixed and grouped into blocks that
+ * carry their own crc32, so a restore can verify and insert blocks in
+ * parallel.
+ *
+ *   snap_header
+ *   { snap_block, payload } * n_blocks
+ *
+ * entry blocks:    { u_int32 key_size, u_int32 value_size, u_int64 slot, key, value } * n_records
+ *                  a tombstone has key_size 0 and value_size snap_tombstone
+ * segment blocks:  { u_int64 segment } * n_records; only in deltas, ahead
+ *                  of the entries: the segments the delta replaces
+ *
+ * A full snapshot has since_seq 0.  A delta holds every segment of the
+ * table changed after the snapshot whose seq is since_seq, and applies
+ * only on top of exactly that state of the same table.
+ */
+
+#define snap_magic      "SHMHTSNP"
+#define snap_version    2
+#define snap_tombstone  0xFFFFFFFFU
+
+enum snap_block_kind {
+    snap_entries = 0, snap_segments = 1
+};
+
+typedef struct _snap_header {
+    char magic[8];
+    u_int32 version, header_crc;
+    unsigned long long capacity, count, n_blocks;
+    unsigned long long table_id, seq, since_seq;
+} snap_header;
+
+typedef struct _snap_block {
+    u_int32 payload_size, n_records, crc, kind;
+} snap_block;
+
+unsigned ht_crc32(unsigned crc, const void *buf, size_t size);
+
+//streams records into path.tmp, renamed to path by snap_writer_close()
+typedef struct _snap_writer {
+    FILE *fp;
+    const char *path;
+    char tmp_path[PATH_MAX];
+    char *payload;
+    size_t used, room;
+    u_int32 n_records, kind;
+    snap_header header;
+} snap_writer;
+
+int snap_writer_open(snap_writer *w, const char *path, hashtable *ht, size_t seq, size_t since_seq);
+int snap_writer_add(snap_writer *w, size_t slot, int flag, const ht_str *key, const ht_str *value);
+int snap_writer_add_segment(snap_writer *w, size_t seg);
+int snap_writer_close(snap_writer *w);
+
+/*
+ * All return the number of live entries written / restored, or -1 with
+ * errno set: EBADMSG for a corrupt file, ENOSPC if the table is too
+ * small, EINVAL if a delta does not follow what the table was last
+ * restored from (or `since` is a snapshot of another table).
+ * The caller holds the table lock.
+ *
+ * ht_snapshot() writes a full snapshot, or a delta against the snapshot
+ * file `since` when that is not NULL.  ht_restore() replaces the whole
+ * table from a full snapshot (slot for slot if the capacity matches,
+ * rehashed otherwise), or applies a delta on top of it.
+ */
+long ht_snapshot(hashtable *ht, const char *path, const char *since);
+long ht_restore(hashtable *ht, const char *path, int n_threads);
+
+/*
+ * Online backup of a table created with HT_BACKUP, as a full snapshot.
+ * Called WITHOUT the table lock; lock/unlock(arg) take it for short
+ * stretches only.
+ */
+long ht_backup(hashtable *ht, const char *path, void (*lock)(void *), void (*unlock)(void *), void *arg);
+
+#endif
@@ -0,0 +1,57 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+
+testfile = 'test_bloom.dat'
+snapfile = 'test_bloom.snap'
+loadfile = 'test_bloom_load.dat'
+
+safe_rm(testfile)
+safe_rm(snapfile)
+safe_rm(loadfile)
+
+ident = shmht.open( testfile, 20000, 1, shmht.BLOOM )
+
+with pycode.test('lookups') :
+    shmht.setvals( ident, [ ( str(x), str(x) + ' data' ) for x in range(10000) ] )
+    assert shmht.getval( ident, '1234' ) == '1234 data'
+    assert shmht.getvals( ident, [ 'no %d' % x for x in range(10000) ] ) == [ None ] * 10000
+    shmht.setval( ident, '1234', 'again' )
+    assert shmht.getval( ident, '1234' ) == 'again'
+
+with pycode.test('remove-compact') :
+    for x in range(5000):
+        assert shmht.remove( ident, str(x) )
+    assert not shmht.remove( ident, 'no such key' )
+    assert shmht.compact( ident ) == 0
+    assert shmht.getval( ident, '10' ) == None
+    assert shmht.getval( ident, '5010' ) == '5010 data'
+    shmht.setval( ident, '10', 'back' )
+    assert shmht.getval( ident, '10' ) == 'back'
+
+with pycode.test('restore') :
+    shmht.snapshot( ident, snapfile )
+    shmht.setval( ident, 'later', 'x' )
+    shmht.restore( ident, snapfile )
+    assert shmht.getval( ident, 'later' ) == None
+    assert shmht.getval( ident, '10' ) == 'back'
+    assert shmht.getval( ident, '9999' ) == '9999 data'
+
+with pycode.test('log-load') :
+    assert shmht.load( loadfile, [ ( str(x), 'v' ) for x in range(3000) ], 2, shmht.BLOOM | shmht.LOG ) == 3000
+    loaded = shmht.open( loadfile )
+    assert shmht.getval( loaded, '2999' ) == 'v'
+    assert shmht.getval( loaded, '3000' ) == None
+    shmht.remove( loaded, '1' )
+    shmht.compact( loaded )
+    assert shmht.getval( loaded, '1' ) == None
+    assert shmht.getval( loaded, '2' ) == 'v'
+    shmht.close( loaded )
+
+shmht.close( ident )
+safe_rm(testfile)
+safe_rm(snapfile)
+safe_rm(loadfile)
@@ -0,0 +1,85 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+
+testfile = 'test_digest.dat'
+otherfile = 'test_digest_other.dat'
+plainfile = 'test_digest_plain.dat'
+
+safe_rm(testfile)
+safe_rm(otherfile)
+safe_rm(plainfile)
+
+with pycode.test('follow') :
+    primary = shmht.open( testfile, 1000, 0, shmht.JOURNAL | shmht.DIGEST )
+    copy = shmht.open( otherfile, 2000, 0, shmht.DIGEST )
+    for x in range(300):
+        shmht.setval( primary, str(x), str(x)+' data' )
+    shmht.remove( primary, '7' )
+    shmht.follow( copy, primary )
+    assert shmht.digest( copy ) == shmht.digest( primary )
+    assert shmht.diff( copy, primary ) == [ ]
+    shmht.setval( copy, '8', 'changed' )
+    assert shmht.diff( copy, primary ) == [ '8' ]
+    shmht.close( primary )
+    shmht.close( copy )
+    safe_rm(testfile)
+    safe_rm(otherfile)
+
+with pycode.test('order') :
+    a = shmht.open( testfile, 1000, 0, shmht.DIGEST )
+    b = shmht.open( otherfile, 1000, 0, shmht.DIGEST )
+    empty = shmht.digest( a )
+    assert shmht.digest( b ) == empty
+    for x in range(500):
+        shmht.setval( a, str(x), str(x)+' data' )
+    for x in reversed(range(600)):
+        shmht.setval( b, str(x), 'old' )
+    for x in range(500, 600):
+        shmht.remove( b, str(x) )
+    assert shmht.digest( a ) != shmht.digest( b )
+    for x in range(500):
+        shmht.setval( b, str(x), str(x)+' data' )
+    assert shmht.digest( a ) == shmht.digest( b )
+    assert shmht.diff( a, b ) == [ ]
+    shmht.setval( a, 'extra', 'x' )
+    shmht.remove( a, '3' )
+    shmht.setval( a, '4', 'changed' )
+    assert sorted( shmht.diff( a, b ) ) == [ '3', '4', 'extra' ]
+    for x in range(500):
+        shmht.remove( a, str(x) )
+    shmht.remove( a, 'extra' )
+    assert shmht.digest( a ) == empty
+    shmht.close( a )
+    shmht.close( b )
+    safe_rm(testfile)
+    safe_rm(otherfile)
+
+with pycode.test('capacity') :
+    a = shmht.open( testfile, 1000, 0, shmht.DIGEST )
+    b = shmht.open( otherfile, 5000, 0, shmht.DIGEST )
+    for x in range(400):
+        shmht.setval( a, str(x), str(x)+' data' )
+        shmht.setval( b, str(x), str(x)+' data' )
+    assert shmht.digest( a ) == shmht.digest( b )
+    assert shmht.diff( b, a ) == [ ]
+    shmht.setval( b, '99', 'changed' )
+    assert shmht.diff( b, a ) == [ '99' ]
+    shmht.close( a )
+    shmht.close( b )
+    safe_rm(testfile)
+    safe_rm(otherfile)
+
+with pycode.test('not-enabled') :
+    plain = shmht.open( plainfile, 1000 )
+    try :
+        shmht.digest( plain )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    shmht.close( plain )
+    safe_rm(plainfile)
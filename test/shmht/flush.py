@@ -0,0 +1,80 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import time
+import struct
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+from ext_shmht.HashTable import HashTable
+
+testfile = 'test_flush.dat'
+chunk = 65536
+
+safe_rm(testfile)
+
+# dirty_count in the header of the table file: magic, then ref_cnt,
+# orig_capacity, capacity, size, flag_offset, bucket_offset,
+# dirty_offset and dirty_chunks before it
+def dirty_chunks() :
+    f = open( testfile )
+    try :
+        return struct.unpack( '=Q', f.read( 80 )[72:80] )[0]
+    finally :
+        f.close()
+
+def wait_clean( seconds=5 ) :
+    deadline = time.time() + seconds
+    while dirty_chunks() > 0 and time.time() < deadline :
+        time.sleep( 0.01 )
+    return dirty_chunks() == 0
+
+h = HashTable( testfile, 1000, force_init=True )
+h.flush()
+
+with pycode.test('flush') :
+    assert h.flush() == 0 and dirty_chunks() == 0
+    h['a'] = 'b'
+    dirty = dirty_chunks()
+    assert dirty > 0
+    assert h.flush() == dirty * chunk
+    assert dirty_chunks() == 0
+    assert h.flush() == 0
+
+with pycode.test('flush-many') :
+    for x in range(1000):
+        h[str(x)] = str(x) * 100
+    dirty = dirty_chunks()
+    assert dirty > 10
+    assert h.flush() == dirty * chunk
+    assert dirty_chunks() == 0
+
+with pycode.test('flusher-interval') :
+    h.start_flusher( interval=0.05 )
+    h['a'] = 'c'
+    assert wait_clean()
+    assert h.stop_flusher() == True
+    assert h.stop_flusher() == False
+
+with pycode.test('flusher-threshold') :
+    h.start_flusher( interval=0, threshold=1000 * chunk )
+    h['a'] = 'd'
+    time.sleep( 0.3 )
+    assert dirty_chunks() > 0
+    assert h.stop_flusher() == True
+    assert dirty_chunks() == 0
+    h.start_flusher( interval=0, threshold=chunk )
+    h['a'] = 'e'
+    assert wait_clean()
+    assert h.stop_flusher() == True
+
+with pycode.test('flusher-close') :
+    h.start_flusher( interval=60 )
+    for x in range(1000):
+        h[str(x)] = str(x) * 99
+    assert dirty_chunks() > 10
+    h.close()
+    # close marks the header again when it drops its reference
+    assert dirty_chunks() <= 1
+
+safe_rm(testfile)
@@ -0,0 +1,71 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import os
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+
+testfile = 'test_frozen.dat'
+frozenfile = 'test_frozen_frozen.dat'
+
+safe_rm(testfile)
+safe_rm(frozenfile)
+
+ident = shmht.open( testfile, 1000 )
+expect = { }
+for x in range(600):
+    shmht.setval( ident, str(x), str(x)+' data' )
+    expect[str(x)] = str(x)+' data'
+shmht.remove( ident, '7' )
+del expect['7']
+
+def contents( ident ):
+    d = { }
+    def collect( key, value ):
+        d[key] = value
+    shmht.foreach( ident, collect )
+    return d
+
+with pycode.test('from-table') :
+    assert shmht.freeze( frozenfile, ident ) == 599
+    assert os.path.getsize( frozenfile ) < os.path.getsize( testfile ) / 20
+    frozen = shmht.open( frozenfile )
+    for x in range(600):
+        assert shmht.getval( frozen, str(x) ) == expect.get(str(x))
+    assert shmht.getval( frozen, 'nope' ) == None
+    assert contents( frozen ) == expect
+    try :
+        shmht.setval( frozen, 'a', 'b' )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    shmht.close( frozen )
+
+with pycode.test('from-pairs') :
+    pairs = [ ( 'k%d' % x, 'v' * (x % 50) ) for x in range(3000) ]
+    assert shmht.freeze( frozenfile, pairs ) == 3000
+    frozen = shmht.open( frozenfile, 0, 0, 0, 0, 0, 1 )
+    for k, v in pairs :
+        assert shmht.getval( frozen, k ) == v
+    shmht.close( frozen )
+
+with pycode.test('empty') :
+    assert shmht.freeze( frozenfile, [ ] ) == 0
+    frozen = shmht.open( frozenfile )
+    assert shmht.getval( frozen, 'a' ) == None
+    assert contents( frozen ) == { }
+    shmht.close( frozen )
+
+with pycode.test('duplicate') :
+    try :
+        shmht.freeze( frozenfile, [ ( 'a', '1' ), ( 'a', '2' ) ] )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+
+shmht.close( ident )
+safe_rm(testfile)
+safe_rm(frozenfile)
@@ -0,0 +1,75 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import os
+import struct
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+from ext_shmht.HashTable import HashTable
+
+testfile = 'test_intkey.dat'
+logfile = 'test_intkey_log.dat'
+plainfile = 'test_intkey_plain.dat'
+snapfile = 'test_intkey.snap'
+
+def cleanup():
+    for f in ( testfile, logfile, plainfile, snapfile ):
+        safe_rm(f)
+
+cleanup()
+
+with pycode.test('intkey') :
+    h = HashTable( testfile, 10000, force_init=True, flags=shmht.INTKEY )
+    for x in range(5000):
+        h.iset( x << 16, x * 3 )
+    assert h.igetint( 7 << 16 ) == 21
+    assert h.igetint( 7 ) == None
+    assert h.igetint( 2 ** 64 - 1 ) == None
+    h.iset( 2 ** 64 - 1, 'max' )
+    assert h.iget( 2 ** 64 - 1 ) == 'max'
+    assert h.iremove( 7 << 16 )
+    assert h.iget( 7 << 16 ) == None
+    assert h.get( struct.pack( '=Q', 8 << 16 ) ) == struct.pack( '=Q', 24 )
+    assert len( h.to_dict() ) == 5000
+
+with pycode.test('intkey-size') :
+    g = HashTable( plainfile, 10000, force_init=True )
+    g.close()
+    assert os.path.getsize( plainfile ) > 10 * os.path.getsize( testfile )
+
+with pycode.test('intkey-refused') :
+    for bad in ( lambda: h.iset( 1, 'more than 8 bytes' ), lambda: h.set( 'short', 'x' ) ) :
+        try :
+            bad()
+        except shmht.error as e :
+            pass
+        else :
+            assert False, 'should have raised an exception'
+    try :
+        h.igetint( 2 ** 64 - 1 )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+
+with pycode.test('intkey-snapshot') :
+    h.snapshot( snapfile )
+    h.iset( 1, 1 )
+    h.restore( snapfile )
+    assert h.iget( 1 ) == None
+    assert h.igetint( 4999 << 16 ) == 4999 * 3
+    h.close()
+
+with pycode.test('intkey-log') :
+    l = HashTable( logfile, 1000, force_init=True, flags=shmht.INTKEY | shmht.LOG )
+    for x in range(500):
+        l.iset( x, 'value number %d' % x )
+    for x in range(0, 500, 2):
+        l.iremove( x )
+    l.compact()
+    assert l.iget( 499 ) == 'value number 499'
+    assert l.iget( 498 ) == None
+    l.close()
+
+cleanup()
@@ -0,0 +1,56 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+
+testfile = 'test_journal.dat'
+replicafile = 'test_journal_replica.dat'
+
+safe_rm(testfile)
+safe_rm(replicafile)
+
+ident = shmht.open( testfile, 1000, 0, shmht.JOURNAL, 0, 65536 )
+replica = shmht.open( replicafile, 1000 )
+
+def contents( ident ):
+    d = { }
+    def collect( key, value ):
+        d[key] = value
+    shmht.foreach( ident, collect )
+    return d
+
+with pycode.test('read') :
+    pos, records = shmht.read_journal( ident )
+    assert records == [ ]
+    shmht.setval( ident, 'a', 'a data' )
+    shmht.remove( ident, 'a' )
+    pos, records = shmht.read_journal( ident, pos )
+    assert records == [ ( 1, 'a', 'a data' ), ( 2, 'a', None ) ]
+
+with pycode.test('follow') :
+    for x in range(200):
+        shmht.setval( ident, str(x), str(x)+' data' )
+    shmht.follow( replica, ident )
+    shmht.remove( ident, '7' )
+    shmht.setval( ident, '8', 'changed' )
+    assert shmht.follow( replica, ident ) == 2
+    assert contents( replica ) == contents( ident )
+
+with pycode.test('fell-behind') :
+    for x in range(2000):
+        shmht.setval( ident, str(x % 500), str(x) * 20 )
+    try :
+        shmht.read_journal( ident, pos )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    shmht.follow( replica, ident )
+    assert contents( replica ) == contents( ident )
+
+shmht.close( ident )
+shmht.close( replica )
+safe_rm(testfile)
+safe_rm(replicafile)
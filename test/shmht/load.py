@@ -0,0 +1,67 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import struct
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+
+testfile = 'test_load.dat'
+textfile = 'test_load.txt'
+binfile = 'test_load.bin'
+
+safe_rm(testfile)
+
+def contents( ident ):
+    d = { }
+    def collect( key, value ):
+        d[key] = value
+    shmht.foreach( ident, collect )
+    return d
+
+expect = dict( ( str(x), str(x)+' data' ) for x in range(20000) )
+
+with pycode.test('pairs') :
+    pairs = expect.items() + [ ( '5', 'again' ) ]
+    assert shmht.load( testfile, pairs, 4 ) == 20000
+    ident = shmht.open( testfile )
+    assert shmht.getval( ident, '5' ) == 'again'
+    assert shmht.getval( ident, '6' ) == '6 data'
+    assert len( contents( ident ) ) == 20000
+    shmht.setval( ident, 'new', 'value' )
+    shmht.close( ident )
+
+with pycode.test('text') :
+    f = open( textfile, 'w' )
+    for x in range(1000):
+        f.write( '%d,%d data\r\n' % ( x, x ) )
+    f.write( '\n' )
+    f.close()
+    assert shmht.load( testfile, textfile, 0, shmht.LOG, 0, ',' ) == 1000
+    ident = shmht.open( testfile )
+    assert shmht.getval( ident, '999' ) == '999 data'
+    shmht.close( ident )
+
+with pycode.test('length-prefixed') :
+    f = open( binfile, 'wb' )
+    for x in range(1000):
+        k, v = 'k\n%d' % x, 'v\t%d' % x
+        f.write( struct.pack( 'II', len(k), len(v) ) + k + v )
+    f.close()
+    assert shmht.load( testfile, binfile, 2, 0, 0, None ) == 1000
+    ident = shmht.open( testfile )
+    assert shmht.getval( ident, 'k\n7' ) == 'v\t7'
+    shmht.close( ident )
+
+with pycode.test('bad-file') :
+    open( textfile, 'w' ).write( 'no delimiter here\n' )
+    try :
+        shmht.load( testfile, textfile )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+
+safe_rm(testfile)
+safe_rm(textfile)
+safe_rm(binfile)
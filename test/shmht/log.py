@@ -0,0 +1,65 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+
+testfile = 'test_log.dat'
+
+safe_rm(testfile)
+
+ident = shmht.open( testfile, 1000, 0, shmht.LOG, 65536 )
+
+def contents( ident ):
+    d = { }
+    def collect( key, value ):
+        d[key] = value
+    shmht.foreach( ident, collect )
+    return d
+
+expect = { }
+
+with pycode.test('set') :
+    for x in range(500):
+        shmht.setval( ident, str(x), str(x)+' data' )
+        expect[str(x)] = str(x)+' data'
+    shmht.remove( ident, '7' )
+    del expect['7']
+    assert shmht.getval( ident, '8' ) == '8 data'
+    assert contents( ident ) == expect
+
+with pycode.test('log-full') :
+    try :
+        for x in range(10000):
+            shmht.setval( ident, '9', 'x' * 1000 )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+
+with pycode.test('compact') :
+    used, live, size = shmht.log_usage( ident )
+    assert shmht.compact( ident ) == live
+    assert shmht.log_usage( ident ) == ( live, live, size )
+    shmht.setval( ident, '9', '9 data' )
+    assert contents( ident ) == expect
+
+with pycode.test('reopen') :
+    shmht.close( ident )
+    ident = shmht.open( testfile )
+    assert contents( ident ) == expect
+
+with pycode.test('compact-needs-flag') :
+    other = shmht.open( 'test_log_plain.dat', 100, 1 )
+    try :
+        shmht.compact( other )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    shmht.close( other )
+    safe_rm('test_log_plain.dat')
+
+shmht.close( ident )
+safe_rm(testfile)
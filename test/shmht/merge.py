@@ -0,0 +1,105 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import os
+import signal
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+
+files = [ 'test_merge_dst.dat', 'test_merge_a.dat', 'test_merge_b.dat' ]
+
+for f in files :
+    safe_rm(f)
+
+def contents( ident ):
+    d = { }
+    def collect( key, value ):
+        d[key] = value
+    shmht.foreach( ident, collect )
+    return d
+
+def tables( dst, a, b ) :
+    idents = [ shmht.open( f, 20000, 1 ) for f in files ]
+    for ident, d in zip( idents, ( dst, a, b ) ) :
+        shmht.setvals( ident, d.items() )
+    return idents
+
+with pycode.test('overwrite') :
+    dst, a, b = tables( { 'x': 'dst' }, dict( ( str(i), 'a' ) for i in range(5000) ), { 'x': 'b', '7': 'b' } )
+    assert shmht.merge( dst, [ a, b ], 'overwrite', 2 ) == 5002
+    d = contents( dst )
+    assert len( d ) == 5001
+    assert d['x'] == 'b' and d['7'] == 'b' and d['8'] == 'a'
+    for ident in ( dst, a, b ) :
+        shmht.close( ident )
+
+with pycode.test('keep') :
+    dst, a, b = tables( { 'x': 'dst' }, { 'x': 'a', 'y': 'a' }, { 'y': 'b', 'z': 'b' } )
+    assert shmht.merge( dst, [ a, b ], 'keep' ) == 2
+    assert contents( dst ) == { 'x': 'dst', 'y': 'a', 'z': 'b' }
+    for ident in ( dst, a, b ) :
+        shmht.close( ident )
+
+with pycode.test('incr') :
+    dst, a, b = tables( { 'x': '1' }, { 'x': '10', 'y': '-2' }, { 'x': '100', 'y': '5' } )
+    shmht.merge( dst, [ a, b ], 'incr' )
+    assert contents( dst ) == { 'x': '111', 'y': '3' }
+    shmht.setval( b, 'y', 'five' )
+    shmht.setval( a, 'x', str( 2 ** 63 - 111 ) )
+    shmht.setval( a, 'y', '-1' )
+    # not an integer; a sum past 2**63 - 1
+    for src in ( b, a ) :
+        try :
+            shmht.merge( dst, [ src ], 'incr' )
+        except shmht.error as e :
+            pass
+        else :
+            assert False, 'should have raised an exception'
+    # a failed merge may have applied some entries already
+    shmht.setval( dst, 'x', '111' )
+    shmht.setval( a, 'x', str( 2 ** 63 - 112 ) )
+    shmht.merge( dst, [ a ], 'incr' )
+    assert contents( dst )['x'] == str( 2 ** 63 - 1 )
+    for ident in ( dst, a, b ) :
+        shmht.close( ident )
+
+with pycode.test('append') :
+    dst, a, b = tables( { 'x': 'd' }, { 'x': 'a' }, { 'x': 'b', 'y': 'b' } )
+    shmht.merge( dst, [ a, b ], 'append' )
+    assert contents( dst ) == { 'x': 'dab', 'y': 'b' }
+    try :
+        shmht.merge( dst, [ dst ] )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    for ident in ( dst, a, b ) :
+        shmht.close( ident )
+
+with pycode.test('crossed') :
+    # two processes merging each other's tables, the other way around
+    go_r, go_w = os.pipe()
+    def merger( dst, src ) :
+        pid = os.fork()
+        if pid == 0 :
+            status = 1
+            try :
+                signal.alarm( 20 )
+                d, s = shmht.open( dst ), shmht.open( src )
+                os.read( go_r, 1 )
+                for i in range(2000) :
+                    shmht.merge( d, [ s ], 'keep' )
+                status = 0
+            finally :
+                os._exit( status )
+        return pid
+    dst, a, b = tables( { }, dict( ( str(i), 'a' ) for i in range(2000) ), dict( ( str(i), 'b' ) for i in range(1000, 3000) ) )
+    for ident in ( dst, a, b ) :
+        shmht.close( ident )
+    pids = [ merger( files[1], files[2] ), merger( files[2], files[1] ) ]
+    os.write( go_w, 'gg' )
+    assert [ os.waitpid( pid, 0 )[1] for pid in pids ] == [ 0, 0 ]
+
+for f in files :
+    safe_rm(f)
@@ -0,0 +1,71 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+from ext_shmht.HashTable import HashTable
+
+testfile = 'test_mirror.dat'
+mirrorfile = 'test_mirror.disk'
+
+def cleanup():
+    for f in ( testfile, mirrorfile ):
+        safe_rm(f)
+
+def same_files() :
+    table, mirror = open( testfile ).read(), open( mirrorfile ).read()
+    return len( mirror ) > 0 and table[:len( mirror )] == mirror
+
+cleanup()
+
+with pycode.test('mirror') :
+    h = HashTable( testfile, 1000, force_init=True )
+    for x in range(100):
+        h[str(x)] = str(x) + ' data'
+    assert h.start_mirror( mirrorfile, interval=0.05, workers=2 ) in ( 'io_uring', 'pwrite' )
+    assert same_files()
+
+with pycode.test('mirror-sync') :
+    for x in range(100, 600):
+        h[str(x)] = str(x) + ' data'
+    del h['7']
+    assert h.sync_mirror() > 0
+    assert same_files()
+
+with pycode.test('mirror-twice') :
+    try :
+        h.start_mirror( mirrorfile )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+
+with pycode.test('mirror-stop') :
+    h['last'] = 'one'
+    assert h.stop_mirror() == True
+    assert h.stop_mirror() == False
+    expect = h.to_dict()
+    h.close()
+    m = HashTable( mirrorfile )
+    assert m.to_dict() == expect and m['last'] == 'one'
+    m.close()
+
+with pycode.test('mirror-failed') :
+    h = HashTable( testfile )
+    # no such directory; a file that cannot be sized
+    for path in ( '/nonexistent/dir/file', '/dev/null' ):
+        try :
+            h.start_mirror( path )
+        except shmht.error as e :
+            pass
+        else :
+            assert False, 'should have raised an exception'
+    h.start_mirror( mirrorfile )
+    h['again'] = 'yes'
+    h.close()
+    m = HashTable( mirrorfile )
+    assert m['again'] == 'yes'
+    m.close()
+
+cleanup()
@@ -0,0 +1,91 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import os
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+from ext_shmht.HashTable import HashTable
+
+setfile = 'test_multimap_set.dat'
+multifile = 'test_multimap.dat'
+
+def cleanup():
+    safe_rm(setfile)
+    safe_rm(multifile)
+
+cleanup()
+
+with pycode.test('set') :
+    s = HashTable( setfile, 1000, force_init=True, flags=shmht.SET )
+    for x in range(500):
+        s.add( str(x) )
+    assert '7' in s
+    assert 'nope' not in s
+    assert s['7'] == ''
+    assert s.count( '7' ) == 1 and s.count( 'nope' ) == 0
+    s.remove( '7' )
+    assert '7' not in s
+    assert len( s.to_dict() ) == 499
+    try :
+        s['x'] = 'a value'
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    s.close()
+    plain = os.path.getsize( setfile )
+    s = HashTable( setfile, 1000, force_init=True )
+    assert os.path.getsize( setfile ) > 4 * plain
+    s.close()
+
+with pycode.test('multi') :
+    m = HashTable( multifile, 1000, force_init=True, flags=shmht.MULTI | shmht.LOG )
+    for x in range(100):
+        m.add( 'k', str(x) )
+    m.add( 'other', 'o' )
+    assert m.count( 'k' ) == 100
+    assert m['k'] == '0'
+    assert m.getall( 'k', 10, 3 ) == [ '10', '11', '12' ]
+    assert list( m.iterall( 'k', chunk=7 ) ) == [ str(x) for x in range(100) ]
+    assert m.getall( 'nope' ) == []
+    assert m.discard( 'k', '50' )
+    assert not m.discard( 'k', '50' )
+    assert m.getall( 'k', 49, 2 ) == [ '49', '51' ]
+    assert m.count( 'k' ) == 99
+
+with pycode.test('multi-dict') :
+    seen = []
+    m.foreach( lambda key, value: seen.append( ( key, value ) ) )
+    assert len( seen ) == 100
+    assert ( 'other', 'o' ) in seen and ( 'k', '99' ) in seen
+    m['k'] = 'only'
+    assert m.getall( 'k' ) == [ 'only' ]
+    del m['k']
+    assert 'k' not in m and m.count( 'k' ) == 0
+    m.add( 'k', 'again' )
+    assert m.getall( 'k' ) == [ 'again' ]
+
+with pycode.test('multi-many') :
+    for x in range(300):
+        m.add( 'many', str(x) )
+    assert m.getall( 'many', 255, 3 ) == [ '255', '256', '257' ]
+    assert m.getall( 'many', 0, 1 ) == [ '0' ]
+    assert m.count( 'many' ) == 300
+
+with pycode.test('multi-refused') :
+    try :
+        HashTable.load( 'test_multimap_load.dat', { 'a': 'b' }, flags=shmht.MULTI )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    try :
+        m.merge( [ HashTable( setfile, 1000 ) ] )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    m.close()
+
+cleanup()
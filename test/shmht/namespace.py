@@ -0,0 +1,95 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+
+testfile = 'test_namespace.dat'
+copyfile = 'test_namespace_copy.dat'
+
+safe_rm(testfile)
+safe_rm(copyfile)
+
+def contents( ident ):
+    d = { }
+    def collect( key, value ):
+        d[key] = value
+    shmht.foreach( ident, collect )
+    return d
+
+users = shmht.open( testfile, 1000, 0, shmht.LOG, 0, 0, 0, 'users' )
+groups = shmht.open( testfile, 0, 0, 0, 0, 0, 0, 'groups', 20 )
+
+with pycode.test('separate') :
+    shmht.setval( users, 'a', 'user a' )
+    shmht.setval( groups, 'a', 'group a' )
+    assert shmht.getval( users, 'a' ) == 'user a'
+    assert shmht.getval( groups, 'a' ) == 'group a'
+    assert shmht.getvals( groups, [ 'a', 'b' ] ) == [ 'group a', None ]
+    assert contents( users ) == { 'a': 'user a' }
+    assert shmht.remove( users, 'a' )
+    assert shmht.getval( groups, 'a' ) == 'group a'
+    shmht.setval( users, 'a', 'user a' )
+
+with pycode.test('quota') :
+    shmht.setval( groups, 'b', '1234567890' )
+    try :
+        shmht.setval( groups, 'c', '1234567890' )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    shmht.setval( groups, 'b', '1' )
+    shmht.setval( groups, 'c', 'x' )
+
+with pycode.test('directory') :
+    n = dict( ( x[0], x[1:] ) for x in shmht.namespaces( users ) )
+    assert n['users'] == ( 1, 7, 0 )
+    assert n['groups'] == ( 3, 12, 20 )
+    assert n[''] == ( 0, 0, 0 )
+
+with pycode.test('another-process') :
+    # a fresh mapping, as another process would have
+    other = shmht.open( testfile, 0, 0, 0, 0, 0, 1, 'users' )
+    shmht.close( users )
+    shmht.close( groups )
+    assert shmht.getval( other, 'a' ) == 'user a'
+    try :
+        shmht.open( testfile, 0, 0, 0, 0, 0, 1, 'nobody' )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    shmht.close( other )
+
+with pycode.test('snapshot') :
+    users = shmht.open( testfile, 0, 0, 0, 0, 0, 0, 'users' )
+    shmht.snapshot( users, copyfile )
+    shmht.setval( users, 'b', 'user b' )
+    shmht.restore( users, copyfile )
+    assert shmht.getval( users, 'b' ) == None
+    n = dict( ( x[0], x[1:] ) for x in shmht.namespaces( users ) )
+    assert n['users'] == ( 1, 7, 0 )
+
+with pycode.test('unnamed') :
+    unnamed = shmht.open( testfile )
+    for x in range(600):
+        shmht.setval( unnamed, 'k%03d' % x, str(x) )
+    assert all( shmht.getval( unnamed, 'k%03d' % x ) == str(x) for x in range(600) )
+    shmht.close( unnamed )
+
+with pycode.test('no-namespaces') :
+    safe_rm( copyfile )
+    plain = shmht.open( copyfile, 100 )
+    shmht.close( plain )
+    try :
+        shmht.open( copyfile, 0, 0, 0, 0, 0, 0, 'users' )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+
+shmht.close( users )
+safe_rm(testfile)
+safe_rm(copyfile)
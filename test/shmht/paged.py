@@ -0,0 +1,99 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import struct
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+from ext_shmht.HashTable import HashTable
+
+testfile = 'test_paged.dat'
+plainfile = 'test_paged_plain.dat'
+snapfile = 'test_paged.snap'
+
+def cleanup():
+    for f in ( testfile, plainfile, snapfile ):
+        safe_rm(f)
+
+cleanup()
+
+with pycode.test('paged') :
+    h = HashTable( testfile, 20000, force_init=True, flags=shmht.SPLIT | shmht.PAGED )
+    for x in range(20000):
+        h[str(x)] = str(x) + ' data'
+    for x in range(0, 20000, 3):
+        del h[str(x)]
+    for x in range(20000):
+        assert h.get( str(x) ) == ( None if x % 3 == 0 else str(x) + ' data' ), x
+    assert len( h.to_dict() ) == 20000 - 6667
+
+with pycode.test('paged-snapshot') :
+    h.snapshot( snapfile )
+    h['new'] = 'x'
+    h.restore( snapfile )
+    assert 'new' not in h
+    assert h['19999'] == '19999 data'
+    h.close()
+
+with pycode.test('paged-refused') :
+    # plain buckets, 3 a page, or LOG slots, which send a probe to the log
+    for flags in ( shmht.PAGED, shmht.LOG | shmht.PAGED ):
+        for build in ( lambda: HashTable( plainfile, 1000, force_init=True, flags=flags ),
+                       lambda: HashTable.load( plainfile, [ ( 'a', 'b' ) ], flags=flags ) ):
+            try :
+                build()
+            except shmht.error as e :
+                pass
+            else :
+                assert False, 'should have raised an exception'
+
+def mix( k ):
+    # the splitmix64 finalizer that INTKEY tables hash with
+    m = ( 1 << 64 ) - 1
+    k ^= k >> 30; k = ( k * 0xbf58476d1ce4e5b9 ) & m
+    k ^= k >> 27; k = ( k * 0x94d049bb133111eb ) & m
+    return k ^ ( k >> 31 )
+
+def slots_of( name ):
+    f = open( name )
+    try :
+        return struct.unpack( '=Q', f.read( 32 )[24:32] )[0]    # the capacity in the header
+    finally :
+        f.close()
+
+page = 4096 // 24    # INTKEY slots in a page
+
+with pycode.test('paged-home') :
+    # filled to the most a table takes, every key still sits in the page
+    # of its home slot; without PAGED about 1 in 100 does not
+    h = HashTable( testfile, 20000, force_init=True, flags=shmht.INTKEY | shmht.PAGED )
+    slots = slots_of( testfile )
+    n = int( slots * 0.65 )
+    for k in range(n):
+        h.iset( k, k )
+    for k in range(n):
+        assert h.find( struct.pack( '=Q', k ) ).ref[0] // page == mix( k ) % slots // page, k
+    h.close()
+
+with pycode.test('paged-overflow') :
+    # more keys than fit in the first page all start there: it fills up
+    # first, then the rest go round the table
+    h = HashTable( testfile, 20000, force_init=True, flags=shmht.INTKEY | shmht.PAGED )
+    slots = slots_of( testfile )
+    keys = [ k for k in xrange(200000) if mix( k ) % slots < page ][:page + 30]
+    assert len( keys ) == page + 30
+    for k in keys:
+        h.iset( k, k )
+    at = [ h.find( struct.pack( '=Q', k ) ).ref[0] for k in keys ]
+    assert sorted( at[:page] ) == range(page)
+    assert all( slot >= page for slot in at[page:] )
+    assert all( h.igetint( k ) == k for k in keys )
+    h.close()
+
+with pycode.test('paged-load') :
+    HashTable.load( testfile, [ ( '%08d' % x, 'v%d' % x ) for x in range(5000) ], flags=shmht.INTKEY | shmht.PAGED )
+    h = HashTable( testfile )
+    assert all( h.get( '%08d' % x ) == 'v%d' % x for x in range(5000) )
+    h.close()
+
+cleanup()
@@ -0,0 +1,54 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+
+testfile = 'test_publish.dat'
+rebuiltfile = 'test_publish_rebuilt.dat'
+
+safe_rm(testfile)
+safe_rm(rebuiltfile)
+
+reader = shmht.open( testfile, 1000 )
+shmht.setval( reader, 'a', 'old a' )
+shmht.setval( reader, 'b', 'old b' )
+
+with pycode.test('publish') :
+    assert shmht.generation( reader ) == 0
+    rebuilt = shmht.open( rebuiltfile, 2000 )
+    shmht.setval( rebuilt, 'a', 'new a' )
+    shmht.setval( rebuilt, 'c', 'new c' )
+    shmht.close( rebuilt )
+    assert shmht.publish( rebuiltfile, testfile ) == 1
+    assert shmht.getval( reader, 'a' ) == 'new a'
+    assert shmht.getval( reader, 'b' ) == None
+    assert shmht.getval( reader, 'c' ) == 'new c'
+    assert shmht.generation( reader ) == 1
+
+with pycode.test('publish-again') :
+    rebuilt = shmht.open( rebuiltfile, 1000, 1 )
+    shmht.setval( rebuilt, 'd', 'newer d' )
+    shmht.close( rebuilt )
+    assert shmht.publish( rebuiltfile, testfile ) == 2
+    shmht.setval( reader, 'e', 'e data' )
+    other = shmht.open( testfile )
+    assert shmht.getval( other, 'd' ) == 'newer d'
+    assert shmht.getval( other, 'e' ) == 'e data'
+    assert shmht.generation( other ) == 2
+    shmht.close( other )
+
+with pycode.test('not-a-table') :
+    open( rebuiltfile, 'w' ).write( 'junk' )
+    try :
+        shmht.publish( rebuiltfile, testfile )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    assert shmht.getval( reader, 'd' ) == 'newer d'
+
+shmht.close( reader )
+safe_rm(testfile)
+safe_rm(rebuiltfile)
@@ -0,0 +1,108 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import os
+import time
+import fcntl
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+
+testfile = 'test_readonly.dat'
+waitfile = 'test_readonly_wait.dat'
+
+safe_rm(testfile)
+safe_rm(waitfile)
+
+ident = shmht.open( testfile, 1000 )
+for x in range(100):
+    shmht.setval( ident, str(x), str(x)+' data' )
+
+def raises( f, *args ) :
+    try :
+        f( *args )
+    except shmht.error as e :
+        return True
+    return False
+
+with pycode.test('readonly') :
+    reader = shmht.open( testfile, 0, 0, 0, 0, 0, 1 )
+    assert shmht.getval( reader, '7' ) == '7 data'
+    shmht.setval( ident, '7', 'changed' )
+    assert shmht.getval( reader, '7' ) == 'changed'
+    assert raises( shmht.setval, reader, 'a', 'b' )
+    assert raises( shmht.remove, reader, '8' )
+    assert raises( shmht.flush, reader )
+    assert raises( shmht.seal, reader )
+    shmht.close( reader )
+
+with pycode.test('readonly-file') :
+    os.chmod( testfile, 0444 )
+    try :
+        reader = shmht.open( testfile, 0, 0, 0, 0, 0, 1 )
+        assert shmht.getval( reader, '9' ) == '9 data'
+        shmht.close( reader )
+    finally :
+        os.chmod( testfile, 0644 )
+
+with pycode.test('sealed') :
+    reader = shmht.open( testfile, 0, 0, 0, 0, 0, 1 )
+    shmht.seal( ident )
+    assert raises( shmht.setval, ident, 'a', 'b' )
+    assert raises( shmht.remove, ident, '8' )
+    assert shmht.getval( reader, '8' ) == '8 data'
+    assert shmht.getval( ident, '8' ) == '8 data'
+    d = { }
+    def collect( key, value ):
+        d[key] = value
+    shmht.foreach( reader, collect )
+    assert len(d) == 100
+    shmht.close( reader )
+
+shmht.close( ident )
+
+# run f in a child with its own handle on waitfile, once told to go
+def child( f ) :
+    ready_r, ready_w = os.pipe()
+    go_r, go_w = os.pipe()
+    pid = os.fork()
+    if pid == 0 :
+        try :
+            ident = shmht.open( waitfile )
+            os.write( ready_w, 'r' )
+            os.read( go_r, 1 )
+            f( ident )
+        finally :
+            os._exit( 0 )
+    os.read( ready_r, 1 )
+    return pid, go_w
+
+with pycode.test('sealed-while-waiting') :
+    # a reader that waited for the lock while the table got sealed must
+    # not keep the lock
+    shmht.close( shmht.open( waitfile, 1000 ) )
+    done_r, done_w = os.pipe()
+    exit_r, exit_w = os.pipe()
+    def read( ident ) :
+        os.write( done_w, str( shmht.getval( ident, 'a' ) ) )
+        os.read( exit_r, 1 )
+    reader, reader_go = child( read )
+    sealer, sealer_go = child( shmht.seal )
+    holder = open( waitfile )
+    fcntl.flock( holder, fcntl.LOCK_EX )
+    os.write( sealer_go, 'g' )
+    time.sleep( 0.2 )
+    os.write( reader_go, 'g' )
+    time.sleep( 0.2 )
+    fcntl.flock( holder, fcntl.LOCK_UN )
+    os.waitpid( sealer, 0 )
+    assert os.read( done_r, 4 ) == 'None'
+    try :
+        fcntl.flock( holder, fcntl.LOCK_EX | fcntl.LOCK_NB )
+    finally :
+        os.write( exit_w, 'x' )
+        os.waitpid( reader, 0 )
+    holder.close()
+
+safe_rm(testfile)
+safe_rm(waitfile)
@@ -0,0 +1,76 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import os
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+from ext_shmht.ShardedHashTable import ShardedHashTable
+
+manifest = 'test_sharded.json'
+testfile = 'test_sharded.dat'
+
+def cleanup():
+    safe_rm(manifest)
+    safe_rm(testfile)
+    for i in range(4):
+        safe_rm('%s.%d' % (manifest, i))
+
+cleanup()
+
+with pycode.test('batch') :
+    ident = shmht.open( testfile, 1000 )
+    assert shmht.setvals( ident, [ ( 'a', '1' ), ( 'b', '2' ) ] ) == 2
+    assert shmht.getvals( ident, [ 'b', 'x', 'a' ] ) == [ '2', None, '1' ]
+
+with pycode.test('grow') :
+    for x in range(500):
+        shmht.setval( ident, str(x), str(x) + ' data' )
+    assert shmht.grow( ident, 5000 ) == 1
+    for x in range(4000):
+        shmht.setval( ident, 'more %d' % x, 'x' )
+    assert shmht.getval( ident, '499' ) == '499 data'
+    assert shmht.getval( ident, 'a' ) == '1'
+    try :
+        shmht.grow( ident, 10 )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    shmht.close( ident )
+
+with pycode.test('shard') :
+    assert shmht.shard( 'key', 4 ) == shmht.shard( 'key', 4 )
+    assert set( shmht.shard( str(x), 4 ) for x in range(100) ) == set(range(4))
+
+with pycode.test('sharded') :
+    h = ShardedHashTable( manifest, shards=4, capacity=4000 )
+    h.update( dict( ( str(x), str(x) + ' data' ) for x in range(2000) ) )
+    h['a'] = 'b'
+    assert h['a'] == 'b'
+    assert h.get_many( [ '7', 'nope', '1999' ] ) == [ '7 data', None, '1999 data' ]
+    assert len( h.to_dict() ) == 2001
+    del h['a']
+    assert 'a' not in h
+    assert os.path.exists( '%s.3' % manifest )
+
+with pycode.test('sharded-attach') :
+    g = ShardedHashTable( manifest, readonly=True )
+    assert g.get( '5' ) == '5 data'
+    shard = h.shard_of( '5' )
+    assert h.grow( shard, 10000 ) == 1
+    h['5'] = 'changed'
+    assert g.get( '5' ) == 'changed'
+    g.close()
+    h.close()
+
+with pycode.test('no-manifest') :
+    cleanup()
+    try :
+        ShardedHashTable( manifest )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+
+cleanup()
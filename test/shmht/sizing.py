@@ -0,0 +1,93 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import os
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+
+testfile = 'test_sizing.dat'
+replicafile = 'test_sizing_replica.dat'
+otherfile = 'test_sizing_other.dat'
+snapfile = 'test_sizing.snap'
+
+def cleanup():
+    for f in ( testfile, testfile + '.grown', testfile + '.loaded', replicafile, otherfile, snapfile ):
+        safe_rm(f)
+
+cleanup()
+
+with pycode.test('capacity-range') :
+    # capacities used to be parsed into an int and cut short
+    for capacity in ( 2 ** 45, -1 ):
+        try :
+            shmht.open( testfile, capacity, 1 )
+        except shmht.error as e :
+            assert 'out of range' in str(e)
+        else :
+            assert False, 'should have raised an exception'
+
+with pycode.test('capacity-long') :
+    ident = shmht.open( testfile, 1000L, 1 )
+    shmht.setval( ident, 'a', 'b' )
+    try :
+        shmht.grow( ident, 2 ** 45 )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    assert shmht.getval( ident, 'a' ) == 'b'
+    shmht.close( ident )
+
+def raises( f, *args ) :
+    try :
+        f( *args )
+    except shmht.error as e :
+        return True
+    return False
+
+big = ''.join( chr( x % 251 ) for x in range( 3 << 20 ) )
+
+with pycode.test('large-values') :
+    # values in the log are only limited by its size
+    ident = shmht.open( testfile, 1000, 1, shmht.LOG | shmht.JOURNAL, 16 << 20 )
+    replica = shmht.open( replicafile, 1000, 1, shmht.LOG, 16 << 20 )
+    shmht.setval( ident, 'small', 'x' )
+    shmht.follow( replica, ident )
+    shmht.setval( ident, 'big', big )
+    shmht.setval( ident, 'medium', big[:5000] )
+    assert shmht.getval( ident, 'big' ) == big
+    assert shmht.getval( ident, 'medium' ) == big[:5000]
+    # too large for the journal: the replica copies the table over
+    assert shmht.follow( replica, ident ) > 0
+    assert shmht.getval( replica, 'big' ) == big
+    shmht.snapshot( ident, snapfile )
+    shmht.remove( ident, 'big' )
+    shmht.compact( ident )
+    shmht.restore( ident, snapfile )
+    assert shmht.getval( ident, 'big' ) == big and shmht.getval( ident, 'small' ) == 'x'
+    assert raises( shmht.setval, ident, 'huge', big * 6 )
+    shmht.close( replica )
+
+with pycode.test('large-values-merge') :
+    other = shmht.open( otherfile, 1000, 1, shmht.LOG, 16 << 20 )
+    shmht.setval( other, 'medium', big[5000:8000] )
+    assert shmht.merge( ident, [ other ], 'append' ) == 1
+    assert shmht.getval( ident, 'medium' ) == big[:8000]
+    shmht.close( other )
+    shmht.close( ident )
+
+with pycode.test('large-values-refused') :
+    ident = shmht.open( testfile, 1000, 1 )
+    assert raises( shmht.setval, ident, 'a', 'x' * 1020 )
+    shmht.setval( ident, 'a', 'x' * 1000 )
+    shmht.close( ident )
+
+with pycode.test('backup-log-refused') :
+    # the shadow of a backup only has room for plain buckets
+    for flags in ( shmht.LOG, shmht.SPLIT, shmht.TIERED ):
+        assert raises( shmht.open, testfile, 1000, 1, flags | shmht.BACKUP )
+        assert raises( shmht.load, testfile + '.loaded', [ ( 'a', 'b' ) ], 0, flags | shmht.BACKUP )
+    assert not os.path.exists( testfile + '.loaded' )
+
+cleanup()
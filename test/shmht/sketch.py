@@ -0,0 +1,130 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import threading
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+from ext_shmht.Sketch import HyperLogLog, CountMinSketch
+
+hllfile = 'test_sketch_hll.dat'
+hllfile2 = 'test_sketch_hll2.dat'
+cmsfile = 'test_sketch_cms.dat'
+cmsfile2 = 'test_sketch_cms2.dat'
+
+def cleanup():
+    for f in ( hllfile, hllfile2, cmsfile, cmsfile2 ):
+        safe_rm(f)
+
+cleanup()
+
+with pycode.test('hll') :
+    h = HyperLogLog( hllfile, 12 )
+    assert h.count() == 0
+    h.add( 'one' )
+    h.add( 'one' )
+    assert len( h ) == 1
+    h.add( [ str(x) for x in range(100000) ] )
+    assert abs( len( h ) - 100001 ) < 100001 * 0.05, len( h )
+
+with pycode.test('hll-attach') :
+    g = HyperLogLog( hllfile, 0 )
+    assert len( g ) == len( h )
+    g.add( [ 'more %d' % x for x in range(1000) ] )
+    assert h.count() == g.count()
+    g.close()
+    try :
+        HyperLogLog( hllfile, 10 )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+
+with pycode.test('hll-merge') :
+    h.clear()
+    h2 = HyperLogLog( hllfile2, 12 )
+    h.add( [ str(x) for x in range(5000) ] )
+    h2.add( [ str(x) for x in range(2500, 7500) ] )
+    h.merge( h2 )
+    assert abs( len( h ) - 7500 ) < 7500 * 0.05, len( h )
+
+with pycode.test('hll-threads') :
+    h.clear()
+    def adder(n):
+        for x in range(0, 20000, 100):
+            h.add( [ '%d %d' % (n, y) for y in range(x, x + 100) ] )
+    threads = [ threading.Thread( target=adder, args=(n,) ) for n in range(4) ]
+    for t in threads :
+        t.start()
+    for t in threads :
+        t.join()
+    assert abs( len( h ) - 80000 ) < 80000 * 0.05, len( h )
+    h.close()
+    h2.close()
+
+with pycode.test('cms') :
+    c = CountMinSketch( cmsfile, 1024, 4 )
+    c.add( 'a' )
+    c.add( 'a', 4 )
+    c.add( [ 'b', 'c', 'b' ] )
+    assert c['a'] >= 5 and c['b'] >= 2
+    assert c.estimate( [ 'a', 'b', 'c' ] ) == [ 5, 2, 1 ]
+    for x in range(10000):
+        c.add( str(x % 100) )
+    assert all( n >= 100 for n in c.estimate( [ str(x) for x in range(100) ] ) )
+
+with pycode.test('cms-merge') :
+    c2 = CountMinSketch( cmsfile2, 1024, 4 )
+    c2.add( 'a', 10 )
+    c.merge( c2 )
+    assert c['a'] >= 15
+    h = HyperLogLog( hllfile, 0 )
+    try :
+        c.merge( h )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    h.close()
+
+with pycode.test('cms-shape') :
+    c3 = CountMinSketch( cmsfile2, 0 )
+    assert c3['a'] == c2['a']
+    c3.close()
+    try :
+        CountMinSketch( hllfile2, 0 )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    c.close()
+    c2.close()
+
+with pycode.test('sketch-close') :
+    # a sketch is not closed under a merge running in another thread
+    c = shmht.cms_open( cmsfile, 1 << 20, 4, 1 )
+    c2 = shmht.cms_open( cmsfile2, 1 << 20, 4, 1 )
+    shmht.cms_add( c2, 'a' )
+    stopped = [ ]
+    started = threading.Event()
+    def merger():
+        try :
+            while True:
+                shmht.sketch_merge( c, c2 )
+                started.set()
+        except shmht.error as e :
+            stopped.append( 'merge' )
+    t = threading.Thread( target=merger )
+    t.start()
+    started.wait()
+    while True:
+        try :
+            shmht.sketch_close( c2 )
+            break
+        except shmht.error as e :
+            pass
+    t.join()
+    assert stopped == [ 'merge' ] and shmht.cms_estimate( c, 'a' ) >= 1
+    shmht.sketch_close( c )
+
+cleanup()
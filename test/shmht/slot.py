@@ -0,0 +1,121 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+from ext_shmht.HashTable import HashTable
+
+testfile = 'test_slot.dat'
+frozenfile = 'test_slot_frozen.dat'
+coldfile = 'test_slot.cold'
+snapfile = 'test_slot.snap'
+
+def cleanup():
+    for f in ( testfile, frozenfile, snapfile, coldfile, testfile + '.grown' ):
+        safe_rm(f)
+
+cleanup()
+
+with pycode.test('slot') :
+    h = HashTable( testfile, 1000, force_init=True )
+    s = h.find( 'a' )
+    assert s.get() == None and s.get( 'none' ) == 'none'
+    s.set( '1' )
+    assert s.ref[0] >= 0
+    assert h['a'] == '1' and s.get() == '1'
+    h['a'] = '2'
+    assert s.get() == '2'
+    ref = s.ref
+    s.set( '3' )
+    assert s.ref == ref and h['a'] == '3'
+
+with pycode.test('slot-stale') :
+    t = h.find( 'b' )
+    t.set( 'b' )
+    h['c'] = 'c'
+    del h['c']
+    assert t.ref != shmht.find( h.fd, 'b' )
+    assert t.get() == 'b'
+    assert t.ref == shmht.find( h.fd, 'b' )
+    del h['a']
+    assert s.get() == None
+    s.set( '4' )
+    assert h['a'] == '4' and s.get() == '4'
+
+with pycode.test('slot-upsert') :
+    d = { }
+    for x in range(600):
+        h[str(x)] = d[str(x)] = str(x)
+    for x in range(0, 600, 2):
+        del h[str(x)]
+        del d[str(x)]
+    for x in range(0, 600, 3):
+        h[str(x)] = d[str(x)] = 'again'
+    assert h.to_dict() == dict( d, a='4', b='b' )
+
+with pycode.test('slot-restore') :
+    h.snapshot( snapfile )
+    s.set( '5' )
+    h.restore( snapfile )
+    assert s.get() == '4'
+    assert shmht.grow( h.fd, 2000 ) == 1
+    assert s.get() == '4'
+    s.set( '6' )
+    assert h['a'] == '6'
+    h.close()
+
+with pycode.test('slot-kinds') :
+    h = HashTable( testfile, 1000, force_init=True, flags=shmht.SPLIT )
+    s = h.find( 'k' )
+    s.set( 'v' )
+    assert s.get() == 'v' and h['k'] == 'v'
+    h.close()
+    h = HashTable( testfile, 1000, force_init=True, flags=shmht.SET )
+    s = h.find( 'k' )
+    s.set( '' )
+    assert 'k' in h
+    try :
+        s.set( 'v' )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    h.close()
+
+with pycode.test('slot-tiered') :
+    # a get through a handle is a read like any other: it brings a cold
+    # value back, whether the handle is current or stale
+    h = HashTable( testfile, 1000, force_init=True, cold_path=coldfile )
+    for x in range(10):
+        h[str(x)] = str(x) * 10
+    slots = [ h.find( str(x) ) for x in range(10) ]
+    h.demote( 0 )
+    h.set_promote( True )
+    assert h.tier_usage()[0] == 0
+    assert slots[1].get() == '1' * 10
+    live = h.tier_usage()[0]
+    assert live > 0
+    del h['0']
+    ref = slots[2].ref
+    assert slots[2].get() == '2' * 10 and slots[2].ref != ref
+    assert h.tier_usage()[0] == 2 * live
+    h.close()
+
+with pycode.test('slot-frozen') :
+    HashTable.freeze( frozenfile, { 'x': '1', 'y': '2' } )
+    f = HashTable( frozenfile )
+    assert f.find( 'y' ).get() == '2' and f.find( 'z' ).get() == None
+    f.close()
+
+with pycode.test('slot-namespace') :
+    n = HashTable( testfile, 1000, force_init=True, namespace='users' )
+    try :
+        n.find( 'k' )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    n.close()
+
+cleanup()
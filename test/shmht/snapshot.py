@@ -0,0 +1,115 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+
+testfile = 'test_snapshot.dat'
+restorefile = 'test_snapshot_restore.dat'
+snapfile = 'test_snapshot.snap'
+
+safe_rm(testfile)
+safe_rm(restorefile)
+safe_rm(snapfile)
+
+ident = shmht.open( testfile, 1000 )
+
+expect = { }
+for x in range(500):
+    shmht.setval( ident, str(x), str(x)+' data' )
+    expect[str(x)] = str(x)+' data'
+shmht.remove( ident, '7' )
+del expect['7']
+
+def contents( ident ):
+    d = { }
+    def collect( key, value ):
+        d[key] = value
+    shmht.foreach( ident, collect )
+    return d
+
+with pycode.test('snapshot') :
+    assert shmht.snapshot( ident, snapfile ) == 499
+
+with pycode.test('restore') :
+    other = shmht.open( restorefile, 2000 )
+    shmht.setval( other, 'gone', 'after restore' )
+    assert shmht.restore( other, snapfile, 2 ) == 499
+    assert contents( other ) == expect
+    shmht.close( other )
+
+with pycode.test('restore-too-small') :
+    safe_rm(restorefile)
+    other = shmht.open( restorefile, 10 )
+    try :
+        shmht.restore( other, snapfile )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    shmht.close( other )
+
+with pycode.test('restore-corrupt') :
+    f = open( snapfile, 'r+b' )
+    f.seek( 200 )
+    f.write( 'X' )
+    f.close()
+    try :
+        shmht.restore( ident, snapfile )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    assert contents( ident ) == expect
+
+shmht.close( ident )
+
+with pycode.test('delta') :
+    deltafile = 'test_snapshot.delta'
+    safe_rm(testfile)
+    safe_rm(restorefile)
+    ident = shmht.open( testfile, 1000 )
+    for x in expect :
+        shmht.setval( ident, x, expect[x] )
+    shmht.snapshot( ident, snapfile )
+
+    shmht.setval( ident, '7', 'back again' )
+    shmht.setval( ident, '8', 'changed' )
+    shmht.remove( ident, '9' )
+    assert shmht.snapshot( ident, deltafile, snapfile ) < 499
+
+    other = shmht.open( restorefile, 1000 )
+    try :
+        shmht.restore( other, deltafile )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'delta should need its base'
+    shmht.restore( other, snapfile )
+    shmht.restore( other, deltafile )
+    assert contents( other ) == contents( ident )
+    shmht.close( other )
+    shmht.close( ident )
+
+with pycode.test('backup-needs-flag') :
+    ident = shmht.open( testfile )
+    try :
+        shmht.backup( ident, snapfile )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    shmht.close( ident )
+
+with pycode.test('backup') :
+    safe_rm(testfile)
+    ident = shmht.open( testfile, 1000, 0, shmht.BACKUP )
+    for x in expect :
+        shmht.setval( ident, x, expect[x] )
+    assert shmht.backup( ident, snapfile ) == 499
+    other = shmht.open( restorefile, 2000, 1 )
+    assert shmht.restore( other, snapfile ) == 499
+    assert contents( other ) == expect
+    shmht.close( other )
+    shmht.close( ident )
@@ -0,0 +1,50 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+from ext_shmht.HashTable import HashTable
+
+testfile = 'test_split.dat'
+snapfile = 'test_split.snap'
+
+def cleanup():
+    safe_rm(testfile)
+    safe_rm(snapfile)
+
+cleanup()
+
+with pycode.test('split') :
+    h = HashTable( testfile, 5000, force_init=True, flags=shmht.SPLIT )
+    for x in range(3000):
+        h[str(x)] = str(x) + ' data'
+    assert h['2999'] == '2999 data'
+    assert h.get( 'nope' ) == None
+    h['5'] = 'changed'
+    assert h['5'] == 'changed'
+    del h['6']
+    assert '6' not in h
+    used, live, size = h.log_usage()
+    assert used > live
+
+with pycode.test('split-compact') :
+    h.compact()
+    assert h['5'] == 'changed'
+    assert h['2999'] == '2999 data'
+    assert len( h.to_dict() ) == 2999
+
+with pycode.test('split-reopen') :
+    g = HashTable( testfile, 0, flags=shmht.LOG )
+    assert g['7'] == '7 data'
+    g.close()
+
+with pycode.test('split-snapshot') :
+    h.snapshot( snapfile )
+    h.update( { 'a': 'b' } )
+    h.restore( snapfile )
+    assert 'a' not in h
+    assert h['5'] == 'changed'
+    h.close()
+
+cleanup()
@@ -0,0 +1,110 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import threading
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+from ext_shmht.HashTable import HashTable
+
+testfile = 'test_threads.dat'
+snapfile = 'test_threads.snap'
+
+def cleanup():
+    for f in ( testfile, snapfile ):
+        safe_rm(f)
+
+def run(workers):
+    threads = [ threading.Thread( target=w ) for w in workers ]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+cleanup()
+
+with pycode.test('threads') :
+    h = HashTable( testfile, 10000, force_init=True )
+    errors = [ ]
+    def writer(n, check=True):
+        def w():
+            try :
+                for x in range(1000):
+                    h['%d.%d' % (n, x)] = str(x)
+                    assert not check or h['%d.%d' % (n, x)] == str(x)
+            except Exception as e :
+                errors.append(e)
+        return w
+    run( [ writer(n) for n in range(4) ] )
+    assert errors == [ ]
+    assert len( h.to_dict() ) == 4000
+
+with pycode.test('threads-snapshot') :
+    def snapshots():
+        try :
+            for i in range(20):
+                h.snapshot( snapfile )
+                assert len( h.to_dict() ) >= 4000
+        except Exception as e :
+            errors.append(e)
+    def remover():
+        try :
+            for x in range(1000):
+                del h['0.%d' % x]
+                h['5.%d' % x] = 'new'
+        except Exception as e :
+            errors.append(e)
+    run( [ snapshots, remover, writer(6) ] )
+    assert errors == [ ]
+    d = h.to_dict()
+    assert len( d ) == 5000 and d['5.999'] == 'new' and '0.1' not in d
+
+with pycode.test('threads-restore') :
+    h.snapshot( snapfile )
+    def restorer():
+        try :
+            for i in range(5):
+                h.restore( snapfile, 2 )
+        except Exception as e :
+            errors.append(e)
+    run( [ restorer, writer(1, False), writer(7, False) ] )
+    assert errors == [ ]
+    h.restore( snapfile )
+    assert h.to_dict() == d
+    h.close()
+
+with pycode.test('threads-close') :
+    # close is refused while another thread works on the table without
+    # the GIL; after it, the other threads get an error, not a crash
+    h = HashTable( testfile )
+    stopped = [ ]
+    started = threading.Event()
+    def snapshots():
+        try :
+            while True:
+                h.snapshot( snapfile )
+                started.set()
+        except shmht.error as e :
+            stopped.append( 'snapshot' )
+    def reader():
+        try :
+            while True:
+                assert h['5.999'] == 'new'
+        except shmht.error as e :
+            stopped.append( 'reader' )
+    threads = [ threading.Thread( target=f ) for f in ( snapshots, reader ) ]
+    for t in threads:
+        t.start()
+    started.wait()
+    refused = 0
+    while True:
+        try :
+            h.close()
+            break
+        except shmht.error as e :
+            refused += 1
+    for t in threads:
+        t.join()
+    assert sorted( stopped ) == [ 'reader', 'snapshot' ]
+
+cleanup()
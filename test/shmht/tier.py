@@ -0,0 +1,91 @@
+# using Pandokia - http://ssb.stsci.edu/testing/pandokia
+#
+import pandokia.helpers.pycode as pycode
+from   pandokia.helpers.filecomp import safe_rm
+
+import shmht
+from ext_shmht.HashTable import HashTable
+
+testfile = 'test_tier.dat'
+coldfile = 'test_tier.cold'
+smallfile = 'test_tier_small.dat'
+smallcold = 'test_tier_small.cold'
+
+def cleanup():
+    for f in ( testfile, coldfile, smallfile, smallcold ):
+        safe_rm(f)
+
+cleanup()
+
+with pycode.test('tier') :
+    h = HashTable( testfile, 1000, force_init=True, cold_path=coldfile )
+    for x in range(1000):
+        h[str(x)] = str(x) + ' data'
+    live, cold_live, cold_used, cold_size = h.tier_usage()
+    assert cold_live == cold_used == 0 and cold_size > 0
+    assert h.demote( 3600 ) == 0
+    moved = h.demote( 0 )
+    assert moved == live
+    assert h.tier_usage()[:3] == ( 0, moved, moved )
+    assert all( h[str(x)] == str(x) + ' data' for x in range(1000) )
+    h.compact()
+    assert h.log_usage()[0] == 0
+
+with pycode.test('tier-promote') :
+    assert h.set_promote( True ) == False
+    for x in range(10):
+        assert h[str(x)] == str(x) + ' data'
+    live, cold_live, cold_used, cold_size = h.tier_usage()
+    assert live == moved / 100 and cold_live == moved - live and cold_used == moved
+    h['10'] = 'changed'
+    del h['11']
+    assert h.tier_usage()[1] < cold_live
+    h.set_promote( False )
+
+with pycode.test('tier-reopen') :
+    h.close()
+    r = HashTable( testfile, readonly=True )
+    assert r['500'] == '500 data'
+    assert r['10'] == 'changed' and '11' not in r
+    r.close()
+    h = HashTable( testfile )
+    assert h['999'] == '999 data'
+    assert h.tier_usage()[2] == moved
+
+with pycode.test('tier-snapshot') :
+    snap = testfile + '.snap'
+    h.snapshot( snap )
+    h.restore( snap )
+    safe_rm( snap )
+    assert h.tier_usage()[1:3] == ( 0, 0 )
+    assert h['999'] == '999 data' and len( h.to_dict() ) == 999
+    h.close()
+
+with pycode.test('tier-full') :
+    h = HashTable( smallfile, 1000, force_init=True, cold_path=smallcold, cold_size=4096 )
+    for x in range(1000):
+        h[str(x)] = 'x' * 100
+    moved = h.demote( 0 )
+    assert 0 < moved <= 4096
+    assert h.demote( 0 ) == 0
+    assert all( h[str(x)] == 'x' * 100 for x in range(1000) )
+    h.close()
+
+with pycode.test('tier-refused') :
+    for args in ( dict( flags=shmht.TIERED ), dict( flags=shmht.MULTI, cold_path=smallcold ) ):
+        try :
+            HashTable( testfile, 1000, force_init=True, **args )
+        except shmht.error as e :
+            pass
+        else :
+            assert False, 'should have raised an exception'
+    h = HashTable( smallfile )
+    try :
+        shmht.grow( h.fd, 5000 )
+    except shmht.error as e :
+        pass
+    else :
+        assert False, 'should have raised an exception'
+    h.close()
+
+cleanup()